@@ -1,53 +1,29 @@
 #pragma once
 
-#include <Eigen/Core>
-
-#include <vector>
-
 namespace kd_trees
 {
 
-class KdNode {
-private:
-  KdNode * lChild;// point(splitDim) <= splitValue
-  KdNode * uChild;// point(splitDim)  > splitValue
-  int splitDim;
-  double splitValue;
-  std::vector<Eigen::VectorXd> points;
-
-public:
+/// A node of a KdTree, nodes are stored in a contiguous array owned by the
+/// tree and refer to each other by their index in this array.
+///
+/// Only leaves contain points: the points of a leaf are stored in a block of
+/// the point buffer of the tree, starting at 'start' and able to hold
+/// 'capacity' points.
+struct KdNode {
   KdNode();
 
   bool isLeaf() const;
 
-  /// Add the leaves of the given node to the provided vector
-  void addLeaves(std::vector<KdNode *> & leaves);
-
-  // Get the leaf corresponding to the given point
-  KdNode * getLeaf(const Eigen::VectorXd &point);
-  const KdNode * getLeaf(const Eigen::VectorXd &point) const;
-
-  const KdNode * getLowerChild() const;
-  const KdNode * getUpperChild() const;
-  int getSplitDim() const;
-  double getSplitVal() const;
-  
-
-  // Add the point to the current tree
-  void push(const Eigen::VectorXd &point);
-
-  // Remove the last point pushed into this node
-  void pop_back();
-
-  // Split node and add separate points to his child
-  void split(int splitDim, double splitValue);
-
-  // Update the given space to match the space of the leaf concerning the
-  // provided point space is a N by 2 matrix where space(d,0) is the min and
-  // space(d,1) is the max
-  void leafSpace(Eigen::MatrixXd &space, const Eigen::VectorXd &point) const;
-
-  const std::vector<Eigen::VectorXd> &getPoints() const;
+  int lChild;// point(splitDim) <= splitValue, -1 for leaves
+  int uChild;// point(splitDim)  > splitValue, -1 for leaves
+  int splitDim;
+  double splitValue;
+  /// First index of the block of the leaf in the point buffer (-1 if no block)
+  int start;
+  /// Number of points in the leaf
+  int nbPoints;
+  /// Number of points the block can hold
+  int capacity;
 };
 
 }
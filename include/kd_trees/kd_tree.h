@@ -2,28 +2,152 @@
 
 #include "kd_trees/kd_node.h"
 
+#include <Eigen/Core>
+
+#include <vector>
+
 namespace kd_trees {
 
+/// A kd-tree whose nodes are stored in a contiguous array, nodes are
+/// identified by their index, the root being 0. Indices of nodes remain valid
+/// when the tree grows.
+///
+/// Points are stored in a single buffer with a structure of arrays layout:
+/// the coordinates of all the points along a dimension are contiguous. Each
+/// leaf owns a block of the buffer whose capacity is a power of two, a block
+/// is moved to a larger one when it is full and blocks released by splits
+/// are reused for further allocations.
 class KdTree {
+public:
+  /// A point of the tree found by a query, leaf and index are only valid
+  /// until the next modification of the tree
+  struct Neighbor {
+    int leaf;
+    /// Index of the point inside the leaf
+    int index;
+    /// Squared euclidean distance to the query point
+    double squaredDist;
+  };
+
 private:
-  KdNode root;
+  /// Buffers reused by the queries of a batch
+  struct QueryBuffers {
+    /// Nodes to explore and lower bound of their squared distance
+    std::vector<std::pair<int, double>> stack;
+    /// Squared distances to the points of the current leaf
+    std::vector<double> distances;
+  };
+
+  std::vector<KdNode> nodes;
   Eigen::MatrixXd space;
+  /// coordinates[dim][i]: coordinate along 'dim' of the point i of the buffer
+  std::vector<std::vector<double>> coordinates;
+  /// Number of points the buffer can hold
+  int buffer_size;
+  /// free_blocks[k]: start of the available blocks with capacity
+  /// 'min_capacity << k'
+  std::vector<std::vector<int>> free_blocks;
+
+  /// Return the start of a block able to hold at least 'nb_points' points,
+  /// its capacity is written in 'capacity'
+  int allocateBlock(int nb_points, int * capacity);
+  /// Make the block available for further allocations
+  void releaseBlock(int start, int capacity);
+
+  void checkLeaf(int node, const char * method) const;
+
+  /// Fill buffers->distances with the squared distances from the points of
+  /// the leaf to 'point', the loops run over the contiguous coordinates of
+  /// each dimension so that they can be vectorized by the compiler
+  void computeSquaredDistances(int leaf, const Eigen::VectorXd &point,
+                               QueryBuffers * buffers) const;
+
+  /// Explore the leaves which might contain points closer than the current
+  /// threshold, 'onLeaf' handles the distances of each leaf explored and
+  /// updates the threshold
+  template <typename LeafHandler>
+  void explore(const Eigen::VectorXd &point, double * threshold,
+               QueryBuffers * buffers, LeafHandler onLeaf) const;
+
+  void getKNearest(const Eigen::VectorXd &point, int k,
+                   QueryBuffers * buffers,
+                   std::vector<Neighbor> * neighbors) const;
+  void getWithinRadius(const Eigen::VectorXd &point, double radius,
+                       QueryBuffers * buffers,
+                       std::vector<Neighbor> * neighbors) const;
+
+  void checkQuery(const Eigen::VectorXd &point, const char * method) const;
 
 public:
+  /// Capacity of the smallest blocks of the point buffer
+  static const int min_capacity;
+
   KdTree(const Eigen::MatrixXd &space);
 
   int dim() const;
-  const KdNode * getRoot() const;
+  int nbNodes() const;
+
+  /// Index of the root (always 0)
+  int getRoot() const;
+  const KdNode & getNode(int node) const;
+
+  bool isLeaf(int node) const;
+  int getLowerChild(int node) const;
+  int getUpperChild(int node) const;
+  int getSplitDim(int node) const;
+  double getSplitVal(int node) const;
+
+  /// Return the index of all the leaves inside the tree
+  std::vector<int> getLeaves() const;
+
+  /// Return the index of the leaf containing the given point
+  int getLeaf(const Eigen::VectorXd &point) const;
+  /// Return the index of the leaf containing the given point and write the
+  /// space of the leaf in 'leaf_space' with a single descent, leaf_space is
+  /// only resized if it does not have the dimensions of the space
+  int getLeafWithSpace(const Eigen::VectorXd &point,
+                       Eigen::MatrixXd * leaf_space) const;
+
+  /// Number of points stored in the leaf
+  int getNbPoints(int leaf) const;
+  /// Coordinates of the points of the leaf along the given dimension, only
+  /// valid until the next modification of the tree
+  const double * getCoordinates(int leaf, int dim) const;
+  /// Return the point with the given index inside the leaf
+  Eigen::VectorXd getPoint(int leaf, int index) const;
+
+  /// Add the point to the leaf containing it and return the index of the leaf
+  int push(const Eigen::VectorXd &point);
+  /// Add the point to the given leaf
+  void push(int leaf, const Eigen::VectorXd &point);
+  /// Remove the last point pushed into the leaf
+  void popBack(int leaf);
 
-  /// Return all the leaves inside the tree
-  std::vector<KdNode *> getLeaves();
+  /// Split the leaf and move its points to its children
+  void split(int leaf, int splitDim, double splitValue);
 
-  KdNode * getLeaf(const Eigen::VectorXd &point);
-  const KdNode * getLeaf(const Eigen::VectorXd &point) const;
+  /// Fill 'neighbors' with the k points closest to 'point' (euclidean
+  /// distance) by increasing distance, less than k points are returned if
+  /// the tree does not contain enough points
+  void getKNearest(const Eigen::VectorXd &point, int k,
+                   std::vector<Neighbor> * neighbors) const;
+  /// Batched version: column i of points is the i-th query and
+  /// (*neighbors)[i] its result
+  void getKNearest(const Eigen::MatrixXd &points, int k,
+                   std::vector<std::vector<Neighbor>> * neighbors) const;
 
-  void push(const Eigen::VectorXd &point);
+  /// Fill 'neighbors' with all the points at a distance lower or equal to
+  /// radius from 'point', by increasing distance
+  void getWithinRadius(const Eigen::VectorXd &point, double radius,
+                       std::vector<Neighbor> * neighbors) const;
+  /// Batched version: column i of points is the i-th query and
+  /// (*neighbors)[i] its result
+  void getWithinRadius(const Eigen::MatrixXd &points, double radius,
+                       std::vector<std::vector<Neighbor>> * neighbors) const;
 
   const Eigen::MatrixXd & getSpace() const;
+  /// Return the space of the leaf containing the provided point, space is a N
+  /// by 2 matrix where space(d,0) is the min and space(d,1) is the max
   Eigen::MatrixXd getSpace(const Eigen::VectorXd &point) const;
 };
 
@@ -32,6 +32,17 @@ public:
                                    double discount,
                                    std::default_random_engine * engine = nullptr) const = 0;
 
+  /// Same as optimize, but result_function allows to simulate several
+  /// trajectories simultaneously. Default implementation calls the
+  /// non-batched version with transitions computed one by one.
+  virtual Eigen::VectorXd optimize(const Eigen::VectorXd & input,
+                                   const Eigen::MatrixXd & action_limits,
+                                   std::shared_ptr<const Policy> current_policy,
+                                   Problem::BatchResultFunction result_function,
+                                   Problem::ValueFunction value_function,
+                                   double discount,
+                                   std::default_random_engine * engine = nullptr) const;
+
 protected:
   int nb_threads;
 };
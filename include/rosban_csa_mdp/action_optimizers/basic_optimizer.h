@@ -12,6 +12,7 @@ class BasicOptimizer : public ActionOptimizer
 public:
   BasicOptimizer();
 
+  /// Trajectories are simulated by batches, see the batched version
   virtual Eigen::VectorXd optimize(const Eigen::VectorXd & input,
                                    const Eigen::MatrixXd & action_limits,
                                    std::shared_ptr<const Policy> current_policy,
@@ -20,12 +21,20 @@ public:
                                    double discount,
                                    std::default_random_engine * engine) const override;
 
+  virtual Eigen::VectorXd optimize(const Eigen::VectorXd & input,
+                                   const Eigen::MatrixXd & action_limits,
+                                   std::shared_ptr<const Policy> current_policy,
+                                   Problem::BatchResultFunction result_function,
+                                   Problem::ValueFunction value_function,
+                                   double discount,
+                                   std::default_random_engine * engine) const override;
+
   typedef std::function<void(int start, int end, std::default_random_engine * engine)> AOTask;
 
   virtual AOTask getTask(const Eigen::VectorXd & input,
                          const Eigen::MatrixXd & actions,
                          std::shared_ptr<const Policy> policy,
-                         Problem::ResultFunction result_function,
+                         Problem::BatchResultFunction result_function,
                          Problem::ValueFunction value_function,
                          double discount,
                          Eigen::VectorXd & results) const;
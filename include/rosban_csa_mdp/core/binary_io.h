@@ -0,0 +1,102 @@
+#pragma once
+
+#include <Eigen/Core>
+
+#include <cstdint>
+#include <iostream>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+/// Helpers for the compact binary files used by checkpoints. Values are
+/// written in native byte order, therefore files are meant to be read on the
+/// machine which produced them.
+namespace csa_mdp
+{
+namespace binary_io
+{
+
+/// Write the raw bytes of a trivially copyable value
+template <typename T>
+void write(std::ostream & out, const T & value)
+{
+  out.write((const char *)&value, sizeof(T));
+}
+
+/// Read a trivially copyable value, throws a std::runtime_error if the stream
+/// ends before the value
+template <typename T>
+T read(std::istream & in)
+{
+  T value;
+  in.read((char *)&value, sizeof(T));
+  if (!in.good()) {
+    throw std::runtime_error("binary_io::read: unexpected end of stream");
+  }
+  return value;
+}
+
+/// Write the dimensions of the matrix, then its content (column-major)
+template <typename Derived>
+void writeMatrix(std::ostream & out, const Eigen::PlainObjectBase<Derived> & m)
+{
+  write<uint64_t>(out, m.rows());
+  write<uint64_t>(out, m.cols());
+  out.write((const char *)m.data(), m.size() * sizeof(typename Derived::Scalar));
+}
+
+/// Read a matrix written by writeMatrix, m is resized
+template <typename Derived>
+void readMatrix(std::istream & in, Eigen::PlainObjectBase<Derived> * m)
+{
+  uint64_t rows = read<uint64_t>(in);
+  uint64_t cols = read<uint64_t>(in);
+  m->resize(rows, cols);
+  in.read((char *)m->data(), m->size() * sizeof(typename Derived::Scalar));
+  if (!in.good()) {
+    throw std::runtime_error("binary_io::readMatrix: unexpected end of stream");
+  }
+}
+
+inline void writeVector(std::ostream & out, const std::vector<double> & v)
+{
+  write<uint64_t>(out, v.size());
+  out.write((const char *)v.data(), v.size() * sizeof(double));
+}
+
+inline std::vector<double> readVector(std::istream & in)
+{
+  std::vector<double> v(read<uint64_t>(in));
+  in.read((char *)v.data(), v.size() * sizeof(double));
+  if (!in.good()) {
+    throw std::runtime_error("binary_io::readVector: unexpected end of stream");
+  }
+  return v;
+}
+
+/// Write the magic string and the version of a file
+inline void writeHeader(std::ostream & out, const char magic[8], uint32_t version)
+{
+  out.write(magic, 8);
+  write<uint32_t>(out, version);
+}
+
+/// Throws a std::runtime_error if the magic string or the version read do not
+/// match the expected ones, 'context' is used in the message
+inline void checkHeader(std::istream & in, const char magic[8], uint32_t version,
+                        const std::string & context)
+{
+  char read_magic[8];
+  in.read(read_magic, 8);
+  if (!in.good() || std::string(read_magic, 8) != std::string(magic, 8)) {
+    throw std::runtime_error(context + ": invalid file type");
+  }
+  uint32_t read_version = read<uint32_t>(in);
+  if (read_version != version) {
+    throw std::runtime_error(context + ": unsupported version " +
+                             std::to_string(read_version));
+  }
+}
+
+}
+}
@@ -0,0 +1,110 @@
+#pragma once
+
+#include <fstream>
+#include <string>
+#include <vector>
+
+namespace csa_mdp
+{
+
+/// A streaming reader for numerical csv files.
+///
+/// The file is read by chunks in an internal buffer and lines are tokenized in
+/// place: separators are replaced by '\0' and values are parsed directly from
+/// the buffer. Neither the lines nor the fields are copied to std::string, and
+/// once the buffer has grown to the size of the longest line, reading a row
+/// does not allocate memory.
+///
+/// A reader can be restricted to the range [begin, end[ of the file, in this
+/// case it handles all the rows *starting* inside the range. This allows to
+/// split a large file in several chunks parsed by different threads.
+class CSVReader
+{
+public:
+  /// Statistics on the parsing of a file
+  struct Stats
+  {
+    Stats();
+
+    double getRowsPerSec() const;
+
+    /// Number of rows parsed (header excluded)
+    size_t rows;
+    /// Time spent parsing the file [s]
+    double elapsed;
+  };
+
+  /// Read the whole file
+  CSVReader(const std::string & path,
+            char separator = ',',
+            size_t buffer_size = default_buffer_size);
+
+  /// Only read the rows starting in [begin, end[
+  CSVReader(const std::string & path,
+            size_t begin, size_t end,
+            char separator = ',',
+            size_t buffer_size = default_buffer_size);
+
+  /// Tokenize the next row of the range, return false if there is no row left.
+  /// Empty lines are skipped. Fields of the previous row are invalidated.
+  bool nextRow();
+
+  /// Number of fields in the current row
+  int nbCols() const;
+
+  /// Offset [bytes] of the beginning of the current row in the file
+  size_t getRowOffset() const;
+
+  /// Access to the raw content of a field, throws a std::runtime_error if the
+  /// column is not available in the current row
+  const char * getField(int col) const;
+
+  /// Parse the given field of the current row as a double, throws a
+  /// std::runtime_error if the field is not a valid number
+  double getDouble(int col) const;
+
+  /// Parse the given field of the current row as an integer, throws a
+  /// std::runtime_error if the field is not a valid number
+  long getLong(int col) const;
+
+  /// Return the size of the file in bytes, throws a std::runtime_error if the
+  /// file cannot be opened
+  static size_t getFileSize(const std::string & path);
+
+  /// Default size for the reading buffer [bytes]
+  static const size_t default_buffer_size;
+
+private:
+  void open(size_t begin, size_t end, size_t buffer_size);
+
+  /// Move remaining data to the beginning of the buffer and read a new chunk,
+  /// grows the buffer if it is full. Return false if no data could be read.
+  bool refill();
+
+  /// Split the line [line_start, line_end[ in place
+  void tokenize(char * line_start, char * line_end);
+
+  std::string path;
+  std::ifstream file;
+  char separator;
+
+  /// The reading buffer, one byte is always kept available to terminate the
+  /// last line if the file does not end with a newline
+  std::vector<char> buffer;
+  /// Offset of buffer[0] in the file
+  size_t buffer_offset;
+  /// Unprocessed data is in buffer[data_start, data_end[
+  size_t data_start;
+  size_t data_end;
+  /// Rows starting after this offset are not read
+  size_t end_offset;
+  /// True once the whole file has been read
+  bool file_ended;
+
+  /// Offset of the current row in the file
+  size_t row_offset;
+  /// Pointers to the beginning of the fields of the current row
+  std::vector<const char *> fields;
+};
+
+}
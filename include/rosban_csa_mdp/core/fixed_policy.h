@@ -0,0 +1,107 @@
+#pragma once
+
+#include "rosban_csa_mdp/core/policy.h"
+
+#include <sstream>
+#include <stdexcept>
+
+namespace csa_mdp
+{
+
+/// A policy for problems whose dimensions are known at compile time.
+///
+/// States and actions use fixed-size Eigen types, therefore computing an
+/// action with getFixedAction does not allocate memory. As for the classic
+/// interface, the first dimension of an action is the action id, thus an
+/// Action has ActionDim + 1 rows. All the action spaces are expected to have
+/// ActionDim dimensions.
+///
+/// The dynamic interface of Policy is provided as an adapter, so that fixed
+/// policies can be used everywhere a Policy is expected.
+template <int StateDim, int ActionDim>
+class FixedPolicy : public Policy
+{
+public:
+  typedef Eigen::Matrix<double, StateDim, 1> State;
+  typedef Eigen::Matrix<double, ActionDim + 1, 1> Action;
+
+  /// Write in 'action' the raw action for the given state
+  virtual void getFixedRawAction(const State & state,
+                                 std::default_random_engine * engine,
+                                 Action * action) const = 0;
+
+  /// Write in 'action' the bounded action for the given state
+  void getFixedAction(const State & state,
+                      std::default_random_engine * engine,
+                      Action * action) const
+  {
+    getFixedRawAction(state, engine, action);
+    boundFixedAction(action);
+  }
+
+  /// Bound the action in place, throws a std::runtime_error if the action id
+  /// or the number of dimensions of the action space is invalid
+  void boundFixedAction(Action * action) const
+  {
+    int action_id = (int)(*action)(0);
+    int max_action = action_limits.size() - 1;
+    if (action_id < 0 || action_id > max_action) {
+      std::ostringstream oss;
+      oss << "FixedPolicy::boundFixedAction: action_id is invalid: "
+          << action_id << " is not in [0," << max_action << "]";
+      throw std::runtime_error(oss.str());
+    }
+    const Eigen::MatrixXd & limits = action_limits[action_id];
+    if (limits.rows() != ActionDim) {
+      std::ostringstream oss;
+      oss << "FixedPolicy::boundFixedAction: Number of rows does not match ("
+          << ActionDim << " while " << limits.rows() << " were expected)";
+      throw std::runtime_error(oss.str());
+    }
+    for (int dim = 1; dim <= ActionDim; dim++) {
+      (*action)(dim) = std::min(limits(dim-1,1), std::max(limits(dim-1,0), (*action)(dim)));
+    }
+  }
+
+  /// Adapter to the dynamic interface
+  virtual Eigen::VectorXd getRawAction(const Eigen::VectorXd & state,
+                                       std::default_random_engine * engine) const override
+  {
+    if (state.rows() != StateDim) {
+      std::ostringstream oss;
+      oss << "FixedPolicy::getRawAction: invalid state dimension ("
+          << state.rows() << " while " << StateDim << " was expected)";
+      throw std::runtime_error(oss.str());
+    }
+    Action action;
+    getFixedRawAction(state, engine, &action);
+    return action;
+  }
+
+  using Policy::getRawAction;
+
+  /// Compute the actions column by column using fixed-size buffers
+  virtual void getActions(const Eigen::MatrixXd & states,
+                          std::default_random_engine * engine,
+                          Eigen::MatrixXd * actions) const override
+  {
+    if (states.rows() != StateDim) {
+      std::ostringstream oss;
+      oss << "FixedPolicy::getActions: invalid state dimension ("
+          << states.rows() << " while " << StateDim << " was expected)";
+      throw std::runtime_error(oss.str());
+    }
+    if (actions->rows() != ActionDim + 1 || actions->cols() != states.cols()) {
+      actions->resize(ActionDim + 1, states.cols());
+    }
+    State state;
+    Action action;
+    for (int i = 0; i < states.cols(); i++) {
+      state = states.col(i);
+      getFixedAction(state, engine, &action);
+      actions->col(i) = action;
+    }
+  }
+};
+
+}
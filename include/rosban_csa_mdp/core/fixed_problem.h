@@ -0,0 +1,164 @@
+#pragma once
+
+#include "rosban_csa_mdp/core/black_box_problem.h"
+#include "rosban_csa_mdp/core/fixed_policy.h"
+
+namespace csa_mdp
+{
+
+/// A BlackBoxProblem whose dimensions are known at compile time.
+///
+/// Transitions are computed by 'step' on fixed-size Eigen types and results
+/// are written in place, therefore simulating a step does not allocate
+/// memory. The dynamic interface of Problem is provided as an adapter, the
+/// batch interface (getSuccessors) does not allocate memory if the output
+/// buffers already have the appropriate size.
+///
+/// When sampleRolloutReward is used with a FixedPolicy of the same
+/// dimensions, the whole rollout runs without allocation, otherwise it falls
+/// back on the dynamic interface.
+template <int StateDim, int ActionDim>
+class FixedProblem : public BlackBoxProblem
+{
+public:
+  typedef FixedPolicy<StateDim, ActionDim> FixedPolicyType;
+  typedef typename FixedPolicyType::State State;
+  typedef typename FixedPolicyType::Action Action;
+
+  /// Sample the successor of (state, action), its reward and terminal status
+  virtual void step(const State & state,
+                    const Action & action,
+                    std::default_random_engine * engine,
+                    State * successor,
+                    double * reward,
+                    bool * terminal) const = 0;
+
+  /// By which state should the episode start
+  virtual State getFixedStartingState(std::default_random_engine * engine) const = 0;
+
+  /// Adapter to the dynamic interface
+  virtual Eigen::VectorXd getStartingState(std::default_random_engine * engine) const override
+  {
+    return getFixedStartingState(engine);
+  }
+
+  /// Adapter to the dynamic interface
+  virtual Result getSuccessor(const Eigen::VectorXd & state,
+                              const Eigen::VectorXd & action,
+                              std::default_random_engine * engine) const override
+  {
+    checkDims(state, action);
+    State successor;
+    Result result;
+    step(state, action, engine, &successor, &result.reward, &result.terminal);
+    result.successor = successor;
+    return result;
+  }
+
+  /// Compute the transitions column by column using fixed-size buffers
+  virtual void getSuccessors(const Eigen::MatrixXd & states,
+                             const Eigen::MatrixXd & actions,
+                             std::default_random_engine * engine,
+                             Eigen::MatrixXd * successors,
+                             Eigen::VectorXd * rewards,
+                             TerminalFlags * terminals) const override
+  {
+    if (states.rows() != StateDim || actions.rows() != ActionDim + 1 ||
+        states.cols() != actions.cols()) {
+      std::ostringstream oss;
+      oss << "FixedProblem::getSuccessors: dimensions mismatch: received states ("
+          << states.rows() << "x" << states.cols() << ") and actions ("
+          << actions.rows() << "x" << actions.cols() << ")";
+      throw std::runtime_error(oss.str());
+    }
+    int nb_transitions = states.cols();
+    if (successors->rows() != StateDim || successors->cols() != nb_transitions) {
+      successors->resize(StateDim, nb_transitions);
+    }
+    if (rewards->rows() != nb_transitions) rewards->resize(nb_transitions);
+    if (terminals->rows() != nb_transitions) terminals->resize(nb_transitions);
+    State state, successor;
+    Action action;
+    for (int i = 0; i < nb_transitions; i++) {
+      state = states.col(i);
+      action = actions.col(i);
+      step(state, action, engine, &successor, &((*rewards)(i)), &((*terminals)(i)));
+      successors->col(i) = successor;
+    }
+  }
+
+  virtual double sampleRolloutReward(const Eigen::VectorXd & initial_state,
+                                     const csa_mdp::Policy & policy,
+                                     int max_horizon,
+                                     double discount,
+                                     std::default_random_engine * engine,
+                                     std::vector<Eigen::VectorXd> * visited_states = nullptr)
+    const override
+  {
+    const FixedPolicyType * fixed_policy = dynamic_cast<const FixedPolicyType *>(&policy);
+    if (fixed_policy == nullptr) {
+      return Problem::sampleRolloutReward(initial_state, policy, max_horizon, discount,
+                                          engine, visited_states);
+    }
+    if (initial_state.rows() != StateDim) {
+      std::ostringstream oss;
+      oss << "FixedProblem::sampleRolloutReward: invalid state dimension ("
+          << initial_state.rows() << " while " << StateDim << " was expected)";
+      throw std::runtime_error(oss.str());
+    }
+    State state = initial_state;
+    return sampleFixedRolloutReward(&state, *fixed_policy, max_horizon, discount,
+                                    engine, visited_states);
+  }
+
+  /// Rollouts are allocation-free if the policy is a FixedPolicy of the same
+  /// dimensions
+  virtual bool hasAllocationFreeRollouts(const csa_mdp::Policy & policy) const override
+  {
+    return dynamic_cast<const FixedPolicyType *>(&policy) != nullptr;
+  }
+
+  /// Allocation-free rollout (unless visited_states is provided), 'state'
+  /// is used as working memory and contains the final state at the end
+  double sampleFixedRolloutReward(State * state,
+                                  const FixedPolicyType & policy,
+                                  int max_horizon,
+                                  double discount,
+                                  std::default_random_engine * engine,
+                                  std::vector<Eigen::VectorXd> * visited_states = nullptr) const
+  {
+    double coeff = 1;
+    double reward = 0;
+    Action action;
+    State successor;
+    for (int i = 0; i < max_horizon; i++) {
+      if (visited_states != nullptr) {
+        visited_states->push_back(*state);
+      }
+      policy.getFixedAction(*state, engine, &action);
+      double step_reward;
+      bool terminal;
+      step(*state, action, engine, &successor, &step_reward, &terminal);
+      reward += coeff * step_reward;
+      *state = successor;
+      coeff *= discount;
+      // Stop predicting steps if a terminal state has been reached
+      if (terminal) break;
+    }
+    return reward;
+  }
+
+private:
+  static void checkDims(const Eigen::VectorXd & state, const Eigen::VectorXd & action)
+  {
+    if (state.rows() != StateDim || action.rows() != ActionDim + 1) {
+      std::ostringstream oss;
+      oss << "FixedProblem::checkDims: dimensions mismatch: received ("
+          << state.rows() << "," << action.rows() << ") while ("
+          << StateDim << "," << (ActionDim + 1) << ") was expected";
+      throw std::runtime_error(oss.str());
+    }
+  }
+};
+
+}
@@ -0,0 +1,120 @@
+#pragma once
+
+#include "rosban_regression_forests/core/forest.h"
+
+#include <Eigen/Core>
+
+#include <vector>
+
+namespace csa_mdp
+{
+
+/// Computes max_a Q(s, a) and the corresponding action for a forest Q whose
+/// input is the concatenation of a state and an action, without building the
+/// projected tree of the forest.
+///
+/// At construction, the trees are flattened and each node stores an upper
+/// bound of the values reachable in its subtree. A query performs a
+/// branch-and-bound search on the action space: the action box is split only
+/// along the splits of the trees which cannot be resolved yet, and boxes whose
+/// bound is not better than the best value found are discarded.
+///
+/// Queries are const and use a Scratch provided by the caller, thus several
+/// threads can query simultaneously, each one with its own Scratch. Once the
+/// buffers of a Scratch have grown, queries on forests with piecewise constant
+/// leaves do not allocate memory.
+///
+/// The query holds pointers to the approximations of the forest, therefore
+/// the forest has to outlive the query and should not be modified.
+class ForestMaxQuery
+{
+public:
+  /// Buffers used during queries
+  class Scratch
+  {
+  public:
+    Scratch();
+  private:
+    friend class ForestMaxQuery;
+    /// Stack of boxes to explore, each box uses 2 * action_dims values
+    /// (min then max along each dimension)
+    std::vector<double> stack_boxes;
+    /// For each box of the stack, the current node of each tree
+    std::vector<int> stack_nodes;
+    /// For each box of the stack, an upper bound of the value
+    std::vector<double> stack_bounds;
+    /// Box currently explored
+    std::vector<double> box;
+    std::vector<int> nodes;
+    /// Buffers for evaluation of approximations
+    Eigen::VectorXd input;
+    Eigen::MatrixXd limits;
+  };
+
+  /// input_limits: the space of the forest (state dimensions, then action
+  ///               dimensions)
+  /// max_tiles   : if > 0, the search stops after evaluating 'max_tiles'
+  ///               boxes of the action space and returns the best one found
+  ForestMaxQuery(const regression_forests::Forest & forest,
+                 const Eigen::MatrixXd & input_limits,
+                 int state_dims, int max_tiles = 0);
+
+  int stateDims() const;
+  int actionDims() const;
+
+  /// Return max_a Q(state, a), if best_action is provided, it is filled with
+  /// the action reaching the maximum (resized only if required)
+  double getMax(const Eigen::VectorXd & state, Scratch * scratch,
+                Eigen::VectorXd * best_action = nullptr) const;
+
+  /// Batched version, column i of states is the i-th query, values(i) and
+  /// best_actions->col(i) are the corresponding results. Outputs are resized
+  /// only if required.
+  void getMax(const Eigen::MatrixXd & states, Scratch * scratch,
+              Eigen::VectorXd * values,
+              Eigen::MatrixXd * best_actions = nullptr) const;
+
+private:
+  struct FlatNode
+  {
+    /// -1 for leaves
+    int split_dim;
+    double split_val;
+    int lower;
+    int upper;
+    /// Upper bound of the values reachable in the subtree
+    double max_value;
+    /// Only for leaves, value is used if approximation is constant
+    const regression_forests::Approximation * approximation;
+    bool is_constant;
+    double value;
+  };
+
+  /// Append the node and its subtree to the flat representation, space is
+  /// the part of the input space covered by the node, returns the index of
+  /// the node
+  int flatten(const regression_forests::Node * node, Eigen::MatrixXd & space);
+
+  /// Move the current nodes of the scratch as deep as possible given the
+  /// state and the current box, returns the index of the first tree whose
+  /// node cannot be resolved or -1 if all the nodes are leaves
+  int resolve(const Eigen::VectorXd & state, Scratch * scratch) const;
+
+  /// Evaluate the box once all the current nodes are leaves, best_action is
+  /// only filled if the value is greater than best_value
+  void evaluateLeaves(const Eigen::VectorXd & state, Scratch * scratch,
+                      double * best_value, Eigen::VectorXd * best_action) const;
+
+  /// Push the current box and nodes of the scratch on the stack
+  void pushCurrent(Scratch * scratch, double bound) const;
+
+  std::vector<FlatNode> flat_nodes;
+  /// Index of the root of each tree
+  std::vector<int> roots;
+  Eigen::MatrixXd action_limits;
+  int state_dims;
+  int action_dims;
+  int max_tiles;
+};
+
+}
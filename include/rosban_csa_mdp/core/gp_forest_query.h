@@ -0,0 +1,126 @@
+#pragma once
+
+#include "rosban_regression_forests/core/forest.h"
+
+#include "rosban_gp/gradient_ascent/randomized_rprop.h"
+
+#include <Eigen/Core>
+
+#include <vector>
+
+namespace csa_mdp
+{
+
+/// Computes max_a Q(s, a) by gradient ascent for a forest Q whose input is
+/// the concatenation of a state and an action and whose leaves are
+/// differentiable approximations (typically gaussian processes).
+///
+/// The trees are flattened once at construction. Before optimizing the
+/// action for a given state, the forest is projected on the state: splits on
+/// state dimensions are resolved once, so that each of the many evaluations
+/// performed by the gradient ascent only goes through splits on the action
+/// dimensions and directly evaluates the approximations of the leaves, which
+/// keep their own precomputed factorization. Values and gradients are
+/// computed in a single pass and the last evaluation is cached, since
+/// RandomizedRProp scores the points where it has already computed the
+/// gradient.
+///
+/// Queries are const and use a Scratch provided by the caller, thus several
+/// threads can query simultaneously, each one with its own Scratch.
+///
+/// The query holds pointers to the approximations of the forest, therefore
+/// the forest has to outlive the query and should not be modified.
+class GPForestQuery
+{
+public:
+  /// Projection of the forest on a state and buffers used during queries
+  class Scratch
+  {
+  public:
+    Scratch();
+  private:
+    friend class GPForestQuery;
+    struct ProjectedNode
+    {
+      /// Action dimension of the split, -1 for leaves
+      int split_dim;
+      double split_val;
+      int lower;
+      int upper;
+      const regression_forests::Approximation * approximation;
+    };
+    std::vector<ProjectedNode> nodes;
+    /// Index of the root of each projected tree
+    std::vector<int> roots;
+    /// Input of the approximations: current state, then action
+    Eigen::VectorXd input;
+    /// Last evaluation: only valid if has_last is true
+    bool has_last;
+    Eigen::VectorXd last_action;
+    double last_value;
+    Eigen::VectorXd last_gradient;
+  };
+
+  /// input_limits: the space of the forest (state dimensions, then action
+  ///               dimensions)
+  GPForestQuery(const regression_forests::Forest & forest,
+                const Eigen::MatrixXd & input_limits,
+                int state_dims);
+
+  int stateDims() const;
+  int actionDims() const;
+
+  /// Project the forest on the given state, required before evaluations
+  void setState(const Eigen::VectorXd & state, Scratch * scratch) const;
+
+  /// Value of the forest for the current state of the scratch and the given
+  /// action, if action_gradient is provided, it is filled with the gradient
+  /// with respect to the action dimensions
+  double getValue(const Eigen::VectorXd & action, Scratch * scratch,
+                  Eigen::VectorXd * action_gradient = nullptr) const;
+
+  /// Return max_a Q(state, a) found by RandomizedRProp, if best_action is
+  /// provided, it is filled with the corresponding action
+  double getMax(const Eigen::VectorXd & state,
+                const rosban_gp::RandomizedRProp::Config & rprop_conf,
+                Scratch * scratch,
+                Eigen::VectorXd * best_action = nullptr) const;
+
+  /// Batched version, column i of states is the i-th query, values(i) and
+  /// best_actions->col(i) are the corresponding results. Outputs are resized
+  /// only if required.
+  void getMax(const Eigen::MatrixXd & states,
+              const rosban_gp::RandomizedRProp::Config & rprop_conf,
+              Scratch * scratch,
+              Eigen::VectorXd * values,
+              Eigen::MatrixXd * best_actions = nullptr) const;
+
+private:
+  struct FlatNode
+  {
+    /// -1 for leaves
+    int split_dim;
+    double split_val;
+    int lower;
+    int upper;
+    /// Only for leaves
+    const regression_forests::Approximation * approximation;
+  };
+
+  /// Append the node and its subtree to the flat representation, returns the
+  /// index of the node
+  int flatten(const regression_forests::Node * node);
+
+  /// Append the projection of the subtree of flat node 'node_id' on 'state'
+  /// to the nodes of the scratch, returns the index of the projected node
+  int project(int node_id, const Eigen::VectorXd & state, Scratch * scratch) const;
+
+  std::vector<FlatNode> flat_nodes;
+  /// Index of the root of each tree
+  std::vector<int> roots;
+  Eigen::MatrixXd action_limits;
+  int state_dims;
+  int action_dims;
+};
+
+}
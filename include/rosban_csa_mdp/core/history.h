@@ -1,6 +1,8 @@
 #pragma once
 
+#include "rosban_csa_mdp/core/csv_reader.h"
 #include "rosban_csa_mdp/core/problem.h"
+#include "rosban_csa_mdp/core/sample_store.h"
 
 #include <memory>
 
@@ -36,6 +38,8 @@ public:
     int step_column;
     std::vector<int> state_columns;
     std::vector<int> action_columns;
+    /// Number of threads used to parse the log file
+    int nb_threads;
     std::shared_ptr<Problem> problem;
   };
 
@@ -46,12 +50,26 @@ public:
             const Eigen::VectorXd &action,
             double reward);
 
+  /// Number of steps in the history
+  size_t size() const;
+  const Eigen::VectorXd & getState(size_t step) const;
+  const Eigen::VectorXd & getAction(size_t step) const;
+  double getReward(size_t step) const;
+
   /// Transform the content of the history to a batch format (s,a,s',r)
   std::vector<Sample> getBatch() const;
   /// Transform the content of several histories
   static std::vector<Sample> getBatch(const std::vector<History> &histories);
+  /// Transform the content of several histories to a columnar store using the
+  /// given precision, limits are only required for Quantized16 precision
+  static SampleStore getSampleStore(const std::vector<History> &histories,
+                                    SampleStore::Precision precision = SampleStore::Precision::Double,
+                                    const Eigen::MatrixXd &state_limits = Eigen::MatrixXd(),
+                                    const Eigen::MatrixXd &action_limits = Eigen::MatrixXd());
 
-  static std::vector<History> readCSV(const History::Config & conf);
+  /// If stats is provided, it is filled with the parsing statistics
+  static std::vector<History> readCSV(const History::Config & conf,
+                                      CSVReader::Stats * stats = nullptr);
 
   /// Read the history contained in a csv file with classical form:
   /// - column 0 is 'run'
@@ -62,7 +80,9 @@ public:
   /// The file also need to have a header
   static std::vector<History> readCSV(const std::string &path,
                                       int nb_states,
-                                      int nb_actions);
+                                      int nb_actions,
+                                      int nb_threads = 1,
+                                      CSVReader::Stats * stats = nullptr);
 
   /// Read the history contained in a csv file
   /// - path: the location of the file
@@ -72,13 +92,18 @@ public:
   /// - action_cols: the columns containing the action dimensions
   /// - reward_col: the column containing the rewards (if reward_col < 0, reward is not read)
   /// - header: Does the file contain a header?
+  /// - nb_threads: the file is split in chunks aligned on run boundaries and
+  ///               parsed in parallel (only used if run_col >= 0)
+  /// - stats: if provided, filled with the parsing statistics
   static std::vector<History> readCSV(const std::string &path,
                                       int run_col,
                                       int step_col,
                                       const std::vector<int> &state_cols,
                                       const std::vector<int> &action_cols,
                                       int reward_col,
-                                      bool header);
+                                      bool header,
+                                      int nb_threads = 1,
+                                      CSVReader::Stats * stats = nullptr);
 
   /// Read the history contained in a csv file
   /// - path: the location of the file
@@ -88,13 +113,17 @@ public:
   /// - action_cols: the columns containing the action dimensions
   /// - compute_reward: a function allowing to get the reward from (s,a,s')
   /// - header: Does the file contain a header?
+  /// - nb_threads: see above
+  /// - stats: if provided, filled with the parsing statistics
   static std::vector<History> readCSV(const std::string &path,
                                       int run_col,
                                       int step_col,
                                       const std::vector<int> &state_cols,
                                       const std::vector<int> &action_cols,
                                       Problem::RewardFunction compute_reward,
-                                      bool header);
+                                      bool header,
+                                      int nb_threads = 1,
+                                      CSVReader::Stats * stats = nullptr);
 
   /// Read the history contained in a csv file
   /// - path: the location of the file
@@ -33,6 +33,12 @@ public:
   Eigen::VectorXd getAction(const Eigen::VectorXd &state,
                             std::default_random_engine * engine) const;
 
+  /// Retrieve the actions for several states at once: actions->col(i) is the
+  /// action for states.col(i). 'actions' is only resized if required.
+  virtual void getActions(const Eigen::MatrixXd &states,
+                          std::default_random_engine * engine,
+                          Eigen::MatrixXd * actions) const;
+
   /// Retrieve the raw action corresponding to the given state
   virtual Eigen::VectorXd getRawAction(const Eigen::VectorXd &state);
 
@@ -41,6 +41,15 @@ public:
   typedef std::function<Result(const Eigen::VectorXd &state,
                                const Eigen::VectorXd &action,
                                std::default_random_engine * engine)> ResultFunction;
+  /// Terminal status of several transitions
+  typedef Eigen::Array<bool, Eigen::Dynamic, 1> TerminalFlags;
+  /// Compute the transitions for several couples (state, action), see getSuccessors
+  typedef std::function<void(const Eigen::MatrixXd & states,
+                             const Eigen::MatrixXd & actions,
+                             std::default_random_engine * engine,
+                             Eigen::MatrixXd * successors,
+                             Eigen::VectorXd * rewards,
+                             TerminalFlags * terminals)> BatchResultFunction;
 
 private:
   /// What are the state limits of the problem
@@ -58,6 +67,12 @@ public:
   virtual ~Problem();
 
   ResultFunction getResultFunction() const;
+  BatchResultFunction getBatchResultFunction() const;
+
+  /// Batched function calling result_function for each transition
+  static BatchResultFunction toBatchResultFunction(ResultFunction result_function);
+  /// Function computing each transition with a batch of size 1
+  static ResultFunction toResultFunction(BatchResultFunction result_function);
 
   /// Throw an explicit runtime_error if action_id is outside of acceptable range
   void checkActionId(int action_id) const;
@@ -106,11 +121,35 @@ public:
                               const Eigen::VectorXd & action,
                               std::default_random_engine * engine)  const = 0;
 
-  double sampleRolloutReward(const Eigen::VectorXd & initial_state,
-                             const csa_mdp::Policy & policy,
-                             int max_horizon,
-                             double discount,
-                             std::default_random_engine * engine) const;
+  /// Compute the transitions for several couples (state, action) at once:
+  /// states.col(i) and actions.col(i) describe the i-th transition, results
+  /// are written in successors->col(i), (*rewards)(i) and (*terminals)(i).
+  /// Output buffers are only resized if their size is not appropriate.
+  /// Default implementation calls getSuccessor for each transition, problems
+  /// can override it with a vectorized implementation.
+  virtual void getSuccessors(const Eigen::MatrixXd & states,
+                             const Eigen::MatrixXd & actions,
+                             std::default_random_engine * engine,
+                             Eigen::MatrixXd * successors,
+                             Eigen::VectorXd * rewards,
+                             TerminalFlags * terminals) const;
+
+  /// Return the discounted reward of a trajectory starting at initial_state
+  /// and following policy for at most max_horizon steps. If visited_states is
+  /// not a nullptr, all the states in which an action is taken are appended.
+  /// Problems may override this method to provide a faster rollout loop.
+  virtual double sampleRolloutReward(const Eigen::VectorXd & initial_state,
+                                     const csa_mdp::Policy & policy,
+                                     int max_horizon,
+                                     double discount,
+                                     std::default_random_engine * engine,
+                                     std::vector<Eigen::VectorXd> * visited_states = nullptr) const;
+
+  /// Return true if sampleRolloutReward provides an allocation-free rollout
+  /// loop for 'policy'. In this case, simulating the trajectories one by one
+  /// with sampleRolloutReward is faster than using a RolloutEngine. Default
+  /// implementation returns false.
+  virtual bool hasAllocationFreeRollouts(const csa_mdp::Policy & policy) const;
 };
 
 }
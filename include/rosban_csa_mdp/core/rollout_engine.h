@@ -0,0 +1,91 @@
+#pragma once
+
+#include "rosban_csa_mdp/core/policy.h"
+#include "rosban_csa_mdp/core/problem.h"
+
+#include <Eigen/Core>
+
+#include <random>
+#include <vector>
+
+namespace csa_mdp
+{
+
+/// Simulate several trajectories of a problem in lock-step.
+///
+/// At each step, the actions of all the active trajectories are computed with
+/// a single call to Policy::getActions and the transitions with a single call
+/// to the batch result function. States are stored in matrices (one column
+/// per trajectory) and trajectories reaching a terminal state are removed from
+/// the active set. Buffers are kept between calls to 'run', but removing
+/// terminated trajectories resizes the state buffer and the dynamic
+/// interface of Problem and Policy allocates at each step. For problems
+/// providing allocation-free rollouts (see
+/// Problem::hasAllocationFreeRollouts), simulating the trajectories one by
+/// one with Problem::sampleRolloutReward is faster.
+class RolloutEngine
+{
+public:
+  RolloutEngine(Problem::BatchResultFunction result_function);
+  RolloutEngine(const Problem & problem);
+
+  /// Simulate the trajectories starting at initial_states.col(i) and
+  /// following 'policy' for at most 'horizon' steps. If first_actions is
+  /// provided, first_actions.col(i) is used as the first action of trajectory
+  /// i instead of the action provided by the policy.
+  void run(const Eigen::MatrixXd & initial_states,
+           const Policy & policy,
+           int horizon,
+           double discount,
+           std::default_random_engine * engine,
+           const Eigen::MatrixXd * first_actions = nullptr);
+
+  /// Number of trajectories simulated during last run
+  int nbTrajectories() const;
+
+  /// rewards(i) is the discounted reward of trajectory i
+  const Eigen::VectorXd & getRewards() const;
+
+  /// Column i is the last state of trajectory i
+  const Eigen::MatrixXd & getFinalStates() const;
+
+  /// terminals(i) is true if trajectory i reached a terminal state
+  const Problem::TerminalFlags & getTerminals() const;
+
+  /// Add the discounted value of the final state to the rewards of all the
+  /// trajectories which did not reach a terminal state
+  void addFinalValues(Problem::ValueFunction value_function);
+
+  /// Enable or disable the recording of the visited states
+  void setRecordVisitedStates(bool record);
+
+  /// visited_states[i] contains all the states of trajectory i in which an
+  /// action has been taken (only available if recording is enabled)
+  const std::vector<std::vector<Eigen::VectorXd>> & getVisitedStates() const;
+
+private:
+  /// Computes the transitions of the active trajectories
+  Problem::BatchResultFunction result_function;
+
+  /// Are visited states recorded
+  bool record_visited_states;
+
+  /// Results of the last run
+  Eigen::VectorXd rewards;
+  Eigen::MatrixXd final_states;
+  Problem::TerminalFlags terminals;
+  /// Discount applied to the final states of non-terminated trajectories
+  double final_coeff;
+  std::vector<std::vector<Eigen::VectorXd>> visited_states;
+
+  /// states.col(i) is the current state of trajectory active[i]
+  Eigen::MatrixXd states;
+  std::vector<int> active;
+  /// Buffers for the current step
+  Eigen::MatrixXd actions;
+  Eigen::MatrixXd successors;
+  Eigen::VectorXd step_rewards;
+  Problem::TerminalFlags step_terminals;
+};
+
+}
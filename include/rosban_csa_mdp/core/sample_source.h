@@ -0,0 +1,43 @@
+#pragma once
+
+#include "rosban_csa_mdp/core/sample.h"
+
+#include <Eigen/Core>
+
+#include <vector>
+
+namespace csa_mdp
+{
+
+/// Interface of an indexed collection of 4-tuples (s, a, s', r).
+///
+/// Components are decoded in buffers provided by the caller, which allows
+/// implementations to provide samples without materializing them (e.g. a
+/// view on histories or a store with reduced precision).
+class SampleSource
+{
+public:
+  virtual ~SampleSource();
+
+  /// Number of samples
+  virtual int size() const = 0;
+  virtual int stateDims() const = 0;
+  virtual int actionDims() const = 0;
+
+  /// Write the components of the sample at index 'idx' in the provided
+  /// vectors, outputs are resized only if required.
+  virtual void getState(int idx, Eigen::VectorXd * state) const = 0;
+  virtual void getAction(int idx, Eigen::VectorXd * action) const = 0;
+  virtual void getNextState(int idx, Eigen::VectorXd * next_state) const = 0;
+  virtual double reward(int idx) const = 0;
+
+  bool empty() const;
+
+  /// Build a Sample from the content at index 'idx' (requires allocation)
+  Sample getSample(int idx) const;
+
+  /// Export the content of the source to the 'classic' format
+  std::vector<Sample> toSamples() const;
+};
+
+}
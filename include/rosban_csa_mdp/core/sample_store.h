@@ -0,0 +1,189 @@
+#pragma once
+
+#include "rosban_csa_mdp/core/sample_source.h"
+
+#include <Eigen/Core>
+
+#include <cstdint>
+#include <iostream>
+#include <string>
+#include <vector>
+
+namespace csa_mdp
+{
+
+/// This class stores a collection of 4-tuples (s, a, s', r) in a columnar
+/// way: states, actions and next states are stored in contiguous matrices
+/// where column 'i' corresponds to the i-th sample, rewards are stored in a
+/// vector. Unlike a std::vector<Sample>, pushing a sample does not require to
+/// allocate memory for each of its components.
+///
+/// Dimensions are set at construction or deduced from the first sample pushed.
+///
+/// States, actions and next states can be stored with a reduced precision in
+/// order to save memory on large datasets (rewards are always stored as
+/// double). With a reduced precision, the zero-copy views (state(), states(),
+/// ...) are not available and values have to be decoded with getState,
+/// getAction and getNextState. Decoded values are always double, and the
+/// maximal encoding errors are recorded.
+class SampleStore : public SampleSource
+{
+public:
+  typedef Eigen::MatrixXd::ConstColXpr ConstColumn;
+  typedef Eigen::MatrixXd::ConstColsBlockXpr ConstColumns;
+  typedef Eigen::VectorXd::ConstSegmentReturnType ConstRewards;
+
+  /// Available precisions for the storage of states and actions
+  /// Double     : 8 bytes per value, no loss
+  /// Float      : 4 bytes per value, relative error of 2^-24
+  /// Quantized16: 2 bytes per value, values are quantized on 65536 levels
+  ///              inside the limits provided with setLimits, values outside
+  ///              of the limits are saturated
+  enum class Precision
+  { Double, Float, Quantized16 };
+
+  /// Create an empty store, dimensions are deduced from the first sample
+  SampleStore();
+  SampleStore(int state_dims, int action_dims, Precision precision = Precision::Double);
+  /// Copy all the samples in a columnar store
+  explicit SampleStore(const std::vector<Sample> & samples);
+
+  int size() const override;
+  /// Number of samples which can be stored without reallocating memory
+  int capacity() const;
+  int stateDims() const override;
+  int actionDims() const override;
+  Precision getPrecision() const;
+
+  /// Set the limits used for quantization (limits.col(0) are the minimal
+  /// values and limits.col(1) the maximal values). Required before pushing
+  /// samples in a Quantized16 store. Throws a std::logic_error if the store
+  /// uses Quantized16 precision and already contains samples.
+  void setLimits(const Eigen::MatrixXd & state_limits,
+                 const Eigen::MatrixXd & action_limits);
+
+  /// Ensure that memory is allocated for at least 'nb_samples' samples
+  void reserve(int nb_samples);
+  /// Remove all the samples without releasing memory
+  void clear();
+
+  /// Append a sample to the store, throws a std::runtime_error if dimensions
+  /// of the sample do not match those of the store
+  void push(const Sample & sample);
+  void push(const Eigen::Ref<const Eigen::VectorXd> & state,
+            const Eigen::Ref<const Eigen::VectorXd> & action,
+            const Eigen::Ref<const Eigen::VectorXd> & next_state,
+            double reward);
+  /// Append the sample at index 'idx' of 'other'
+  void push(const SampleSource & other, int idx);
+
+  /// Append all the samples of 'other' at the end of the store
+  void append(const SampleSource & other);
+
+  /// Read-only views on the components of the sample at index 'idx'
+  /// Throw a std::logic_error if precision is not Double
+  ConstColumn state(int idx) const;
+  ConstColumn action(int idx) const;
+  ConstColumn nextState(int idx) const;
+  double reward(int idx) const override;
+
+  /// Read-only views on all the samples (one column per sample)
+  /// Throw a std::logic_error if precision is not Double
+  ConstColumns states() const;
+  ConstColumns actions() const;
+  ConstColumns nextStates() const;
+  ConstRewards rewards() const;
+
+  /// Decode the components of the sample at index 'idx', available for all
+  /// precisions. Outputs are resized only if required.
+  void getState(int idx, Eigen::VectorXd * state) const override;
+  void getAction(int idx, Eigen::VectorXd * action) const override;
+  void getNextState(int idx, Eigen::VectorXd * next_state) const override;
+
+  /// Maximal absolute error along each dimension on the states (and next
+  /// states) and actions pushed since the last call to clear
+  Eigen::VectorXd getMaxStateError() const;
+  Eigen::VectorXd getMaxActionError() const;
+
+  /// Memory allocated for the samples [bytes]
+  size_t getMemoryUsage() const;
+
+  /// Write the samples in a compact binary form: samples are stored with the
+  /// precision of the store, without conversion
+  void write(std::ostream & out) const;
+  /// Replace the content of the store by the samples written with 'write',
+  /// throws a std::runtime_error if the data is not valid
+  void read(std::istream & in);
+
+private:
+  /// A set of columns stored with a given precision
+  class ColumnStorage
+  {
+  public:
+    ColumnStorage();
+
+    void setup(Precision precision, int dims);
+    /// Limits are required for Quantized16 precision
+    void setLimits(const Eigen::MatrixXd & limits);
+    void resetErrors();
+
+    int capacity() const;
+    void reserve(int capacity);
+
+    /// Encode the vector in column idx
+    void set(int idx, const Eigen::Ref<const Eigen::VectorXd> & value);
+    /// Decode column idx
+    void get(int idx, Eigen::VectorXd * value) const;
+
+    /// Number of bytes used per column
+    size_t bytesPerColumn() const;
+
+    /// Write quantization parameters and the 'nb_columns' first columns
+    void write(std::ostream & out, int nb_columns) const;
+    /// Read data written by 'write', precision and dims have to be set up
+    void read(std::istream & in, int nb_columns);
+
+    Precision precision;
+    int dims;
+    /// Only the matrix corresponding to the precision is used
+    Eigen::MatrixXd double_data;
+    Eigen::MatrixXf float_data;
+    Eigen::Matrix<uint16_t, Eigen::Dynamic, Eigen::Dynamic> quantized_data;
+    /// Quantization: value = offset + level * scale
+    Eigen::VectorXd offset;
+    Eigen::VectorXd scale;
+    bool has_limits;
+    /// Maximal absolute error along each dimension
+    Eigen::VectorXd max_error;
+  };
+
+  /// Throw an explicit std::runtime_error if the dimensions do not match,
+  /// set the dimensions if the store is empty and has no dimensions yet
+  void checkDims(int sample_state_dims, int sample_action_dims);
+
+  /// Throw a std::logic_error if precision is not Double
+  void checkDoublePrecision(const char * caller) const;
+
+  /// Dimensions of the state space
+  int state_dims;
+  /// Dimensions of the action space
+  int action_dims;
+  /// Number of samples currently stored
+  int nb_samples;
+  /// Precision used for states and actions
+  Precision precision;
+
+  /// Column i is the starting state of sample i
+  ColumnStorage state_data;
+  /// Column i is the action of sample i
+  ColumnStorage action_data;
+  /// Column i is the resulting state of sample i
+  ColumnStorage next_state_data;
+  /// reward_data(i) is the reward of sample i
+  Eigen::VectorXd reward_data;
+};
+
+std::string to_string(SampleStore::Precision precision);
+SampleStore::Precision loadPrecision(const std::string & precision);
+
+}
@@ -0,0 +1,84 @@
+#pragma once
+
+#include "rosban_csa_mdp/core/sample_store.h"
+
+#include "rosban_utils/serializable.h"
+
+#include <vector>
+
+namespace csa_mdp
+{
+
+/// Reduce a collection of samples to a weighted subset, the weight of a
+/// sample of the subset is the number of original samples it represents.
+///
+/// Two stages are applied, both working on the (state, action) of the samples
+/// normalized by the input limits:
+/// 1. Merging: a sample similar to a previous sample (up to merge_tolerance
+///    along each dimension) is merged into it, its weight is incremented.
+/// 2. Stratification: if more than max_samples samples remain, the space is
+///    partitioned by a kd-tree with median splits on the widest dimension
+///    and each cell receives a quota of samples: one sample at least, the
+///    rest being shared proportionally to the weight of the cells. Inside a
+///    cell, samples are chosen at regular intervals and each chosen sample
+///    carries the weight of the samples it replaces.
+///
+/// The result is deterministic and the total weight is the number of original
+/// samples.
+class SampleSubsampler
+{
+public:
+  class Config : public rosban_utils::Serializable
+  {
+  public:
+    Config();
+
+    void to_xml(std::ostream &out) const override;
+    void from_xml(TiXmlNode *node) override;
+    std::string class_name() const override;
+
+    /// Return true if at least one of the stages is enabled
+    bool isActive() const;
+
+    /// Maximal number of samples kept (0 disables stratification)
+    int max_samples;
+    /// Tolerance used to merge similar samples in the normalized space
+    /// [0,1]^n (0 disables merging)
+    double merge_tolerance;
+    /// Maximal number of samples in the cells of the kd-partition, it is
+    /// increased if required so that the number of cells does not exceed
+    /// max_samples
+    int leaf_size;
+    /// Maximal ratio between the size of a weighted training set and the
+    /// number of samples kept, see FPF::applyWeights
+    double max_replication;
+  };
+
+  SampleSubsampler(const Config & conf);
+
+  /// Fill 'subset' with the samples kept (Double precision) and 'weights'
+  /// with their weights. input_limits is the space of (state, action).
+  void subsample(const SampleSource & samples,
+                 const Eigen::MatrixXd & input_limits,
+                 SampleStore * subset,
+                 std::vector<double> * weights) const;
+
+private:
+  /// Split points[start, end[ until cells contain at most max_leaf_size
+  /// points, appends the boundaries of the cells to 'cells'
+  static void partition(const Eigen::MatrixXd & points,
+                        std::vector<int> & order, int start, int end,
+                        int max_leaf_size,
+                        std::vector<std::pair<int,int>> * cells);
+
+  /// Number of samples chosen in each cell: one sample at least, the other
+  /// samples being shared proportionally to the weights of the cells which
+  /// have not been entirely chosen yet
+  static std::vector<int> getQuotas(const std::vector<std::pair<int,int>> & cells,
+                                    const std::vector<double> & cell_weights,
+                                    int nb_samples);
+
+  Config conf;
+};
+
+}
@@ -0,0 +1,80 @@
+#pragma once
+
+#include <Eigen/Core>
+
+#include <cstdint>
+#include <unordered_map>
+#include <vector>
+
+namespace csa_mdp
+{
+
+/// An incremental index allowing to detect if a point has already been
+/// inserted up to a given tolerance: two points are similar if the maximal
+/// difference along their dimensions is lower than the tolerance.
+///
+/// The space is divided in a grid of cells of size 'cell_factor * tolerance'
+/// which are stored in a hash map. Similar points can only be located in the
+/// same cell or in a neighbor cell along the dimensions where the point is
+/// close to the border of its cell. Therefore insertion and queries have an
+/// expected constant cost, no matter how many points are stored.
+class SimilarityIndex
+{
+public:
+  /// Size of the cells relative to the tolerance
+  static const int cell_factor;
+  /// A point close to the border of its cell along k dimensions has to be
+  /// compared with the content of 2^k cells, above this number of dimensions
+  /// queries are answered by checking all the points
+  static const int max_border_dims;
+
+  SimilarityIndex(double tolerance = 1e-6);
+
+  /// Remove all the points and change the tolerance
+  void reset(double tolerance);
+
+  /// Return true if a point similar to 'point' has been inserted. Queries and
+  /// insertions throw a std::runtime_error if the dimension of the point is
+  /// invalid or if one of its coordinates is not finite or too large
+  bool hasSimilar(const Eigen::VectorXd & point) const;
+
+  /// Return the index (in insertion order) of a point similar to 'point' or
+  /// -1 if there is no such point
+  int findSimilar(const Eigen::VectorXd & point) const;
+
+  /// Insert the point if there is no similar point in the index, returns true
+  /// if the point has been inserted
+  bool insert(const Eigen::VectorXd & point);
+
+  /// Number of points in the index
+  int size() const;
+
+  double getTolerance() const;
+
+private:
+  /// Return the index of a point similar to 'point' in the cell 'cell_hash'
+  /// or -1 if there is no such point
+  int cellFindSimilar(uint64_t cell_hash, const Eigen::VectorXd & point) const;
+
+  /// Throws a std::runtime_error if the point has not the dimension of the
+  /// index or if a coordinate is not finite or too large to be mapped to a
+  /// cell
+  void checkPoint(const Eigen::VectorXd & point, const char * method) const;
+
+  /// Compute the coordinates of the cell containing the point
+  void getCell(const Eigen::VectorXd & point, std::vector<int64_t> * cell) const;
+
+  static uint64_t hashCell(const std::vector<int64_t> & cell);
+
+  double tolerance;
+  double cell_size;
+  /// Number of dimensions, deduced from the first point inserted
+  int dim;
+  /// Content of the inserted points, point i is at [i*dim, (i+1)*dim[
+  std::vector<double> points;
+  /// Indices of the points contained in each cell, collisions of the hash
+  /// function only add candidates which are rejected by the distance check
+  std::unordered_map<uint64_t, std::vector<int>> cells;
+};
+
+}
@@ -0,0 +1,180 @@
+#pragma once
+
+#include "rosban_csa_mdp/core/history.h"
+
+#include <Eigen/Core>
+
+#include <cstdint>
+#include <fstream>
+#include <string>
+#include <vector>
+
+namespace csa_mdp
+{
+
+/// A binary on-disk format for a collection of runs (std::vector<History>).
+///
+/// File layout (native byte order):
+/// - Header: magic, version, state and action dimensions, number of runs and
+///   offset of the run index
+/// - Data: for each step of each run, a record of doubles
+///   [state(0..x_dim) | action(0..u_dim) | reward]
+/// - Index: for each run, the offset [bytes] of its first record and its
+///   number of steps
+///
+/// Files are written once (from csv files or while running experiments) and
+/// opened with mmap: opening a log does not depend on its size and the
+/// content of the runs is accessed through Eigen::Map without copy.
+class TrajectoryLog
+{
+public:
+  /// Header of the file
+  struct Header
+  {
+    char magic[8];
+    uint32_t version;
+    uint32_t state_dims;
+    uint32_t action_dims;
+    uint32_t reserved;
+    uint64_t nb_runs;
+    /// Offset of the run index in the file [bytes]
+    uint64_t index_offset;
+  };
+
+  /// Entry of the run index
+  struct RunEntry
+  {
+    /// Offset of the first record of the run [bytes]
+    uint64_t offset;
+    uint64_t nb_steps;
+  };
+
+  typedef Eigen::Map<const Eigen::VectorXd> ConstVectorMap;
+  typedef Eigen::Map<const Eigen::MatrixXd, 0, Eigen::OuterStride<>> ConstMatrixMap;
+
+  /// A zero-copy view on a sample (s, a, s', r) of a run
+  class SampleView
+  {
+  public:
+    SampleView(const double * record, const double * next_record,
+               int state_dims, int action_dims);
+
+    /// Copy the content of the view
+    Sample toSample() const;
+
+    ConstVectorMap state;
+    ConstVectorMap action;
+    ConstVectorMap next_state;
+    double reward;
+  };
+
+  /// A zero-copy view on a run, equivalent to a History
+  class RunView
+  {
+  public:
+    RunView(const double * data, size_t nb_steps, int state_dims, int action_dims);
+
+    /// Number of steps in the run
+    size_t size() const;
+    ConstVectorMap getState(size_t step) const;
+    ConstVectorMap getAction(size_t step) const;
+    double getReward(size_t step) const;
+
+    /// Views on all the states/actions of the run (one column per step)
+    ConstMatrixMap getStates() const;
+    ConstMatrixMap getActions() const;
+
+    /// Number of samples in the run: size() - 1 if the run is not empty
+    size_t getNbSamples() const;
+    /// Sample view consistent with History::getBatch
+    SampleView getSample(size_t idx) const;
+
+    /// Copy the content of the view to a History
+    History toHistory() const;
+
+  private:
+    /// Number of doubles in a record
+    int stride() const;
+
+    const double * data;
+    size_t nb_steps;
+    int state_dims;
+    int action_dims;
+  };
+
+  /// Append runs to a log file, the run index and the header are written
+  /// when the writer is closed.
+  class Writer
+  {
+  public:
+    Writer(const std::string & path, int state_dims, int action_dims);
+    /// Close the file if it has not been closed
+    ~Writer();
+
+    /// Start a new run, the previous run is ended if necessary
+    void startRun();
+    /// Append a step to the current run (same order as History::push)
+    void push(const Eigen::VectorXd & state,
+              const Eigen::VectorXd & action,
+              double reward);
+    /// End the current run
+    void endRun();
+    /// Write a whole run
+    void write(const History & history);
+
+    /// End current run and write index and header
+    void close();
+
+  private:
+    std::string path;
+    std::ofstream out;
+    int state_dims;
+    int action_dims;
+    std::vector<RunEntry> runs;
+    /// Is there a run currently written?
+    bool run_started;
+    /// Current offset in the file [bytes]
+    uint64_t offset;
+    /// Reused buffer for records
+    std::vector<double> record;
+  };
+
+  /// Map the content of the log file, throws a std::runtime_error if the file
+  /// cannot be opened or if it is not a valid trajectory log
+  TrajectoryLog(const std::string & path);
+  TrajectoryLog(const TrajectoryLog & other) = delete;
+  TrajectoryLog & operator=(const TrajectoryLog & other) = delete;
+  ~TrajectoryLog();
+
+  int getStateDims() const;
+  int getActionDims() const;
+  size_t getNbRuns() const;
+  /// Total number of samples (s,a,s',r) in the log
+  size_t getNbSamples() const;
+
+  /// Random access to a run, throws a std::out_of_range if idx is not valid
+  RunView getRun(size_t idx) const;
+
+  /// Copy the content of the log to the 'classic' format
+  std::vector<History> toHistories() const;
+
+  /// Write the given histories to a log file
+  static void write(const std::string & path, const std::vector<History> & histories,
+                    int state_dims, int action_dims);
+
+  /// Parse the csv file described by conf and write it to a binary log
+  static void convertCSV(const History::Config & conf, const std::string & output_path);
+
+  static const char magic[8];
+  static const uint32_t version;
+
+private:
+  std::string path;
+  /// Mapped memory
+  void * mapping;
+  size_t mapping_size;
+  const Header * header;
+  const RunEntry * index;
+};
+
+}
@@ -0,0 +1,50 @@
+#pragma once
+
+#include "rosban_csa_mdp/core/history.h"
+#include "rosban_csa_mdp/core/sample_source.h"
+
+#include <vector>
+
+namespace csa_mdp
+{
+
+/// Read-only view on the transitions (s, a, s', r) contained in a set of
+/// histories. Transitions are read directly from the histories, no copy of
+/// the states or actions is performed. Indices and content are consistent
+/// with History::getBatch.
+///
+/// The view holds a pointer to the histories: they have to outlive the view
+/// and should not be modified while the view is used.
+class TransitionView : public SampleSource
+{
+public:
+  TransitionView(const std::vector<History> & histories);
+
+  int size() const override;
+  int stateDims() const override;
+  int actionDims() const override;
+
+  void getState(int idx, Eigen::VectorXd * state) const override;
+  void getAction(int idx, Eigen::VectorXd * action) const override;
+  void getNextState(int idx, Eigen::VectorXd * next_state) const override;
+  double reward(int idx) const override;
+
+  /// Direct access to the components of the transition at index 'idx'
+  const Eigen::VectorXd & state(int idx) const;
+  const Eigen::VectorXd & action(int idx) const;
+  const Eigen::VectorXd & nextState(int idx) const;
+
+private:
+  /// Retrieve the history and the step corresponding to the given index,
+  /// throws a std::out_of_range if idx is not valid
+  void locate(int idx, const History ** history, size_t * step) const;
+
+  const std::vector<History> * histories;
+  /// offsets[i] is the index of the first transition of histories[i],
+  /// last element is the total number of transitions
+  std::vector<int> offsets;
+  int state_dims;
+  int action_dims;
+};
+
+}
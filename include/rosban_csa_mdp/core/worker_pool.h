@@ -0,0 +1,165 @@
+#pragma once
+
+#include "rosban_utils/multi_core.h"
+
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <exception>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <random>
+#include <thread>
+#include <vector>
+
+namespace csa_mdp
+{
+
+/// A process-wide pool of persistent worker threads using work-stealing.
+///
+/// Each worker owns a queue of jobs: jobs submitted by a worker are pushed in
+/// its own queue and popped in LIFO order, while idle workers steal the
+/// oldest jobs from the queues of the others. Jobs submitted from outside the
+/// pool are pushed in a shared queue.
+///
+/// The thread submitting a batch of jobs also executes jobs while it waits
+/// for the end of its batch, therefore jobs can submit nested batches without
+/// risking a deadlock and without leaving cores idle. The pool grows on
+/// demand to match the largest number of threads requested, but the jobs of
+/// a batch might be executed by any worker.
+///
+/// At most 'nb_threads' threads execute the jobs of a batch at the same time,
+/// the submitting thread included, even if the pool contains more workers.
+/// With nb_threads <= 1, all the jobs are executed sequentially by the
+/// submitting thread, thus jobs which are not thread-safe can be used.
+///
+/// If jobs throw, the first exception caught is rethrown by the submitting
+/// thread once all the jobs of the batch have ended.
+class WorkerPool
+{
+public:
+  typedef std::function<void(int job_id)> Job;
+
+  /// Maximal number of workers in the pool
+  static const int max_workers;
+  /// Number of chunks per thread used by runBalancedStochasticTask
+  static const int chunks_per_thread;
+
+  static WorkerPool & getInstance();
+
+  ~WorkerPool();
+
+  /// Run job(0), ..., job(nb_jobs - 1) in parallel and return once all of them
+  /// have been executed. At most 'nb_threads' threads (the submitting thread
+  /// included) run jobs of this batch simultaneously, the pool is grown to
+  /// at least 'nb_threads - 1' workers if required.
+  void run(int nb_jobs, Job job, int nb_threads);
+
+  /// Ensure that at least 'nb_workers' threads are available
+  void reserveWorkers(int nb_workers);
+
+  int getNbWorkers() const;
+
+  /// Same behavior as MultiCore::runParallelTask using the shared pool
+  static void runParallelTask(rosban_utils::MultiCore::Task task,
+                              int nb_tasks, int nb_threads);
+
+  /// Same behavior as MultiCore::runParallelStochasticTask using the shared
+  /// pool: tasks are split in one interval per engine and interval i always
+  /// uses (*engines)[i], thus results do not depend on the scheduling
+  static void runParallelStochasticTask(rosban_utils::MultiCore::StochasticTask task,
+                                        int nb_tasks,
+                                        std::vector<std::default_random_engine> * engines);
+
+  /// Split the tasks in 'chunks_per_thread * nb_threads' chunks which are
+  /// balanced dynamically among the workers, this is suited to tasks with
+  /// heterogeneous durations. Each chunk uses its own engine, generated from
+  /// 'engine', thus results do not depend on the scheduling. With
+  /// nb_threads <= 1, a single chunk is run by the calling thread.
+  static void runBalancedStochasticTask(rosban_utils::MultiCore::StochasticTask task,
+                                        int nb_tasks, int nb_threads,
+                                        std::default_random_engine * engine);
+
+private:
+  /// Shared state of the jobs submitted by a single call to run
+  struct Batch
+  {
+    Job job;
+    /// Number of jobs which have not ended yet
+    std::atomic<int> nb_remaining;
+    /// Maximal number of threads executing jobs of the batch simultaneously
+    int max_participants;
+    /// Number of threads currently executing jobs of the batch, the
+    /// submitting thread is always counted
+    std::atomic<int> nb_participants;
+    std::thread::id owner;
+    std::mutex error_mutex;
+    std::exception_ptr error;
+  };
+
+  struct Entry
+  {
+    Batch * batch;
+    int job_id;
+    /// True if the thread executing the entry has been counted as a
+    /// participant of the batch
+    bool counted;
+  };
+
+  struct JobQueue
+  {
+    std::mutex mutex;
+    std::deque<Entry> entries;
+  };
+
+  WorkerPool();
+
+  /// Main loop of the worker threads
+  void workerLoop(int worker_id);
+
+  /// Retrieve an entry from the queue of the worker, then from the shared
+  /// queue and finally steal from the other workers. worker_id is -1 for
+  /// threads which are not part of the pool. Entries of batches which
+  /// already have their maximal number of participants are skipped. Returns
+  /// false if no entry was available.
+  bool takeEntry(int worker_id, Entry * entry);
+
+  /// Remove the first entry of the queue which can be executed by the
+  /// current thread (starting from the back if 'from_back' is true)
+  bool popEntry(JobQueue & queue, bool from_back, Entry * entry);
+
+  /// Return true if the current thread can execute a job of the batch, in
+  /// this case, entry->counted tells if the thread has been added to the
+  /// participants
+  static bool claim(Entry * entry);
+
+  /// Execute the job and update the batch
+  void execute(const Entry & entry);
+
+  /// Wake up the threads waiting for jobs or for the end of a batch
+  void notifyAll();
+
+  /// Incremented by notifyAll, threads which did not find any entry they
+  /// could execute wait until it changes
+  long getVersion();
+
+  /// queues[i] is the queue of worker i, only the first nb_workers are used
+  std::vector<std::unique_ptr<JobQueue>> queues;
+  /// Queue used by threads which are not part of the pool
+  JobQueue shared_queue;
+  std::atomic<int> nb_workers;
+  /// Number of entries waiting in all the queues
+  std::atomic<int> nb_pending;
+
+  std::vector<std::thread> workers;
+  std::mutex workers_mutex;
+
+  /// Used to sleep when there is no job available
+  std::mutex sleep_mutex;
+  std::condition_variable cond;
+  long version;
+  bool stop;
+};
+
+}
@@ -4,9 +4,28 @@
 
 #include "rosban_regression_forests/core/forest.h"
 
+#include <condition_variable>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
 namespace csa_mdp
 {
 
+/// A forest of independent KnownnessTrees.
+///
+/// Insertions can be performed by batches, trees being processed in parallel
+/// on the WorkerPool. In asynchronous mode, push and pushBatch only enqueue
+/// the points and return immediately: a background thread applies the
+/// pending points by batches. Use flush to wait until all the pending points
+/// have been inserted.
+///
+/// In asynchronous mode, readers work on a snapshot of the trees: each batch
+/// is inserted in a copy of the set of trees which then replaces the current
+/// set atomically. Therefore getValue never blocks and never sees a
+/// partially applied batch, at the cost of copying all the trees for each
+/// batch.
 class KnownnessForest : public KnownnessFunction
 {
 public:
@@ -22,16 +41,32 @@ public:
 
     int nb_trees;
     KnownnessTree::Config tree_conf;
+    /// Number of threads used to insert batches of points
+    int nb_threads;
+    /// If enabled, insertions are applied by a background thread
+    bool async;
   };
 
   KnownnessForest();
   KnownnessForest(const Eigen::MatrixXd &space,
                   const Config &conf);
+  KnownnessForest(const KnownnessForest &other) = delete;
+  KnownnessForest & operator=(const KnownnessForest &other) = delete;
+  /// Pending points are inserted before the destruction
+  ~KnownnessForest();
 
   /// Notify the knownness function that a new point has been found
   virtual void push(const Eigen::VectorXd &point);
 
-  /// Get the knownness value at the given point
+  /// Notify the knownness function of several points at once, the points are
+  /// inserted in order in each tree and the trees are processed in parallel
+  void pushBatch(const std::vector<Eigen::VectorXd> &points);
+
+  /// Block until all the points pushed have been inserted (asynchronous mode)
+  void flush() const;
+
+  /// Get the knownness value at the given point, computed on the last
+  /// snapshot of the trees in asynchronous mode
   virtual double getValue(const Eigen::VectorXd &point) const;
 
   /// Conversion to a regression_forest
@@ -40,8 +75,41 @@ public:
   /// Ensure that all the trees are consistent
   void checkConsistency();
 
+  /// Write all the trees in a compact binary form
+  void write(std::ostream &out) const;
+  /// Replace the trees by the ones written with 'write', space and
+  /// configuration of the trees are kept
+  void read(std::istream &in);
+
 private:
-  std::vector<KnownnessTree> trees;
+  typedef std::vector<KnownnessTree> TreeSet;
+
+  /// Insert the points in all the trees, in asynchronous mode the points are
+  /// inserted in a copy of the trees which replaces the current snapshot
+  void applyBatch(const std::vector<Eigen::VectorXd> &points);
+
+  /// Insert the points in all the trees of 'target'
+  void insertPoints(const std::vector<Eigen::VectorXd> &points, TreeSet * target) const;
+
+  /// Current set of trees (loaded atomically in asynchronous mode)
+  std::shared_ptr<const TreeSet> getSnapshot() const;
+
+  /// Main loop of the background thread
+  void insertionLoop();
+
+  /// In asynchronous mode, the pointed set is never modified once published
+  /// and the pointer is accessed with std::atomic_load and std::atomic_store
+  std::shared_ptr<TreeSet> trees;
+  int nb_threads;
+  bool async;
+
+  /// Points waiting for insertion and state of the background thread
+  mutable std::mutex queue_mutex;
+  mutable std::condition_variable queue_cond;
+  std::vector<Eigen::VectorXd> pending_points;
+  bool applying_batch;
+  bool stop;
+  std::thread insertion_thread;
 };
 
 }
@@ -46,20 +46,37 @@ public:
 
   // Implementations
   virtual void push(const Eigen::VectorXd &point) override;
+  /// Knownness is computed from the number of points and the space of the
+  /// leaf containing 'point'. Previous versions used the number of points of
+  /// the node located at most one level under the root (with the space of
+  /// the leaf), therefore values differ once the tree has been split more
+  /// than once.
   virtual double getValue(const Eigen::VectorXd &point) const override;
 
   double getValue(const Eigen::MatrixXd &space, int nb_points) const;
 
   // Conversion tools
-  regression_forests::Node * convertToRegNode(const kd_trees::KdNode *node,
+  /// Convert the subtree of the given kd-tree node, space is the space of
+  /// the node
+  regression_forests::Node * convertToRegNode(int node,
                                               Eigen::MatrixXd &space) const;
   std::unique_ptr<regression_forests::Tree> convertToRegTree() const;
 
   /// Ensure that the number of points stored correspond to the total number
   /// of points, if it does not, throw a logic_error
-  void checkConsistency();
+  void checkConsistency() const;
+
+  /// Write the structure of the tree and its points in a compact binary form
+  void write(std::ostream &out) const;
+  /// Rebuild the tree written by 'write', the tree has to be empty
+  void read(std::istream &in);
 
 private:
+  /// Write the subtree in preorder
+  void writeNode(std::ostream &out, int node) const;
+  /// Read a subtree written by writeNode into an empty leaf
+  void readNode(std::istream &in, int node);
+
   /// The basic data structure
   kd_trees::KdTree tree;
   /// Configuration of the tree
@@ -12,6 +12,7 @@ class MonteCarloPredictor : public RewardPredictor
 public:
   MonteCarloPredictor();
 
+  /// Trajectories are simulated by batches, see the batched version
   void predict(const Eigen::VectorXd & input,
                const Policy & policy,
                Problem::ResultFunction result_function,
@@ -21,11 +22,20 @@ public:
                double * var,
                std::default_random_engine * engine) override;
 
+  void predict(const Eigen::VectorXd & input,
+               const Policy & policy,
+               Problem::BatchResultFunction result_function,
+               Problem::ValueFunction value_function,
+               double discount,
+               double * mean,
+               double * var,
+               std::default_random_engine * engine) override;
+
   typedef std::function<void(int start, int end, std::default_random_engine * engine)> RPTask;
 
   virtual RPTask getTask(const Eigen::VectorXd & input,
                          const Policy & policy,
-                         Problem::ResultFunction result_function,
+                         Problem::BatchResultFunction result_function,
                          Problem::ValueFunction value_function,
                          double discount,
                          std::vector<double> & rewards);
@@ -31,6 +31,18 @@ public:
                        double * var,
                        std::default_random_engine * engine) = 0;
 
+  /// Same as predict, but result_function allows to simulate several
+  /// trajectories simultaneously. Default implementation calls the
+  /// non-batched version with transitions computed one by one.
+  virtual void predict(const Eigen::VectorXd & input,
+                       const Policy & policy,
+                       Problem::BatchResultFunction result_function,
+                       Problem::ValueFunction value_function,
+                       double discount,
+                       double * mean,
+                       double * var,
+                       std::default_random_engine * engine);
+
   virtual void setNbThreads(int nb_threads);
 
   virtual void to_xml(std::ostream &out) const override;
@@ -77,6 +77,18 @@ public:
   void writeScore(double score);
 
 protected:
+  /// Simulate the trajectories starting at initial_states.col(i) and return
+  /// their discounted rewards. If visited_states is provided, the states
+  /// visited by trajectory i are written in (*visited_states)[i]. Rollouts
+  /// are simulated one by one with problem->sampleRolloutReward if the
+  /// problem provides allocation-free rollouts for 'p' (e.g. FixedProblem)
+  /// and in lock-step with a RolloutEngine otherwise.
+  Eigen::VectorXd simulateRollouts(const Policy & p,
+                                   const Eigen::MatrixXd & initial_states,
+                                   std::default_random_engine * engine,
+                                   std::vector<std::vector<Eigen::VectorXd>> * visited_states
+                                   = nullptr) const;
+
   /// The problem to solve
   std::shared_ptr<const BlackBoxProblem> problem;
 
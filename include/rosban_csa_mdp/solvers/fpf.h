@@ -1,6 +1,9 @@
 #pragma once
 
-#include "rosban_csa_mdp/core/sample.h"
+#include "rosban_csa_mdp/core/forest_max_query.h"
+#include "rosban_csa_mdp/core/gp_forest_query.h"
+#include "rosban_csa_mdp/core/sample_store.h"
+#include "rosban_csa_mdp/core/sample_subsampler.h"
 
 #include "rosban_regression_forests/core/training_set.h"
 #include "rosban_regression_forests/algorithms/extra_trees.h"
@@ -35,8 +38,16 @@ public:
     size_t horizon;
     /// The discount factor of the MDP
     double discount;
-    /// The final size of the tree when merging the forest into a single tree for a given action
+    /// The maximal number of tiles of the projected tree used by previous
+    /// versions to search the best action of the q_value. The best action is
+    /// now computed exactly by ForestMaxQuery, thus this parameter is only
+    /// kept for the compatibility of configuration files
     size_t max_action_tiles;
+    /// If > 0, the search of the best action of the q_value for a given state
+    /// stops after evaluating 'max_query_tiles' boxes of the action space and
+    /// returns the best action found, which might not be optimal. Default is
+    /// 0: the search is exact
+    int max_query_tiles;
     /// > 0: The number of samples generated to learn the policy
     /// = 0: States used to learn policy are the same as the state from samples
     /// < 0: Policy is not learned
@@ -45,6 +56,32 @@ public:
     double q_training_set_time;
     /// The time spent growing extra-trees for the q_value [s]
     double q_extra_trees_time;
+    /// Iterations on the q_value stop once the maximal residual is lower than
+    /// this tolerance (0 means that 'horizon' iterations are always performed)
+    double residual_tolerance;
+    /// For each iteration on the q_value, the maximal and mean absolute change
+    /// of the training targets with respect to the previous iteration (the
+    /// initial q_value is 0), and the time spent on the iteration [s]
+    std::vector<double> q_max_residuals;
+    std::vector<double> q_mean_residuals;
+    std::vector<double> q_iteration_times;
+    /// Maximal time allowed for solve [s] (0 means no limit). Before each
+    /// iteration on the q_value (except the first one), the duration of the
+    /// iteration is estimated by the duration of the previous one and the
+    /// duration of the policy extraction by the one of the previous solve (or
+    /// by the duration of the previous iteration if no policy was learned
+    /// before). If they do not fit in the remaining time, the policy is
+    /// learned from the current q_value.
+    double time_budget;
+    /// Number of iterations performed on the q_value by the last solve
+    /// (including iterations restored from a checkpoint)
+    size_t q_nb_iterations;
+    /// Did the last solve stop iterating on the q_value because of time_budget?
+    bool budget_exhausted;
+    /// Did the last solve start from a checkpoint? If resume is activated and
+    /// this is false, no checkpoint matching the samples and the config was
+    /// found
+    bool checkpoint_resumed;
     /// The time spent computing training sets for policies [s]
     double p_training_set_time;
     /// The time spent growing extra-trees for the policies [s]
@@ -59,6 +96,30 @@ public:
     bool gp_values;
     /// If activated, gaussian processes are used to represent the policies
     bool gp_policies;
+    /// If activated and if the q_value uses piecewise constant approximations,
+    /// refits of the q_value keep the splits of the previous q_value: values
+    /// of the leaves are updated and only the leaves containing samples added
+    /// since the previous refit are grown further. If the samples used for the
+    /// previous q_value are not the first samples of the new training set,
+    /// the q_value is learnt from scratch.
+    bool warm_start;
+    /// Precision used to store the samples when solving from a vector of
+    /// samples, Quantized16 uses the state and action limits
+    SampleStore::Precision sample_precision;
+    /// Subsampling applied to the samples before computing the q_value and
+    /// the policies, the weights of the subset are approximated by
+    /// replicating the samples of the training sets of the q_value (see
+    /// applyWeights)
+    SampleSubsampler::Config subsampler_conf;
+    /// If not empty, the q_value, the number of iterations performed and the
+    /// timing counters are saved after each iteration on the q_value in files
+    /// starting by this prefix
+    std::string checkpoint_prefix;
+    /// If activated and if the checkpoint found at checkpoint_prefix was
+    /// computed with the same samples, the same training subset and the same
+    /// parameters for the q_value, solve starts from the checkpoint instead
+    /// of starting from scratch
+    bool resume;
 
     /// Config used for computing the Q-value
     regression_forests::ExtraTrees::Config q_value_conf;
@@ -84,11 +145,33 @@ public:
     virtual std::string class_name() const override;
     virtual void to_xml(std::ostream &out) const override;
     virtual void from_xml(TiXmlNode *node) override;
+
+    /// Write all the parameters which influence the q_value, used to check
+    /// that a checkpoint was computed with the same parameters
+    virtual void writeQValueParameters(std::ostream &out) const;
   };
 
 protected:
   /// A forest describing current q_value
   std::unique_ptr<regression_forests::Forest> q_value;
+  /// Computes the best action according to q_value, it is built from q_value
+  /// before computing training sets or policy actions
+  std::unique_ptr<ForestMaxQuery> q_max_query;
+  /// Computes the best action by gradient ascent when gp_values is used, it
+  /// is built at the same time as q_max_query
+  std::unique_ptr<GPForestQuery> q_gp_query;
+  /// Targets of the last training set computed for the q_value, used to
+  /// compute the residuals
+  Eigen::VectorXd last_q_targets;
+  /// Number of samples used to build the structure of q_value
+  size_t q_value_nb_samples;
+  /// Hash of the inputs of the samples used to build the structure of
+  /// q_value, a warm start is only possible if the first q_value_nb_samples
+  /// samples of the new training set have the same hash
+  uint64_t q_value_samples_hash;
+  /// Weights of the samples used by the current solve, empty if the samples
+  /// have not been subsampled
+  std::vector<double> sample_weights;
   /// Since action might be multi-dimensional, it is necessary to represent the
   /// policy by one forest for each dimension. This choice might lead to unsatisfying
   /// results, depending on the shape of the quality function with respect to the action
@@ -99,20 +182,51 @@ protected:
   ///       need to use a custom way of initializing the data, they should implement
   ///       the method which generate samples for a given interval
   regression_forests::TrainingSet
-  getTrainingSet(const std::vector<Sample>& samples,
+  getTrainingSet(const SampleSource& samples,
                  std::function<bool(const Eigen::VectorXd&)> is_terminal,
                  const Config &conf);
 
   /// Create a TrainingSet from current q_value, using samples from samples[start_idx,end_idx[
   virtual regression_forests::TrainingSet
-  getTrainingSet(const std::vector<Sample>& samples,
+  getTrainingSet(const SampleSource& samples,
                  std::function<bool(const Eigen::VectorXd&)> is_terminal,
                  const Config &conf,
                  int start_idx, int end_idx);
 
+  /// Fill 'subset' with the samples which should be used to solve the problem
+  /// and sample_weights with their weights, return false if all the samples
+  /// should be used without weights. The default implementation uses
+  /// conf.subsampler_conf.
+  virtual bool subsample(const SampleSource& samples, const Config &conf,
+                         SampleStore * subset);
+
+  /// Called once at the beginning of each solve with the samples used for the
+  /// q_value, allows to precompute data which do not change between the
+  /// iterations. Default implementation does nothing.
+  virtual void prepareSolve(const SampleSource& samples, const Config &conf);
+
+  /// Called once at the end of each solve, allows to release the data
+  /// computed by prepareSolve. Default implementation does nothing.
+  virtual void finishSolve();
+
+  /// Write the state of the solver which influences the q_value, apart from
+  /// the samples and the configuration (e.g. a knownness function). It is
+  /// hashed in the checkpoint keys. Default implementation writes nothing.
+  virtual void writeQValueState(const Config &conf, std::ostream &out) const;
+
+  /// Replicate the samples of ts according to sample_weights: each sample
+  /// appears round(weight / min_weight) times, so that the relative weights
+  /// are honoured. If the result would contain more than
+  /// conf.subsampler_conf.max_replication * ts.size() samples, the number of
+  /// copies is scaled down to fit, every sample still appearing at least
+  /// once; the lightest samples are then overweighted.
+  regression_forests::TrainingSet
+  applyWeights(const regression_forests::TrainingSet &ts,
+               const Config &conf) const;
+
   /// Perform one step of update on the Q-value, last_step might include special update.
   /// This function is virtual because some algorithms need to modify it.
-  virtual void updateQValue(const std::vector<Sample>& samples,
+  virtual void updateQValue(const SampleSource& samples,
                             std::function<bool(const Eigen::VectorXd&)> isTerminal,
                             Config &conf,
                             bool last_step);
@@ -122,7 +236,7 @@ protected:
   /// Note: this method is virtual, because other algorithms (such as MRE) might need to use a
   ///       custom way of creating their policy training state
   virtual std::vector<Eigen::VectorXd>
-  getPolicyTrainingStates(const std::vector<Sample>& samples,
+  getPolicyTrainingStates(const SampleSource& samples,
                           const Config &conf);
 
   /// This function is not virtual, because it mainly handle the multi threading
@@ -135,6 +249,85 @@ protected:
                    const Config &conf,
                    int start_idx, int end_idx);
 
+  /// Compute max_a Q(s,a) for each column s of states with a single batched
+  /// query on q_gp_query or q_max_query (depending on conf.gp_values), if
+  /// best_actions is provided, its columns are filled with the actions
+  /// reaching the maxima. 'method' is used in the error messages.
+  void getMaxQValues(const Eigen::MatrixXd &states, const Config &conf,
+                     const char * method, Eigen::VectorXd * values,
+                     Eigen::MatrixXd * best_actions = nullptr) const;
+
+  /// Return true if q_value can be refit from its current structure,
+  /// prefix_hash is the hash of the inputs of the first q_value_nb_samples
+  /// samples of ts
+  bool canWarmStart(const regression_forests::TrainingSet &ts,
+                    const regression_forests::ExtraTrees &q_learner,
+                    const Config &conf,
+                    uint64_t prefix_hash) const;
+
+  /// Build a new q_value from the structure of the current q_value: each
+  /// tree is refit with warmRefitNode
+  std::unique_ptr<regression_forests::Forest>
+  warmRefit(const regression_forests::TrainingSet &ts,
+            const regression_forests::ExtraTrees &q_learner,
+            const Config &conf) const;
+
+  /// Build a copy of 'node' where leaf values are the average of the targets
+  /// of the samples 'indices' of ts (which are inside 'space'). Leaves
+  /// containing new samples are replaced by a tree grown on their samples.
+  regression_forests::Node *
+  warmRefitNode(const regression_forests::Node * node,
+                const regression_forests::TrainingSet &ts,
+                const std::vector<int> &indices,
+                Eigen::MatrixXd &space,
+                const regression_forests::ExtraTrees &leaf_learner) const;
+
+  /// Append the residuals between the targets of 'ts' and the previous targets
+  /// to the config and store the new targets
+  void updateResiduals(const regression_forests::TrainingSet &ts, Config &conf);
+
+  /// Identifies the problem solved by a checkpoint, it is computed once per
+  /// solve
+  struct CheckpointKey
+  {
+    uint64_t nb_samples;
+    uint64_t samples_hash;
+    /// Number of samples used for the q_value (after subsampling)
+    uint64_t nb_training_samples;
+    /// Hash of the parameters influencing the q_value
+    uint64_t config_hash;
+    /// Hash of the state written by writeQValueState
+    uint64_t state_hash;
+  };
+
+  CheckpointKey getCheckpointKey(const SampleSource& samples,
+                                 const SampleSource& training_samples,
+                                 const Config &conf) const;
+
+  /// Write the checkpoint of the current q_value after 'nb_iterations'
+  /// iterations, files are replaced atomically
+  void saveCheckpoint(const CheckpointKey &key, const Config &conf,
+                      size_t nb_iterations, bool converged) const;
+
+  /// Restore q_value and the counters of conf from the checkpoint if it
+  /// matches the key, return false if there was no valid checkpoint. Throws
+  /// a std::runtime_error if the checkpoint is corrupted.
+  bool loadCheckpoint(const CheckpointKey &key, Config &conf,
+                      size_t * nb_iterations, bool * converged);
+
+  /// Hash of the content of the samples, used to check that a checkpoint
+  /// was computed with the same samples
+  static uint64_t hashSamples(const SampleSource& samples);
+  /// Hash of the parameters of conf which influence the q_value
+  static uint64_t hashConfig(const Config &conf);
+  /// Update 'hash' with the inputs of the samples [start, end[ of ts
+  static uint64_t hashInputs(const regression_forests::TrainingSet &ts,
+                             size_t start, size_t end, uint64_t hash);
+
+  /// Build q_max_query (or q_gp_query if gp_values is used) from current
+  /// q_value, both are reset if there is no q_value
+  void updateMaxQuery(const Config &conf);
+
   /// Compute the bestAction at given state according to the current q_value
   Eigen::VectorXd bestAction(const Eigen::VectorXd& state);
 
@@ -148,9 +341,22 @@ public:
   /// Remove the forest from the memory of the solver!!!
   std::unique_ptr<regression_forests::Forest> stealPolicyForest(int action_index);
 
+  /// Convert the samples to a SampleStore with conf.sample_precision and
+  /// solve the problem
   void solve(const std::vector<Sample>& samples,
              std::function<bool(const Eigen::VectorXd&)> is_terminal,
              Config &conf);
+
+  /// Solve the problem reading directly the samples from the source (e.g. a
+  /// TransitionView on histories), no copy of the samples is performed.
+  /// If conf.resume is activated, iterations on the q_value start from the
+  /// checkpoint (if it is valid)
+  void solve(const SampleSource& samples,
+             std::function<bool(const Eigen::VectorXd&)> is_terminal,
+             Config &conf);
+
+  static const char checkpoint_magic[8];
+  static const uint32_t checkpoint_version;
 };
 
 
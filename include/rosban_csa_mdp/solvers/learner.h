@@ -1,6 +1,7 @@
 #pragma once
 
 #include "rosban_csa_mdp/core/problem.h"
+#include "rosban_csa_mdp/core/sample_store.h"
 
 #include "rosban_utils/serializable.h"
 #include "rosban_utils/time_stamp.h"
@@ -41,6 +42,11 @@ public:
   /// Add the sample to the sample collection and take any required action
   virtual void feed(const csa_mdp::Sample & sample);
 
+  /// Feed the learner with a whole collection of samples, default implementation
+  /// calls 'feed' for each sample, learners should override it when a bulk
+  /// insertion is possible
+  virtual void feed(const csa_mdp::SampleSource & samples);
+
   /// Update the content of the learner, this method should not be called during
   /// a trial because it is likely to require a lot of time
   virtual void internalUpdate() = 0;
@@ -67,7 +73,7 @@ public:
 
 protected:
   /// Acquired samples until now
-  std::vector<Sample> samples;
+  SampleStore samples;
 
 protected:
   /// This function allows to test if a state is terminal
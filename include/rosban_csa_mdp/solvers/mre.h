@@ -3,6 +3,7 @@
 #include "rosban_csa_mdp/solvers/learner.h"
 
 #include "rosban_csa_mdp/core/sample.h"
+#include "rosban_csa_mdp/core/similarity_index.h"
 #include "rosban_csa_mdp/solvers/mre_fpf.h"
 #include "rosban_csa_mdp/knownness/knownness_forest.h"
 
@@ -29,6 +30,10 @@ public:
   /// Feed the learning process with a new sample, update policy if required
   void feed(const Sample &s) override;
 
+  /// Feed the learning process with several samples at once, the policy is
+  /// updated at most once (if plan_period was reached)
+  void feed(const SampleSource &new_samples) override;
+
   /// Return the best action according to current policy
   /// if there is no policy available yet, return a random action
   Eigen::VectorXd getAction(const Eigen::VectorXd &state) override;
@@ -48,6 +53,15 @@ public:
   void saveKnownnessTree(const std::string &prefix);
   void saveStatus(const std::string &prefix) override;
 
+  /// Save the samples, the knownness forest and the number of fed samples in
+  /// a compact binary file. If mrefpf_conf.checkpoint_prefix is not empty,
+  /// this is done automatically before each update of the policy.
+  void saveCheckpoint(const std::string &prefix);
+  /// Restore the state saved by saveCheckpoint, limits have to be set before.
+  /// If mrefpf_conf.resume is activated, the next update of the policy starts
+  /// from the checkpoint of the solver.
+  void loadCheckpoint(const std::string &prefix);
+
   void setStateLimits(const Eigen::MatrixXd & limits) override;
   void setActionLimits(const std::vector<Eigen::MatrixXd> & limits) override;
   void updateQSpaceLimits();
@@ -70,14 +84,25 @@ private:
   /// Knownness Forest
   std::shared_ptr<KnownnessForest> knownness_forest;
 
-  /// Acquired samples until now
-  std::vector<Sample> samples;
+  /// Index of the (state, action) of the samples kept, used to ignore similar
+  /// samples on feed when mrefpf_conf.filter_samples is enabled
+  SimilarityIndex similarity_index;
+
+  /// Number of samples received (including filtered samples)
+  int nb_fed_samples;
 
   /// Random generator
   std::default_random_engine random_engine;
 
   // Quick approach for implementation, yet not generic, force the use of FPF
   std::vector<std::unique_ptr<regression_forests::Forest>> policies;
+
+  /// Reset the similarity index with mrefpf_conf.filter_tolerance and insert
+  /// the samples kept
+  void rebuildSimilarityIndex();
+
+  static const char checkpoint_magic[8];
+  static const uint32_t checkpoint_version;
 };
 
 }
@@ -3,6 +3,9 @@
 #include "rosban_csa_mdp/solvers/fpf.h"
 #include "rosban_csa_mdp/knownness/knownness_function.h"
 
+#include <map>
+#include <vector>
+
 namespace csa_mdp
 {
 
@@ -30,8 +33,13 @@ public:
     virtual std::string class_name() const override;
     virtual void to_xml(std::ostream &out) const override;
     virtual void from_xml(TiXmlNode *node) override;
+    virtual void writeQValueParameters(std::ostream &out) const override;
 
+    /// If enabled, samples similar to a known sample are ignored
     bool filter_samples;
+    /// Two samples are similar if the maximal difference along the state and
+    /// action dimensions is lower than this tolerance
+    double filter_tolerance;
     double reward_max;
     UpdateType update_type;
   };
@@ -43,24 +51,48 @@ public:
 
 protected:
 
+  /// Compute the knownness of the inputs of all the samples in MRE and MRE_CI
+  /// modes and reset the knownness of the leaves. TrueType of conf must be
+  /// MREFPF::Config
+  virtual void prepareSolve(const SampleSource& samples,
+                            const FPF::Config &conf) override;
+
+  /// Release the knownness computed during the solve, they are not valid
+  /// anymore once new samples are pushed to the knownness function
+  virtual void finishSolve() override;
+
+  /// Write the state of the knownness function if it is used by the update.
+  /// TrueType of conf must be MREFPF::Config
+  virtual void writeQValueState(const FPF::Config &conf,
+                                std::ostream &out) const override;
+
   /// TrueType of conf must be MREFPF::Config
   virtual regression_forests::TrainingSet
-  getTrainingSet(const std::vector<Sample>& samples,
+  getTrainingSet(const SampleSource& samples,
                  std::function<bool(const Eigen::VectorXd&)> is_terminal,
                  const FPF::Config &conf,
                  int start_idx, int end_idx) override;
 
   /// TrueType of conf must be MREFPF::Config
   virtual void
-  updateQValue(const std::vector<Sample> &samples,
+  updateQValue(const SampleSource &samples,
                std::function<bool(const Eigen::VectorXd&)> is_terminal,
                FPF::Config &conf,
                bool last_step) override;
 
-  std::vector<Sample> filterSimilarSamples(const std::vector<Sample> &samples) const;
-
 private:
   std::shared_ptr<KnownnessFunction> knownness_func;
+
+  /// Knownness of the input (state, action) of each sample used by the
+  /// current solve, empty if it is not required by the update type. The
+  /// knownness function does not change during a solve, thus the values are
+  /// reused at each iteration.
+  std::vector<double> sample_knownness;
+
+  /// Knownness of the middle of the leaves encountered during the current
+  /// solve (Alternative update), leaves which are kept between iterations do
+  /// not require a new computation
+  std::map<std::vector<double>, double> leaf_knownness;
 };
 
 std::string to_string(MREFPF::UpdateType type);
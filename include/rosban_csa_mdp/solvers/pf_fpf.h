@@ -1,5 +1,6 @@
 #pragma once
 
+#include "rosban_csa_mdp/core/forest_max_query.h"
 #include "rosban_csa_mdp/core/sample.h"
 #include "rosban_csa_mdp/knownness/knownness_function.h"
 
@@ -31,9 +32,16 @@ public:
     size_t horizon;
     /// The discount factor of the MDP
     double discount;
-    /// The final size of the tree when merging the forest into a single tree for a given action
-    /// TODO: this parameter should be set automatically, but how?
+    /// The maximal number of tiles of the projected tree used by previous
+    /// versions to search the best action of the q_value. The best action is
+    /// now computed exactly by ForestMaxQuery, thus this parameter is only
+    /// kept for the compatibility of configuration files
     size_t max_action_tiles;
+    /// If > 0, the search of the best action of the q_value for a given state
+    /// stops after evaluating 'max_query_tiles' boxes of the action space and
+    /// returns the best action found, which might not be optimal. Default is
+    /// 0: the search is exact
+    int max_query_tiles;
     /// The time spent learning the q_value [s]
     double q_value_time;
     /// The time spent learning the policy from the q_value [s]
@@ -70,13 +78,15 @@ private:
                  const Config &conf,
                  std::shared_ptr<regression_forests::Forest> q_value);
 
-  /// Create a TrainingSet from given q_value, using samples from samples[start_idx,end_idx[
-  /// This function makes multi-threading easier
+  /// Create a TrainingSet from the query built on the q_value (nullptr if
+  /// there is no q_value yet), using samples from samples[start_idx,end_idx[
+  /// This function makes multi-threading easier, the query is shared by all
+  /// the calls
   regression_forests::TrainingSet
   getTrainingSet(const std::vector<Sample>& samples,
                  std::function<bool(const Eigen::VectorXd&)> is_terminal,
                  const Config &conf,
-                 std::shared_ptr<regression_forests::Forest> q_value,
+                 const ForestMaxQuery * q_max_query,
                  int start_idx, int end_idx);
 
   /// Perform one step of update on the Q-value.
@@ -0,0 +1,138 @@
+#include "kd_trees/kd_tree.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdlib>
+#include <iostream>
+#include <random>
+#include <stdexcept>
+#include <string>
+
+using kd_trees::KdTree;
+
+/// Compares the kNN and radius queries of KdTree with a brute force search
+/// on uniformly distributed points, results of both methods are checked to
+/// be identical.
+int main(int argc, char ** argv)
+{
+  if (argc > 6)
+  {
+    std::cout << "Usage: " << argv[0]
+              << " [nb_points] [dims] [nb_queries] [k] [radius]" << std::endl;
+    exit(EXIT_FAILURE);
+  }
+  int nb_points  = argc > 1 ? std::atoi(argv[1]) : 100000;
+  int dims       = argc > 2 ? std::atoi(argv[2]) : 4;
+  int nb_queries = argc > 3 ? std::atoi(argv[3]) : 1000;
+  int k          = argc > 4 ? std::atoi(argv[4]) : 10;
+  double radius  = argc > 5 ? std::atof(argv[5]) : 0.05;
+  int max_leaf_points = 10;
+
+  typedef std::chrono::steady_clock Clock;
+  auto elapsed_ms = [](Clock::time_point start)
+    {
+      return std::chrono::duration<double, std::milli>(Clock::now() - start).count();
+    };
+
+  std::default_random_engine engine(0);
+  std::uniform_real_distribution<double> distrib(0, 1);
+  Eigen::MatrixXd space(dims, 2);
+  space.col(0).setZero();
+  space.col(1).setOnes();
+  Eigen::MatrixXd points(dims, nb_points), queries(dims, nb_queries);
+  for (int i = 0; i < nb_points; i++)
+    for (int d = 0; d < dims; d++)
+      points(d, i) = distrib(engine);
+  for (int i = 0; i < nb_queries; i++)
+    for (int d = 0; d < dims; d++)
+      queries(d, i) = distrib(engine);
+
+  // Leaves are split at the middle of their space, cycling on dimensions
+  Clock::time_point start = Clock::now();
+  KdTree tree(space);
+  Eigen::MatrixXd leaf_space;
+  Eigen::VectorXd point(dims);
+  int next_split_dim = 0;
+  for (int i = 0; i < nb_points; i++)
+  {
+    point = points.col(i);
+    int leaf = tree.getLeafWithSpace(point, &leaf_space);
+    tree.push(leaf, point);
+    if (tree.getNbPoints(leaf) > max_leaf_points)
+    {
+      double split_val = (leaf_space(next_split_dim, 0) + leaf_space(next_split_dim, 1)) / 2;
+      tree.split(leaf, next_split_dim, split_val);
+      next_split_dim = (next_split_dim + 1) % dims;
+    }
+  }
+  std::cout << "Tree built in " << elapsed_ms(start) << " ms ("
+            << tree.nbNodes() << " nodes)" << std::endl;
+
+  // Brute force: squared distances to all the points
+  std::vector<std::vector<double>> bf_knn(nb_queries), bf_radius(nb_queries);
+  start = Clock::now();
+  std::vector<double> distances(nb_points);
+  for (int q = 0; q < nb_queries; q++)
+  {
+    for (int i = 0; i < nb_points; i++)
+    {
+      distances[i] = (points.col(i) - queries.col(q)).squaredNorm();
+    }
+    int nb_kept = std::min(k, nb_points);
+    std::partial_sort(distances.begin(), distances.begin() + nb_kept, distances.end());
+    bf_knn[q].assign(distances.begin(), distances.begin() + nb_kept);
+  }
+  double bf_knn_time = elapsed_ms(start);
+  start = Clock::now();
+  for (int q = 0; q < nb_queries; q++)
+  {
+    for (int i = 0; i < nb_points; i++)
+    {
+      double dist = (points.col(i) - queries.col(q)).squaredNorm();
+      if (dist <= radius * radius) bf_radius[q].push_back(dist);
+    }
+    std::sort(bf_radius[q].begin(), bf_radius[q].end());
+  }
+  double bf_radius_time = elapsed_ms(start);
+
+  // KdTree: batched queries
+  std::vector<std::vector<KdTree::Neighbor>> knn, within_radius;
+  start = Clock::now();
+  tree.getKNearest(queries, k, &knn);
+  double tree_knn_time = elapsed_ms(start);
+  start = Clock::now();
+  tree.getWithinRadius(queries, radius, &within_radius);
+  double tree_radius_time = elapsed_ms(start);
+
+  // Checking that results are identical (ties might be ordered differently,
+  // therefore only distances are compared)
+  auto check = [](const std::vector<double> & expected,
+                  const std::vector<KdTree::Neighbor> & found,
+                  const std::string & query_name)
+    {
+      bool valid = expected.size() == found.size();
+      for (size_t i = 0; valid && i < expected.size(); i++)
+      {
+        valid = std::fabs(expected[i] - found[i].squaredDist) < 1e-12;
+      }
+      if (!valid)
+      {
+        throw std::logic_error("Mismatch between brute force and KdTree for " + query_name);
+      }
+    };
+  for (int q = 0; q < nb_queries; q++)
+  {
+    check(bf_knn[q], knn[q], "kNN");
+    check(bf_radius[q], within_radius[q], "radius");
+  }
+
+  std::cout << nb_queries << " queries on " << nb_points << " points in dimension "
+            << dims << std::endl
+            << "kNN (k=" << k << "):" << std::endl
+            << "\tbrute force: " << bf_knn_time << " ms" << std::endl
+            << "\tkd_tree    : " << tree_knn_time << " ms" << std::endl
+            << "radius (r=" << radius << "):" << std::endl
+            << "\tbrute force: " << bf_radius_time << " ms" << std::endl
+            << "\tkd_tree    : " << tree_radius_time << " ms" << std::endl;
+}
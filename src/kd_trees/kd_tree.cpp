@@ -1,23 +1,66 @@
 #include "kd_trees/kd_tree.h"
 
+#include <algorithm>
+#include <limits>
+#include <sstream>
+#include <stdexcept>
+
 namespace kd_trees
 {
 
+const int KdTree::min_capacity = 4;
+
 KdTree::KdTree(const Eigen::MatrixXd & tree_space)
-  : space(tree_space)
+  : nodes(1), space(tree_space), coordinates(tree_space.rows()), buffer_size(0)
 {
 }
 
-const KdNode * KdTree::getRoot() const
+int KdTree::allocateBlock(int nb_points, int * capacity)
 {
-  return &root;
+  int level = 0;
+  *capacity = min_capacity;
+  while (*capacity < nb_points) {
+    *capacity *= 2;
+    level++;
+  }
+  if (level < (int)free_blocks.size() && free_blocks[level].size() > 0) {
+    int start = free_blocks[level].back();
+    free_blocks[level].pop_back();
+    return start;
+  }
+  int start = buffer_size;
+  buffer_size += *capacity;
+  for (std::vector<double> & dim_coordinates : coordinates) {
+    dim_coordinates.resize(buffer_size);
+  }
+  return start;
 }
 
-std::vector<KdNode *> KdTree::getLeaves()
+void KdTree::releaseBlock(int start, int capacity)
 {
-  std::vector<KdNode *> leaves;
-  root.addLeaves(leaves);
-  return leaves;
+  if (start < 0) return;
+  int level = 0;
+  while ((min_capacity << level) < capacity) {
+    level++;
+  }
+  if (level >= (int)free_blocks.size()) {
+    free_blocks.resize(level + 1);
+  }
+  free_blocks[level].push_back(start);
+}
+
+void KdTree::checkLeaf(int node, const char * method) const
+{
+  if (node < 0 || node >= (int)nodes.size()) {
+    std::ostringstream oss;
+    oss << "KdTree::" << method << ": invalid node index " << node;
+    throw std::out_of_range(oss.str());
+  }
+  if (!nodes[node].isLeaf()) {
+    std::ostringstream oss;
+    oss << "KdTree::" << method << ": node " << node << " is not a leaf";
+    throw std::runtime_error(oss.str());
+  }
 }
 
 int KdTree::dim() const
@@ -25,19 +68,368 @@ int KdTree::dim() const
   return space.rows();
 }
 
-KdNode * KdTree::getLeaf(const Eigen::VectorXd& point)
+int KdTree::nbNodes() const
+{
+  return nodes.size();
+}
+
+int KdTree::getRoot() const
+{
+  return 0;
+}
+
+const KdNode & KdTree::getNode(int node) const
+{
+  return nodes[node];
+}
+
+bool KdTree::isLeaf(int node) const
+{
+  return nodes[node].isLeaf();
+}
+
+int KdTree::getLowerChild(int node) const
+{
+  return nodes[node].lChild;
+}
+
+int KdTree::getUpperChild(int node) const
+{
+  return nodes[node].uChild;
+}
+
+int KdTree::getSplitDim(int node) const
+{
+  return nodes[node].splitDim;
+}
+
+double KdTree::getSplitVal(int node) const
+{
+  return nodes[node].splitValue;
+}
+
+std::vector<int> KdTree::getLeaves() const
+{
+  std::vector<int> leaves;
+  for (size_t node = 0; node < nodes.size(); node++) {
+    if (nodes[node].isLeaf()) {
+      leaves.push_back(node);
+    }
+  }
+  return leaves;
+}
+
+int KdTree::getLeaf(const Eigen::VectorXd& point) const
+{
+  int node = 0;
+  while (!nodes[node].isLeaf()) {
+    const KdNode & current = nodes[node];
+    node = point(current.splitDim) > current.splitValue ? current.uChild : current.lChild;
+  }
+  return node;
+}
+
+int KdTree::getLeafWithSpace(const Eigen::VectorXd& point,
+                             Eigen::MatrixXd * leaf_space) const
+{
+  // No allocation if leaf_space already has the right dimensions
+  *leaf_space = space;
+  int node = 0;
+  while (!nodes[node].isLeaf()) {
+    const KdNode & current = nodes[node];
+    if (point(current.splitDim) > current.splitValue) {
+      (*leaf_space)(current.splitDim, 0) = current.splitValue;
+      node = current.uChild;
+    }
+    else {
+      (*leaf_space)(current.splitDim, 1) = current.splitValue;
+      node = current.lChild;
+    }
+  }
+  return node;
+}
+
+int KdTree::getNbPoints(int leaf) const
+{
+  return nodes[leaf].nbPoints;
+}
+
+const double * KdTree::getCoordinates(int leaf, int dim) const
+{
+  const KdNode & node = nodes[leaf];
+  if (node.start < 0) return nullptr;
+  return coordinates[dim].data() + node.start;
+}
+
+Eigen::VectorXd KdTree::getPoint(int leaf, int index) const
+{
+  const KdNode & node = nodes[leaf];
+  if (index < 0 || index >= node.nbPoints) {
+    std::ostringstream oss;
+    oss << "KdTree::getPoint: invalid index " << index << " for a leaf with "
+        << node.nbPoints << " points";
+    throw std::out_of_range(oss.str());
+  }
+  Eigen::VectorXd point(dim());
+  for (int d = 0; d < dim(); d++) {
+    point(d) = coordinates[d][node.start + index];
+  }
+  return point;
+}
+
+int KdTree::push(const Eigen::VectorXd& point)
+{
+  int leaf = getLeaf(point);
+  push(leaf, point);
+  return leaf;
+}
+
+void KdTree::push(int leaf, const Eigen::VectorXd& point)
+{
+  checkLeaf(leaf, "push");
+  KdNode & node = nodes[leaf];
+  // Block is full: points are moved to a block twice larger
+  if (node.nbPoints == node.capacity) {
+    int new_capacity;
+    int new_start = allocateBlock(2 * node.capacity, &new_capacity);
+    for (std::vector<double> & dim_coordinates : coordinates) {
+      for (int i = 0; i < node.nbPoints; i++) {
+        dim_coordinates[new_start + i] = dim_coordinates[node.start + i];
+      }
+    }
+    releaseBlock(node.start, node.capacity);
+    node.start = new_start;
+    node.capacity = new_capacity;
+  }
+  for (int d = 0; d < dim(); d++) {
+    coordinates[d][node.start + node.nbPoints] = point(d);
+  }
+  node.nbPoints++;
+}
+
+void KdTree::popBack(int leaf)
+{
+  checkLeaf(leaf, "popBack");
+  if (nodes[leaf].nbPoints == 0) {
+    throw std::runtime_error("KdTree::popBack: leaf is empty");
+  }
+  nodes[leaf].nbPoints--;
+}
+
+void KdTree::split(int leaf, int splitDim, double splitValue)
+{
+  checkLeaf(leaf, "split");
+  const double * split_coordinates = getCoordinates(leaf, splitDim);
+  int nb_points = nodes[leaf].nbPoints;
+  int nb_lower = 0;
+  for (int i = 0; i < nb_points; i++) {
+    if (split_coordinates[i] <= splitValue) nb_lower++;
+  }
+  int nb_upper = nb_points - nb_lower;
+  // Children are appended to the array, no reference is kept before
+  int lower = nodes.size();
+  int upper = lower + 1;
+  nodes.resize(nodes.size() + 2);
+  KdNode & lower_node = nodes[lower];
+  KdNode & upper_node = nodes[upper];
+  if (nb_lower > 0) {
+    lower_node.start = allocateBlock(nb_lower, &lower_node.capacity);
+  }
+  if (nb_upper > 0) {
+    upper_node.start = allocateBlock(nb_upper, &upper_node.capacity);
+  }
+  KdNode & node = nodes[leaf];
+  // Points are dispatched in their order of insertion
+  for (int i = 0; i < nb_points; i++) {
+    int src = node.start + i;
+    KdNode & child = coordinates[splitDim][src] > splitValue ? upper_node : lower_node;
+    int dst = child.start + child.nbPoints;
+    for (std::vector<double> & dim_coordinates : coordinates) {
+      dim_coordinates[dst] = dim_coordinates[src];
+    }
+    child.nbPoints++;
+  }
+  releaseBlock(node.start, node.capacity);
+  node.lChild = lower;
+  node.uChild = upper;
+  node.splitDim = splitDim;
+  node.splitValue = splitValue;
+  node.start = -1;
+  node.nbPoints = 0;
+  node.capacity = 0;
+}
+
+void KdTree::checkQuery(const Eigen::VectorXd& point, const char * method) const
+{
+  if (point.rows() != dim()) {
+    std::ostringstream oss;
+    oss << "KdTree::" << method << ": invalid dimension for query (" << point.rows()
+        << " while " << dim() << " was expected)";
+    throw std::runtime_error(oss.str());
+  }
+}
+
+void KdTree::computeSquaredDistances(int leaf, const Eigen::VectorXd& point,
+                                     QueryBuffers * buffers) const
+{
+  const KdNode & node = nodes[leaf];
+  if ((int)buffers->distances.size() < node.nbPoints) {
+    buffers->distances.resize(node.nbPoints);
+  }
+  double * distances = buffers->distances.data();
+  for (int i = 0; i < node.nbPoints; i++) {
+    distances[i] = 0;
+  }
+  for (int d = 0; d < dim(); d++) {
+    const double * values = coordinates[d].data() + node.start;
+    double value = point(d);
+    for (int i = 0; i < node.nbPoints; i++) {
+      double diff = values[i] - value;
+      distances[i] += diff * diff;
+    }
+  }
+}
+
+template <typename LeafHandler>
+void KdTree::explore(const Eigen::VectorXd& point, double * threshold,
+                     QueryBuffers * buffers, LeafHandler onLeaf) const
+{
+  std::vector<std::pair<int, double>> & stack = buffers->stack;
+  stack.clear();
+  stack.push_back(std::pair<int, double>(0, 0.0));
+  while (stack.size() > 0) {
+    int node = stack.back().first;
+    double bound = stack.back().second;
+    stack.pop_back();
+    if (bound > *threshold) continue;
+    // Descend toward the point, the other children are explored later if
+    // their bound is still below the threshold. The bound of the other child
+    // is not tight: it only accounts for the largest offset along one
+    // dimension
+    while (!nodes[node].isLeaf()) {
+      const KdNode & current = nodes[node];
+      double diff = point(current.splitDim) - current.splitValue;
+      double far_bound = std::max(bound, diff * diff);
+      if (diff > 0) {
+        stack.push_back(std::pair<int, double>(current.lChild, far_bound));
+        node = current.uChild;
+      }
+      else {
+        stack.push_back(std::pair<int, double>(current.uChild, far_bound));
+        node = current.lChild;
+      }
+    }
+    if (nodes[node].nbPoints == 0) continue;
+    computeSquaredDistances(node, point, buffers);
+    onLeaf(node);
+  }
+}
+
+void KdTree::getKNearest(const Eigen::VectorXd& point, int k,
+                         std::vector<Neighbor> * neighbors) const
+{
+  QueryBuffers buffers;
+  getKNearest(point, k, &buffers, neighbors);
+}
+
+void KdTree::getKNearest(const Eigen::MatrixXd& points, int k,
+                         std::vector<std::vector<Neighbor>> * neighbors) const
+{
+  QueryBuffers buffers;
+  neighbors->resize(points.cols());
+  Eigen::VectorXd point(points.rows());
+  for (int col = 0; col < points.cols(); col++) {
+    point = points.col(col);
+    getKNearest(point, k, &buffers, &((*neighbors)[col]));
+  }
+}
+
+void KdTree::getKNearest(const Eigen::VectorXd& point, int k,
+                         QueryBuffers * buffers,
+                         std::vector<Neighbor> * neighbors) const
+{
+  checkQuery(point, "getKNearest");
+  if (k <= 0) {
+    throw std::runtime_error("KdTree::getKNearest: k should be strictly positive");
+  }
+  // neighbors is used as a bounded max-heap on the distance
+  auto closer = [](const Neighbor & n1, const Neighbor & n2)
+    {
+      return n1.squaredDist < n2.squaredDist;
+    };
+  neighbors->clear();
+  double threshold = std::numeric_limits<double>::max();
+  explore(point, &threshold, buffers,
+          [&](int leaf)
+          {
+            const double * distances = buffers->distances.data();
+            for (int i = 0; i < nodes[leaf].nbPoints; i++) {
+              if ((int)neighbors->size() == k) {
+                if (distances[i] >= threshold) continue;
+                std::pop_heap(neighbors->begin(), neighbors->end(), closer);
+                neighbors->pop_back();
+              }
+              Neighbor neighbor;
+              neighbor.leaf = leaf;
+              neighbor.index = i;
+              neighbor.squaredDist = distances[i];
+              neighbors->push_back(neighbor);
+              std::push_heap(neighbors->begin(), neighbors->end(), closer);
+              if ((int)neighbors->size() == k) {
+                threshold = neighbors->front().squaredDist;
+              }
+            }
+          });
+  std::sort_heap(neighbors->begin(), neighbors->end(), closer);
+}
+
+void KdTree::getWithinRadius(const Eigen::VectorXd& point, double radius,
+                             std::vector<Neighbor> * neighbors) const
 {
-  return root.getLeaf(point);
+  QueryBuffers buffers;
+  getWithinRadius(point, radius, &buffers, neighbors);
 }
 
-const KdNode * KdTree::getLeaf(const Eigen::VectorXd& point) const
+void KdTree::getWithinRadius(const Eigen::MatrixXd& points, double radius,
+                             std::vector<std::vector<Neighbor>> * neighbors) const
 {
-  return root.getLeaf(point);
+  QueryBuffers buffers;
+  neighbors->resize(points.cols());
+  Eigen::VectorXd point(points.rows());
+  for (int col = 0; col < points.cols(); col++) {
+    point = points.col(col);
+    getWithinRadius(point, radius, &buffers, &((*neighbors)[col]));
+  }
 }
 
-void KdTree::push(const Eigen::VectorXd& point)
+void KdTree::getWithinRadius(const Eigen::VectorXd& point, double radius,
+                             QueryBuffers * buffers,
+                             std::vector<Neighbor> * neighbors) const
 {
-  getLeaf(point)->push(point);
+  checkQuery(point, "getWithinRadius");
+  if (radius < 0) {
+    throw std::runtime_error("KdTree::getWithinRadius: radius should be positive");
+  }
+  neighbors->clear();
+  double threshold = radius * radius;
+  explore(point, &threshold, buffers,
+          [&](int leaf)
+          {
+            const double * distances = buffers->distances.data();
+            for (int i = 0; i < nodes[leaf].nbPoints; i++) {
+              if (distances[i] > threshold) continue;
+              Neighbor neighbor;
+              neighbor.leaf = leaf;
+              neighbor.index = i;
+              neighbor.squaredDist = distances[i];
+              neighbors->push_back(neighbor);
+            }
+          });
+  std::sort(neighbors->begin(), neighbors->end(),
+            [](const Neighbor & n1, const Neighbor & n2)
+            {
+              return n1.squaredDist < n2.squaredDist;
+            });
 }
 
 const Eigen::MatrixXd & KdTree::getSpace() const
@@ -47,8 +439,8 @@ const Eigen::MatrixXd & KdTree::getSpace() const
 
 Eigen::MatrixXd KdTree::getSpace(const Eigen::VectorXd& point) const
 {
-  Eigen::MatrixXd leaf_space = space;
-  root.leafSpace(leaf_space, point);
+  Eigen::MatrixXd leaf_space;
+  getLeafWithSpace(point, &leaf_space);
   return leaf_space;
 }
 
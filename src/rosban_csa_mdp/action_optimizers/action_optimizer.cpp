@@ -7,6 +7,19 @@ ActionOptimizer::ActionOptimizer() : nb_threads(1) {}
 
 ActionOptimizer::~ActionOptimizer() {}
 
+Eigen::VectorXd ActionOptimizer::optimize(const Eigen::VectorXd & input,
+                                          const Eigen::MatrixXd & action_limits,
+                                          std::shared_ptr<const Policy> current_policy,
+                                          Problem::BatchResultFunction result_function,
+                                          Problem::ValueFunction value_function,
+                                          double discount,
+                                          std::default_random_engine * engine) const
+{
+  return optimize(input, action_limits, current_policy,
+                  Problem::toResultFunction(result_function),
+                  value_function, discount, engine);
+}
+
 void ActionOptimizer::setNbThreads(int new_nb_threads)
 {
   nb_threads = new_nb_threads;
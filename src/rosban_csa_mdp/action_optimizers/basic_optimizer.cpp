@@ -1,5 +1,8 @@
 #include "rosban_csa_mdp/action_optimizers/basic_optimizer.h"
 
+#include "rosban_csa_mdp/core/rollout_engine.h"
+#include "rosban_csa_mdp/core/worker_pool.h"
+
 #include "rosban_fa/function_approximator.h"
 #include "rosban_fa/gp_trainer.h"
 #include "rosban_fa/trainer_factory.h"
@@ -33,6 +36,19 @@ Eigen::VectorXd BasicOptimizer::optimize(const Eigen::VectorXd & input,
                                          Problem::ValueFunction value_function,
                                          double discount,
                                          std::default_random_engine * engine) const
+{
+  return optimize(input, action_limits, current_policy,
+                  Problem::toBatchResultFunction(result_function),
+                  value_function, discount, engine);
+}
+
+Eigen::VectorXd BasicOptimizer::optimize(const Eigen::VectorXd & input,
+                                         const Eigen::MatrixXd & action_limits,
+                                         std::shared_ptr<const Policy> current_policy,
+                                         Problem::BatchResultFunction result_function,
+                                         Problem::ValueFunction value_function,
+                                         double discount,
+                                         std::default_random_engine * engine) const
 {
   bool clean_engine = false;
   if (engine == nullptr) {
@@ -52,7 +68,7 @@ Eigen::VectorXd BasicOptimizer::optimize(const Eigen::VectorXd & input,
   AOTask task = getTask(input, actions, current_policy, result_function,
                         value_function, discount, results);
   // Now filling reward in parallel
-  MultiCore::runParallelStochasticTask(task, nb_actions, &engines);
+  WorkerPool::runParallelStochasticTask(task, nb_actions, &engines);
   // Train a function approximator
   std::unique_ptr<rosban_fa::FunctionApproximator> approximator;
   approximator = trainer->train(actions, results, action_limits);
@@ -78,7 +94,7 @@ Eigen::VectorXd BasicOptimizer::optimize(const Eigen::VectorXd & input,
 BasicOptimizer::AOTask BasicOptimizer::getTask(const Eigen::VectorXd & input,
                                                const Eigen::MatrixXd & actions,
                                                std::shared_ptr<const Policy> policy,
-                                               Problem::ResultFunction result_function,
+                                               Problem::BatchResultFunction result_function,
                                                Problem::ValueFunction value_function,
                                                double discount,
                                                Eigen::VectorXd & results) const
@@ -87,34 +103,22 @@ BasicOptimizer::AOTask BasicOptimizer::getTask(const Eigen::VectorXd & input,
           value_function, discount, &results]
     (int start_idx, int end_idx, std::default_random_engine * engine)
     {
+      // The engine keeps its buffers for all the actions of the chunk
+      RolloutEngine rollout_engine(result_function);
+      Eigen::MatrixXd initial_states = input.replicate(1, nb_simulations);
       for (int action = start_idx; action < end_idx; action++)
       {
-        Eigen::VectorXd initial_action = actions.col(action);
-        // Prepare simulations data
-        double total_reward = 0;
-        // Compute several simulations
-        for (int sim = 0; sim < nb_simulations; sim++) {
-          // 1. Using chosen action
-          Problem::Result result = result_function(input, initial_action, engine);
-          total_reward += result.reward;
-          double coeff = discount;
-          // 2. Using policy for a few steps
-          for (int i = 0; i < this->nb_additional_steps; i++)
-          {
-            // Stop predicting steps if a terminal state has been reached
-            if (result.terminal) break;
-
-            Eigen::VectorXd action = policy->getAction(result.successor, engine);
-            result = result_function(result.successor, action, engine);
-            total_reward += coeff * result.reward;
-            coeff *= discount;
-          }
-          // 3. Using value at final state if provided
-          if (value_function && !result.terminal) {
-            total_reward += coeff * value_function(result.successor);
-          }
+        // All the simulations are computed simultaneously:
+        // 1. Using chosen action
+        // 2. Using policy for a few steps
+        Eigen::MatrixXd initial_actions = actions.col(action).replicate(1, nb_simulations);
+        rollout_engine.run(initial_states, *policy, 1 + this->nb_additional_steps, discount,
+                           engine, &initial_actions);
+        // 3. Using value at final state if provided
+        if (value_function) {
+          rollout_engine.addFinalValues(value_function);
         }
-        results(action) = total_reward / nb_simulations;
+        results(action) = rollout_engine.getRewards().mean();
       }
     };
 }
@@ -0,0 +1,214 @@
+#include "rosban_csa_mdp/core/csv_reader.h"
+
+#include <algorithm>
+#include <cstdlib>
+#include <cstring>
+#include <limits>
+#include <sstream>
+#include <stdexcept>
+
+namespace csa_mdp
+{
+
+const size_t CSVReader::default_buffer_size = 1 << 20;
+
+CSVReader::Stats::Stats()
+  : rows(0), elapsed(0)
+{
+}
+
+double CSVReader::Stats::getRowsPerSec() const
+{
+  if (elapsed <= 0) return 0;
+  return rows / elapsed;
+}
+
+CSVReader::CSVReader(const std::string & path_,
+                     char separator_,
+                     size_t buffer_size)
+  : path(path_), separator(separator_)
+{
+  open(0, std::numeric_limits<size_t>::max(), buffer_size);
+}
+
+CSVReader::CSVReader(const std::string & path_,
+                     size_t begin, size_t end,
+                     char separator_,
+                     size_t buffer_size)
+  : path(path_), separator(separator_)
+{
+  open(begin, end, buffer_size);
+}
+
+void CSVReader::open(size_t begin, size_t end, size_t buffer_size)
+{
+  file.open(path, std::ios::binary);
+  if (!file.good())
+  {
+    throw std::runtime_error("CSVReader: Failed to open file '" + path + "'");
+  }
+  buffer.resize(std::max(buffer_size, (size_t)2));
+  buffer_offset = 0;
+  data_start = 0;
+  data_end = 0;
+  end_offset = end;
+  file_ended = false;
+  row_offset = 0;
+  if (begin == 0) return;
+  // The range starts at the first line beginning at or after 'begin': start
+  // reading at 'begin - 1' and skip everything until the end of that line
+  file.seekg(begin - 1);
+  buffer_offset = begin - 1;
+  while (true)
+  {
+    char * start = buffer.data() + data_start;
+    char * line_end = (char *)memchr(start, '\n', data_end - data_start);
+    if (line_end != nullptr)
+    {
+      data_start = line_end - buffer.data() + 1;
+      return;
+    }
+    data_start = data_end;
+    if (!refill()) return;
+  }
+}
+
+bool CSVReader::nextRow()
+{
+  while (true)
+  {
+    size_t next_offset = buffer_offset + data_start;
+    if (next_offset >= end_offset) return false;
+    char * line_start = buffer.data() + data_start;
+    char * line_end = (char *)memchr(line_start, '\n', data_end - data_start);
+    if (line_end == nullptr)
+    {
+      // Incomplete line: read more data if possible
+      if (refill()) continue;
+      // Last line of the file without a newline
+      if (data_start == data_end) return false;
+      line_end = buffer.data() + data_end;
+      data_start = data_end;
+    }
+    else
+    {
+      data_start = line_end - buffer.data() + 1;
+    }
+    *line_end = '\0';
+    // Handle files with windows line endings
+    if (line_end > line_start && *(line_end - 1) == '\r')
+    {
+      line_end--;
+      *line_end = '\0';
+    }
+    if (line_end == line_start) continue;
+    row_offset = next_offset;
+    tokenize(line_start, line_end);
+    return true;
+  }
+}
+
+int CSVReader::nbCols() const
+{
+  return fields.size();
+}
+
+size_t CSVReader::getRowOffset() const
+{
+  return row_offset;
+}
+
+const char * CSVReader::getField(int col) const
+{
+  if (col < 0 || col >= (int)fields.size())
+  {
+    std::ostringstream oss;
+    oss << "CSVReader::getField: column " << col << " is not available in row at offset "
+        << row_offset << " of '" << path << "' (" << fields.size() << " columns)";
+    throw std::runtime_error(oss.str());
+  }
+  return fields[col];
+}
+
+double CSVReader::getDouble(int col) const
+{
+  const char * str = getField(col);
+  char * end;
+  double value = std::strtod(str, &end);
+  if (end == str)
+  {
+    std::ostringstream oss;
+    oss << "CSVReader::getDouble: invalid number '" << str << "' at column " << col
+        << " of row at offset " << row_offset << " in '" << path << "'";
+    throw std::runtime_error(oss.str());
+  }
+  return value;
+}
+
+long CSVReader::getLong(int col) const
+{
+  const char * str = getField(col);
+  char * end;
+  long value = std::strtol(str, &end, 10);
+  if (end == str)
+  {
+    std::ostringstream oss;
+    oss << "CSVReader::getLong: invalid number '" << str << "' at column " << col
+        << " of row at offset " << row_offset << " in '" << path << "'";
+    throw std::runtime_error(oss.str());
+  }
+  return value;
+}
+
+size_t CSVReader::getFileSize(const std::string & path)
+{
+  std::ifstream file(path, std::ios::binary | std::ios::ate);
+  if (!file.good())
+  {
+    throw std::runtime_error("CSVReader: Failed to open file '" + path + "'");
+  }
+  return file.tellg();
+}
+
+bool CSVReader::refill()
+{
+  if (file_ended) return false;
+  // Moving unprocessed data to the beginning of the buffer
+  size_t remaining = data_end - data_start;
+  if (data_start > 0)
+  {
+    memmove(buffer.data(), buffer.data() + data_start, remaining);
+    buffer_offset += data_start;
+    data_start = 0;
+    data_end = remaining;
+  }
+  // If a single line fills the buffer, it needs to grow
+  if (data_end + 1 >= buffer.size())
+  {
+    buffer.resize(2 * buffer.size());
+  }
+  file.read(buffer.data() + data_end, buffer.size() - 1 - data_end);
+  size_t nb_read = file.gcount();
+  data_end += nb_read;
+  if (nb_read == 0 || file.eof())
+  {
+    file_ended = true;
+  }
+  return nb_read > 0;
+}
+
+void CSVReader::tokenize(char * line_start, char * line_end)
+{
+  fields.clear();
+  fields.push_back(line_start);
+  for (char * c = line_start; c < line_end; c++)
+  {
+    if (*c == separator)
+    {
+      *c = '\0';
+      fields.push_back(c + 1);
+    }
+  }
+}
+
+}
@@ -0,0 +1,290 @@
+#include "rosban_csa_mdp/core/forest_max_query.h"
+
+#include "rosban_regression_forests/approximations/pwc_approximation.h"
+
+#include <limits>
+#include <sstream>
+#include <stdexcept>
+
+using regression_forests::Approximation;
+using regression_forests::Node;
+using regression_forests::PWCApproximation;
+
+namespace csa_mdp
+{
+
+ForestMaxQuery::Scratch::Scratch()
+{
+}
+
+ForestMaxQuery::ForestMaxQuery(const regression_forests::Forest & forest,
+                               const Eigen::MatrixXd & input_limits,
+                               int state_dims_, int max_tiles_)
+  : state_dims(state_dims_), max_tiles(max_tiles_)
+{
+  if (forest.nbTrees() == 0) {
+    throw std::logic_error("ForestMaxQuery::ForestMaxQuery: forest is empty");
+  }
+  if (state_dims < 0 || state_dims >= input_limits.rows()) {
+    std::ostringstream oss;
+    oss << "ForestMaxQuery::ForestMaxQuery: invalid state_dims (" << state_dims
+        << ") for an input space of dimension " << input_limits.rows();
+    throw std::logic_error(oss.str());
+  }
+  action_dims = input_limits.rows() - state_dims;
+  action_limits = input_limits.bottomRows(action_dims);
+  for (size_t tree_id = 0; tree_id < forest.nbTrees(); tree_id++) {
+    Eigen::MatrixXd space = input_limits;
+    roots.push_back(flatten(forest.getTree(tree_id).root, space));
+  }
+}
+
+int ForestMaxQuery::stateDims() const
+{
+  return state_dims;
+}
+
+int ForestMaxQuery::actionDims() const
+{
+  return action_dims;
+}
+
+double ForestMaxQuery::getMax(const Eigen::VectorXd & state, Scratch * scratch,
+                              Eigen::VectorXd * best_action) const
+{
+  if (state.rows() != state_dims) {
+    std::ostringstream oss;
+    oss << "ForestMaxQuery::getMax: invalid dimension for state (" << state.rows()
+        << " while " << state_dims << " was expected)";
+    throw std::runtime_error(oss.str());
+  }
+  int nb_trees = roots.size();
+  // Initial box is the whole action space
+  scratch->stack_boxes.clear();
+  scratch->stack_nodes.clear();
+  scratch->stack_bounds.clear();
+  scratch->box.resize(2 * action_dims);
+  for (int dim = 0; dim < action_dims; dim++) {
+    scratch->box[2 * dim    ] = action_limits(dim, 0);
+    scratch->box[2 * dim + 1] = action_limits(dim, 1);
+  }
+  scratch->nodes.assign(roots.begin(), roots.end());
+  pushCurrent(scratch, std::numeric_limits<double>::max());
+  double best_value = std::numeric_limits<double>::lowest();
+  int nb_tiles = 0;
+  while (!scratch->stack_bounds.empty()) {
+    // Pop the box on top of the stack
+    double bound = scratch->stack_bounds.back();
+    scratch->stack_bounds.pop_back();
+    size_t box_start = scratch->stack_boxes.size() - 2 * action_dims;
+    size_t nodes_start = scratch->stack_nodes.size() - nb_trees;
+    std::copy(scratch->stack_boxes.begin() + box_start, scratch->stack_boxes.end(),
+              scratch->box.begin());
+    std::copy(scratch->stack_nodes.begin() + nodes_start, scratch->stack_nodes.end(),
+              scratch->nodes.begin());
+    scratch->stack_boxes.resize(box_start);
+    scratch->stack_nodes.resize(nodes_start);
+    // The bound might have been reached since the box was pushed
+    if (bound <= best_value) continue;
+    int tree_id = resolve(state, scratch);
+    bound = 0;
+    for (int node_id : scratch->nodes) {
+      bound += flat_nodes[node_id].max_value;
+    }
+    bound /= nb_trees;
+    if (bound <= best_value) continue;
+    // All the trees are constant on the box
+    if (tree_id < 0) {
+      evaluateLeaves(state, scratch, &best_value, best_action);
+      nb_tiles++;
+      if (max_tiles > 0 && nb_tiles >= max_tiles) break;
+      continue;
+    }
+    // Splitting the box along the split of the unresolved tree
+    const FlatNode & node = flat_nodes[scratch->nodes[tree_id]];
+    int action_dim = node.split_dim - state_dims;
+    double old_min = scratch->box[2 * action_dim];
+    double old_max = scratch->box[2 * action_dim + 1];
+    double lower_bound = bound + (flat_nodes[node.lower].max_value - node.max_value) / nb_trees;
+    double upper_bound = bound + (flat_nodes[node.upper].max_value - node.max_value) / nb_trees;
+    // The most promising child is pushed last to be explored first
+    bool lower_first = lower_bound > upper_bound;
+    for (int child = 0; child < 2; child++) {
+      bool use_lower = (child == 0) != lower_first;
+      scratch->box[2 * action_dim    ] = use_lower ? old_min : node.split_val;
+      scratch->box[2 * action_dim + 1] = use_lower ? node.split_val : old_max;
+      scratch->nodes[tree_id] = use_lower ? node.lower : node.upper;
+      pushCurrent(scratch, use_lower ? lower_bound : upper_bound);
+    }
+  }
+  return best_value;
+}
+
+void ForestMaxQuery::getMax(const Eigen::MatrixXd & states, Scratch * scratch,
+                            Eigen::VectorXd * values,
+                            Eigen::MatrixXd * best_actions) const
+{
+  int nb_states = states.cols();
+  if (values->rows() != nb_states) {
+    values->resize(nb_states);
+  }
+  if (best_actions != nullptr &&
+      (best_actions->rows() != action_dims || best_actions->cols() != nb_states)) {
+    best_actions->resize(action_dims, nb_states);
+  }
+  Eigen::VectorXd state(state_dims), action(action_dims);
+  for (int idx = 0; idx < nb_states; idx++) {
+    state = states.col(idx);
+    if (best_actions == nullptr) {
+      (*values)(idx) = getMax(state, scratch);
+    }
+    else {
+      (*values)(idx) = getMax(state, scratch, &action);
+      best_actions->col(idx) = action;
+    }
+  }
+}
+
+int ForestMaxQuery::flatten(const Node * node, Eigen::MatrixXd & space)
+{
+  int node_id = flat_nodes.size();
+  flat_nodes.push_back(FlatNode());
+  if (node->isLeaf()) {
+    FlatNode & leaf = flat_nodes[node_id];
+    leaf.split_dim = -1;
+    leaf.split_val = 0;
+    leaf.lower = -1;
+    leaf.upper = -1;
+    leaf.approximation = node->a.get();
+    const PWCApproximation * pwc = dynamic_cast<const PWCApproximation *>(leaf.approximation);
+    leaf.is_constant = pwc != nullptr;
+    leaf.value = leaf.is_constant ? pwc->getValue() : 0;
+    leaf.max_value = leaf.is_constant ? leaf.value : leaf.approximation->getMax(space);
+    return node_id;
+  }
+  int split_dim = node->s.dim;
+  double split_val = node->s.val;
+  double old_min = space(split_dim, 0);
+  double old_max = space(split_dim, 1);
+  // flat_nodes might be reallocated during recursion, no reference is kept
+  space(split_dim, 1) = split_val;
+  int lower = flatten(node->lowerChild, space);
+  space(split_dim, 1) = old_max;
+  space(split_dim, 0) = split_val;
+  int upper = flatten(node->upperChild, space);
+  space(split_dim, 0) = old_min;
+  FlatNode & flat_node = flat_nodes[node_id];
+  flat_node.split_dim = split_dim;
+  flat_node.split_val = split_val;
+  flat_node.lower = lower;
+  flat_node.upper = upper;
+  flat_node.max_value = std::max(flat_nodes[lower].max_value, flat_nodes[upper].max_value);
+  flat_node.approximation = nullptr;
+  flat_node.is_constant = false;
+  flat_node.value = 0;
+  return node_id;
+}
+
+int ForestMaxQuery::resolve(const Eigen::VectorXd & state, Scratch * scratch) const
+{
+  int unresolved = -1;
+  for (size_t tree_id = 0; tree_id < scratch->nodes.size(); tree_id++) {
+    int node_id = scratch->nodes[tree_id];
+    while (flat_nodes[node_id].split_dim >= 0) {
+      const FlatNode & node = flat_nodes[node_id];
+      if (node.split_dim < state_dims) {
+        node_id = state(node.split_dim) > node.split_val ? node.upper : node.lower;
+        continue;
+      }
+      int action_dim = node.split_dim - state_dims;
+      if (scratch->box[2 * action_dim + 1] <= node.split_val) {
+        node_id = node.lower;
+      }
+      else if (scratch->box[2 * action_dim] >= node.split_val) {
+        node_id = node.upper;
+      }
+      else {
+        break;
+      }
+    }
+    scratch->nodes[tree_id] = node_id;
+    if (unresolved < 0 && flat_nodes[node_id].split_dim >= 0) {
+      unresolved = tree_id;
+    }
+  }
+  return unresolved;
+}
+
+void ForestMaxQuery::evaluateLeaves(const Eigen::VectorXd & state, Scratch * scratch,
+                                    double * best_value, Eigen::VectorXd * best_action) const
+{
+  int nb_trees = roots.size();
+  int input_dims = state_dims + action_dims;
+  if (scratch->input.rows() != input_dims) {
+    scratch->input.resize(input_dims);
+  }
+  scratch->input.segment(0, state_dims) = state;
+  // Default candidate is the center of the box
+  for (int dim = 0; dim < action_dims; dim++) {
+    scratch->input(state_dims + dim) = (scratch->box[2 * dim] + scratch->box[2 * dim + 1]) / 2;
+  }
+  double constant_sum = 0;
+  bool all_constant = true;
+  for (int node_id : scratch->nodes) {
+    const FlatNode & leaf = flat_nodes[node_id];
+    if (leaf.is_constant) {
+      constant_sum += leaf.value;
+    }
+    else {
+      all_constant = false;
+    }
+  }
+  if (all_constant) {
+    double value = constant_sum / nb_trees;
+    if (value > *best_value) {
+      *best_value = value;
+      if (best_action != nullptr) {
+        *best_action = scratch->input.segment(state_dims, action_dims);
+      }
+    }
+    return;
+  }
+  // Candidates are the argmax of each non-constant leaf on the box
+  if (scratch->limits.rows() != input_dims || scratch->limits.cols() != 2) {
+    scratch->limits.resize(input_dims, 2);
+  }
+  scratch->limits.block(0, 0, state_dims, 1) = state;
+  scratch->limits.block(0, 1, state_dims, 1) = state;
+  for (int dim = 0; dim < action_dims; dim++) {
+    scratch->limits(state_dims + dim, 0) = scratch->box[2 * dim];
+    scratch->limits(state_dims + dim, 1) = scratch->box[2 * dim + 1];
+  }
+  for (int node_id : scratch->nodes) {
+    const FlatNode & candidate_leaf = flat_nodes[node_id];
+    if (candidate_leaf.is_constant) continue;
+    scratch->input = candidate_leaf.approximation->getArgMax(scratch->limits);
+    double value = 0;
+    for (int other_id : scratch->nodes) {
+      const FlatNode & leaf = flat_nodes[other_id];
+      value += leaf.is_constant ? leaf.value : leaf.approximation->eval(scratch->input);
+    }
+    value /= nb_trees;
+    if (value > *best_value) {
+      *best_value = value;
+      if (best_action != nullptr) {
+        *best_action = scratch->input.segment(state_dims, action_dims);
+      }
+    }
+  }
+}
+
+void ForestMaxQuery::pushCurrent(Scratch * scratch, double bound) const
+{
+  scratch->stack_boxes.insert(scratch->stack_boxes.end(),
+                              scratch->box.begin(), scratch->box.end());
+  scratch->stack_nodes.insert(scratch->stack_nodes.end(),
+                              scratch->nodes.begin(), scratch->nodes.end());
+  scratch->stack_bounds.push_back(bound);
+}
+
+}
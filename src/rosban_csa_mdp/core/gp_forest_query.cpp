@@ -0,0 +1,223 @@
+#include "rosban_csa_mdp/core/gp_forest_query.h"
+
+#include <sstream>
+#include <stdexcept>
+
+using regression_forests::Node;
+
+namespace csa_mdp
+{
+
+GPForestQuery::Scratch::Scratch()
+  : has_last(false), last_value(0)
+{
+}
+
+GPForestQuery::GPForestQuery(const regression_forests::Forest & forest,
+                             const Eigen::MatrixXd & input_limits,
+                             int state_dims_)
+  : state_dims(state_dims_)
+{
+  if (forest.nbTrees() == 0) {
+    throw std::logic_error("GPForestQuery::GPForestQuery: forest is empty");
+  }
+  if (state_dims < 0 || state_dims >= input_limits.rows()) {
+    std::ostringstream oss;
+    oss << "GPForestQuery::GPForestQuery: invalid state_dims (" << state_dims
+        << ") for an input space of dimension " << input_limits.rows();
+    throw std::logic_error(oss.str());
+  }
+  action_dims = input_limits.rows() - state_dims;
+  action_limits = input_limits.bottomRows(action_dims);
+  for (size_t tree_id = 0; tree_id < forest.nbTrees(); tree_id++) {
+    roots.push_back(flatten(forest.getTree(tree_id).root));
+  }
+}
+
+int GPForestQuery::stateDims() const
+{
+  return state_dims;
+}
+
+int GPForestQuery::actionDims() const
+{
+  return action_dims;
+}
+
+void GPForestQuery::setState(const Eigen::VectorXd & state, Scratch * scratch) const
+{
+  if (state.rows() != state_dims) {
+    std::ostringstream oss;
+    oss << "GPForestQuery::setState: invalid dimension for state (" << state.rows()
+        << " while " << state_dims << " was expected)";
+    throw std::runtime_error(oss.str());
+  }
+  scratch->nodes.clear();
+  scratch->roots.clear();
+  for (int root : roots) {
+    scratch->roots.push_back(project(root, state, scratch));
+  }
+  if (scratch->input.rows() != state_dims + action_dims) {
+    scratch->input.resize(state_dims + action_dims);
+  }
+  scratch->input.segment(0, state_dims) = state;
+  scratch->has_last = false;
+}
+
+double GPForestQuery::getValue(const Eigen::VectorXd & action, Scratch * scratch,
+                               Eigen::VectorXd * action_gradient) const
+{
+  if (scratch->has_last && scratch->last_action == action) {
+    if (action_gradient != nullptr) {
+      *action_gradient = scratch->last_gradient;
+    }
+    return scratch->last_value;
+  }
+  scratch->input.segment(state_dims, action_dims) = action;
+  double value = 0;
+  if (scratch->last_gradient.rows() != action_dims) {
+    scratch->last_gradient.resize(action_dims);
+  }
+  scratch->last_gradient.setZero();
+  for (int node_id : scratch->roots) {
+    while (scratch->nodes[node_id].split_dim >= 0) {
+      const Scratch::ProjectedNode & node = scratch->nodes[node_id];
+      node_id = action(node.split_dim) > node.split_val ? node.upper : node.lower;
+    }
+    const regression_forests::Approximation * leaf = scratch->nodes[node_id].approximation;
+    value += leaf->eval(scratch->input);
+    scratch->last_gradient += leaf->getGrad(scratch->input).segment(state_dims, action_dims);
+  }
+  value /= scratch->roots.size();
+  scratch->last_gradient /= scratch->roots.size();
+  scratch->last_action = action;
+  scratch->last_value = value;
+  scratch->has_last = true;
+  if (action_gradient != nullptr) {
+    *action_gradient = scratch->last_gradient;
+  }
+  return value;
+}
+
+double GPForestQuery::getMax(const Eigen::VectorXd & state,
+                             const rosban_gp::RandomizedRProp::Config & rprop_conf,
+                             Scratch * scratch,
+                             Eigen::VectorXd * best_action) const
+{
+  setState(state, scratch);
+  // RandomizedRProp works on the whole input, the limits of the state
+  // dimensions are reduced to the state and their gradient is always 0
+  Eigen::MatrixXd limits(state_dims + action_dims, 2);
+  limits.block(0, 0, state_dims, 1) = state;
+  limits.block(0, 1, state_dims, 1) = state;
+  limits.block(state_dims, 0, action_dims, 2) = action_limits;
+  Eigen::VectorXd action(action_dims), action_gradient(action_dims);
+  std::function<Eigen::VectorXd(const Eigen::VectorXd)> gradient_func;
+  gradient_func = [&](const Eigen::VectorXd & input)
+    {
+      action = input.segment(state_dims, action_dims);
+      this->getValue(action, scratch, &action_gradient);
+      Eigen::VectorXd gradient = Eigen::VectorXd::Zero(state_dims + action_dims);
+      gradient.segment(state_dims, action_dims) = action_gradient;
+      return gradient;
+    };
+  std::function<double(const Eigen::VectorXd)> scoring_func;
+  scoring_func = [&](const Eigen::VectorXd & input)
+    {
+      action = input.segment(state_dims, action_dims);
+      return this->getValue(action, scratch);
+    };
+  Eigen::VectorXd best_input;
+  best_input = rosban_gp::RandomizedRProp::run(gradient_func, scoring_func,
+                                               limits, rprop_conf);
+  if (best_action != nullptr) {
+    *best_action = best_input.segment(state_dims, action_dims);
+  }
+  return scoring_func(best_input);
+}
+
+void GPForestQuery::getMax(const Eigen::MatrixXd & states,
+                           const rosban_gp::RandomizedRProp::Config & rprop_conf,
+                           Scratch * scratch,
+                           Eigen::VectorXd * values,
+                           Eigen::MatrixXd * best_actions) const
+{
+  int nb_states = states.cols();
+  if (values->rows() != nb_states) {
+    values->resize(nb_states);
+  }
+  if (best_actions != nullptr &&
+      (best_actions->rows() != action_dims || best_actions->cols() != nb_states)) {
+    best_actions->resize(action_dims, nb_states);
+  }
+  Eigen::VectorXd state(state_dims), action(action_dims);
+  for (int idx = 0; idx < nb_states; idx++) {
+    state = states.col(idx);
+    if (best_actions == nullptr) {
+      (*values)(idx) = getMax(state, rprop_conf, scratch);
+    }
+    else {
+      (*values)(idx) = getMax(state, rprop_conf, scratch, &action);
+      best_actions->col(idx) = action;
+    }
+  }
+}
+
+int GPForestQuery::flatten(const Node * node)
+{
+  int node_id = flat_nodes.size();
+  flat_nodes.push_back(FlatNode());
+  if (node->isLeaf()) {
+    FlatNode & leaf = flat_nodes[node_id];
+    leaf.split_dim = -1;
+    leaf.split_val = 0;
+    leaf.lower = -1;
+    leaf.upper = -1;
+    leaf.approximation = node->a.get();
+    return node_id;
+  }
+  // flat_nodes might be reallocated during recursion, no reference is kept
+  int lower = flatten(node->lowerChild);
+  int upper = flatten(node->upperChild);
+  FlatNode & flat_node = flat_nodes[node_id];
+  flat_node.split_dim = node->s.dim;
+  flat_node.split_val = node->s.val;
+  flat_node.lower = lower;
+  flat_node.upper = upper;
+  flat_node.approximation = nullptr;
+  return node_id;
+}
+
+int GPForestQuery::project(int node_id, const Eigen::VectorXd & state,
+                           Scratch * scratch) const
+{
+  // Splits on the state are resolved without creating nodes
+  while (flat_nodes[node_id].split_dim >= 0 && flat_nodes[node_id].split_dim < state_dims) {
+    const FlatNode & node = flat_nodes[node_id];
+    node_id = state(node.split_dim) > node.split_val ? node.upper : node.lower;
+  }
+  const FlatNode & node = flat_nodes[node_id];
+  int projected_id = scratch->nodes.size();
+  scratch->nodes.push_back(Scratch::ProjectedNode());
+  if (node.split_dim < 0) {
+    Scratch::ProjectedNode & leaf = scratch->nodes[projected_id];
+    leaf.split_dim = -1;
+    leaf.split_val = 0;
+    leaf.lower = -1;
+    leaf.upper = -1;
+    leaf.approximation = node.approximation;
+    return projected_id;
+  }
+  // scratch->nodes might be reallocated during recursion, no reference is kept
+  int lower = project(node.lower, state, scratch);
+  int upper = project(node.upper, state, scratch);
+  Scratch::ProjectedNode & projected = scratch->nodes[projected_id];
+  projected.split_dim = node.split_dim - state_dims;
+  projected.split_val = node.split_val;
+  projected.lower = lower;
+  projected.upper = upper;
+  projected.approximation = nullptr;
+  return projected_id;
+}
+
+}
@@ -1,16 +1,20 @@
 #include "rosban_csa_mdp/core/history.h"
 #include "rosban_csa_mdp/core/problem_factory.h"
+#include "rosban_csa_mdp/core/transition_view.h"
 
-#include "rosban_utils/string_tools.h"
+#include "rosban_utils/time_stamp.h"
 
+#include <algorithm>
+#include <exception>
 #include <fstream>
 #include <sstream>
+#include <thread>
 
 namespace csa_mdp
 {
 
 History::Config::Config()
-  : run_column(-1), step_column(-1)
+  : run_column(-1), step_column(-1), nb_threads(1)
 {
 }
 
@@ -28,6 +32,7 @@ void History::Config::to_xml(std::ostream &out) const
   rosban_utils::xml_tools::write<int>        ("step_column"   , step_column   , out);
   rosban_utils::xml_tools::write_vector<int> ("state_columns" , state_columns , out);
   rosban_utils::xml_tools::write_vector<int> ("action_columns", action_columns, out);
+  rosban_utils::xml_tools::write<int>        ("nb_threads"    , nb_threads    , out);
 }
 
 void History::Config::from_xml(TiXmlNode *node)
@@ -44,6 +49,7 @@ void History::Config::from_xml(TiXmlNode *node)
   rosban_utils::xml_tools::try_read<int>        (node, "step_column"   , step_column   );
   rosban_utils::xml_tools::try_read_vector<int> (node, "state_columns" , state_columns );
   rosban_utils::xml_tools::try_read_vector<int> (node, "action_columns", action_columns);
+  rosban_utils::xml_tools::try_read<int>        (node, "nb_threads"    , nb_threads    );
 }
 
 std::string History::Config::class_name() const
@@ -65,6 +71,26 @@ void History::push(const Eigen::VectorXd &state,
   rewards.push_back(reward);
 }
 
+size_t History::size() const
+{
+  return states.size();
+}
+
+const Eigen::VectorXd & History::getState(size_t step) const
+{
+  return states[step];
+}
+
+const Eigen::VectorXd & History::getAction(size_t step) const
+{
+  return actions[step];
+}
+
+double History::getReward(size_t step) const
+{
+  return rewards[step];
+}
+
 std::vector<Sample> History::getBatch() const
 {
   std::vector<Sample> samples;
@@ -78,17 +104,52 @@ std::vector<Sample> History::getBatch() const
 
 std::vector<Sample> History::getBatch(const std::vector<History> &histories)
 {
+  // Samples are built directly in the result, without intermediate batches
+  TransitionView transitions(histories);
   std::vector<Sample> samples;
-  for (const History &h : histories)
+  samples.reserve(transitions.size());
+  for (int idx = 0; idx < transitions.size(); idx++)
   {
-    std::vector<Sample> new_samples = h.getBatch();
-    samples.reserve(samples.size() + new_samples.size());
-    std::move(new_samples.begin(), new_samples.end(), std::inserter(samples, samples.end()));
+    samples.push_back(Sample(transitions.state(idx), transitions.action(idx),
+                             transitions.nextState(idx), transitions.reward(idx)));
   }
   return samples;
 }
 
-std::vector<History> History::readCSV(const History::Config & conf)
+SampleStore History::getSampleStore(const std::vector<History> &histories,
+                                    SampleStore::Precision precision,
+                                    const Eigen::MatrixXd &state_limits,
+                                    const Eigen::MatrixXd &action_limits)
+{
+  // Getting dimensions and number of samples
+  int x_dim = -1, u_dim = -1;
+  int nb_samples = 0;
+  for (const History &h : histories)
+  {
+    if (h.size() == 0) continue;
+    x_dim = h.states[0].rows();
+    u_dim = h.actions[0].rows();
+    nb_samples += h.size() - 1;
+  }
+  if (x_dim < 0) return SampleStore();
+  SampleStore store(x_dim, u_dim, precision);
+  if (precision == SampleStore::Precision::Quantized16)
+  {
+    store.setLimits(state_limits, action_limits);
+  }
+  store.reserve(nb_samples);
+  for (const History &h : histories)
+  {
+    for (size_t i = 0; i + 1 < h.size(); i++)
+    {
+      store.push(h.states[i], h.actions[i], h.states[i+1], h.rewards[i+1]);
+    }
+  }
+  return store;
+}
+
+std::vector<History> History::readCSV(const History::Config & conf,
+                                      CSVReader::Stats * stats)
 {
   if (conf.log_path == "") {
     throw std::runtime_error("History::readCSV: Trying to read from a conf with log_path=\"\"");
@@ -100,12 +161,14 @@ std::vector<History> History::readCSV(const History::Config & conf)
   // TODO start by validating config and accept other format
   int nb_states_dims = conf.problem->getStateLimits().rows();
   int nb_actions_dims = conf.problem->actionDims(0);
-  return readCSV(conf.log_path, nb_states_dims, nb_actions_dims);
+  return readCSV(conf.log_path, nb_states_dims, nb_actions_dims, conf.nb_threads, stats);
 }
 
 std::vector<History> History::readCSV(const std::string &path,
                                       int nb_states,
-                                      int nb_actions)
+                                      int nb_actions,
+                                      int nb_threads,
+                                      CSVReader::Stats * stats)
 {
   std::vector<int> state_cols, action_cols;
   for (int i = 0; i < nb_states; i++)
@@ -117,87 +180,206 @@ std::vector<History> History::readCSV(const std::string &path,
     action_cols.push_back(i+2+nb_states);
   }
   int reward_col = 2 + nb_states + nb_actions;
-  return readCSV(path, 0, 1, state_cols, action_cols, reward_col, true);
+  return readCSV(path, 0, 1, state_cols, action_cols, reward_col, true, nb_threads, stats);
 }
 
-std::vector<History> History::readCSV(const std::string &path,
-                                      int run_col,
-                                      int step_col,
-                                      const std::vector<int> &state_cols,
-                                      const std::vector<int> &action_cols,
-                                      int reward_col,
-                                      bool header)
+/// Throw an explicit error if the column is not available in current row
+static void checkColumn(const CSVReader & reader, int col)
+{
+  if (col >= reader.nbCols())
+    throw std::runtime_error("Not enough columns in logs");
+}
+
+/// Build the histories from all the rows of the reader.
+/// Only the first chunk of a file can start in the middle of a run, other
+/// chunks are expected to start with a new run.
+static std::vector<History> readHistories(CSVReader & reader,
+                                          bool first_chunk,
+                                          int run_col,
+                                          int step_col,
+                                          const std::vector<int> &state_cols,
+                                          const std::vector<int> &action_cols,
+                                          int reward_col,
+                                          size_t * nb_rows)
 {
   std::vector<History> histories;
   int x_dim = state_cols.size();
   int u_dim = action_cols.size();
-  std::ifstream infile(path);
-  if (!infile.good())
-  {
-    throw std::runtime_error("History::readCSV: Failed to open file '" + path + "'");
-  }
-  std::string line;
   // Temporary variables
   History curr_history;
-  int curr_run = 1;
+  long curr_run = 1;
   int expected_step = 0;
-  while (std::getline(infile, line))
+  // Buffers reused for all the rows
+  Eigen::VectorXd state(x_dim);
+  Eigen::VectorXd action(u_dim);
+  while (reader.nextRow())
   {
-    // Skipping first line if needed
-    if (header)
-    {
-      header = false;
-      continue;
-    }
-    // Getting columns
-    std::vector<std::string> cols = rosban_utils::split_string(line,',');
     // Checking if a new run is started (if run-col is specified)
-    if (run_col >= 0 && std::stoi(cols[run_col]) != curr_run)
+    if (run_col >= 0)
     {
-      histories.push_back(curr_history);
-      curr_run = std::stoi(cols[run_col]);
-      curr_history = History();
-      expected_step = 0;
+      checkColumn(reader, run_col);
+      long run = reader.getLong(run_col);
+      if (!first_chunk && *nb_rows == 0)
+      {
+        curr_run = run;
+      }
+      if (run != curr_run)
+      {
+        histories.push_back(std::move(curr_history));
+        curr_run = run;
+        curr_history = History();
+        expected_step = 0;
+      }
     }
+    (*nb_rows)++;
     // Checking
-    if (step_col >= 0 && std::stoi(cols[step_col]) != expected_step)
+    if (step_col >= 0)
     {
-      std::ostringstream oss;
-      oss << "Unexpected step: '" << cols[step_col] << "' expecting step '"
-          << expected_step << "'";
-      throw std::runtime_error(oss.str());
+      checkColumn(reader, step_col);
+      if (reader.getLong(step_col) != expected_step)
+      {
+        std::ostringstream oss;
+        oss << "Unexpected step: '" << reader.getField(step_col) << "' expecting step '"
+            << expected_step << "'";
+        throw std::runtime_error(oss.str());
+      }
     }
-
-    // Declaring variables
-    Eigen::VectorXd state(x_dim);
-    Eigen::VectorXd action(u_dim);
-    double reward = 0;
     // Attributing variables at the right place
+    double reward = 0;
     int dim = 0;
     for (int col : state_cols)
     {
-      if (col >= (int)cols.size())
-        throw std::runtime_error("Not enough columns in logs");
-      state(dim++) = std::stod(cols[col]);
+      checkColumn(reader, col);
+      state(dim++) = reader.getDouble(col);
     }
     dim = 0;
     for (int col : action_cols)
     {
-      if (col >= (int)cols.size())
-        throw std::runtime_error("Not enough columns in logs");
-      action(dim++) = std::stod(cols[col]);
+      checkColumn(reader, col);
+      action(dim++) = reader.getDouble(col);
     }
     if (reward_col >= 0)
     {
-      if (reward_col >= (int)cols.size())
-        throw std::runtime_error("Not enough columns in logs");
-      reward = std::stod(cols[reward_col]);
+      checkColumn(reader, reward_col);
+      reward = reader.getDouble(reward_col);
     }
     // Pushing values
     curr_history.push(state, action, reward);
     expected_step++;
   }
-  histories.push_back(curr_history);
+  if (first_chunk || *nb_rows > 0)
+  {
+    histories.push_back(std::move(curr_history));
+  }
+  return histories;
+}
+
+/// Return the offsets delimiting the chunks of a csv file: offsets[i] is the
+/// start of chunk i and offsets.back() is the size of the file. Each chunk
+/// (except the first one) starts with the first row of a run.
+static std::vector<size_t> getRunBoundaries(const std::string &path,
+                                            int run_col,
+                                            int nb_chunks)
+{
+  size_t file_size = CSVReader::getFileSize(path);
+  std::vector<size_t> boundaries;
+  boundaries.push_back(0);
+  for (int chunk = 1; chunk < nb_chunks; chunk++)
+  {
+    size_t nominal_start = file_size * chunk / nb_chunks;
+    if (nominal_start <= boundaries.back()) continue;
+    // Find the first run starting after the nominal start
+    CSVReader reader(path, nominal_start, file_size);
+    if (!reader.nextRow()) break;
+    checkColumn(reader, run_col);
+    long run = reader.getLong(run_col);
+    size_t boundary = file_size;
+    while (reader.nextRow())
+    {
+      checkColumn(reader, run_col);
+      if (reader.getLong(run_col) != run)
+      {
+        boundary = reader.getRowOffset();
+        break;
+      }
+    }
+    if (boundary >= file_size) break;
+    boundaries.push_back(boundary);
+  }
+  boundaries.push_back(file_size);
+  return boundaries;
+}
+
+std::vector<History> History::readCSV(const std::string &path,
+                                      int run_col,
+                                      int step_col,
+                                      const std::vector<int> &state_cols,
+                                      const std::vector<int> &action_cols,
+                                      int reward_col,
+                                      bool header,
+                                      int nb_threads,
+                                      CSVReader::Stats * stats)
+{
+  rosban_utils::TimeStamp start = rosban_utils::TimeStamp::now();
+  std::ifstream infile(path);
+  if (!infile.good())
+  {
+    throw std::runtime_error("History::readCSV: Failed to open file '" + path + "'");
+  }
+  infile.close();
+  // Chunks need to be aligned on runs to be parsed independently
+  if (run_col < 0) nb_threads = 1;
+  std::vector<size_t> boundaries = getRunBoundaries(path, run_col, std::max(1, nb_threads));
+  int nb_chunks = boundaries.size() - 1;
+  std::vector<std::vector<History>> chunks_histories(nb_chunks);
+  std::vector<size_t> chunks_rows(nb_chunks, 0);
+  std::vector<std::exception_ptr> chunks_errors(nb_chunks);
+  auto read_chunk = [&](int chunk)
+    {
+      try
+      {
+        CSVReader reader(path, boundaries[chunk], boundaries[chunk+1]);
+        // Skipping first line if needed
+        if (chunk == 0 && header) reader.nextRow();
+        chunks_histories[chunk] = readHistories(reader, chunk == 0, run_col, step_col,
+                                                state_cols, action_cols, reward_col,
+                                                &(chunks_rows[chunk]));
+      }
+      catch (...)
+      {
+        chunks_errors[chunk] = std::current_exception();
+      }
+    };
+  std::vector<std::thread> threads;
+  for (int chunk = 1; chunk < nb_chunks; chunk++)
+  {
+    threads.push_back(std::thread(read_chunk, chunk));
+  }
+  read_chunk(0);
+  for (std::thread & t : threads)
+  {
+    t.join();
+  }
+  // Gathering histories in the right order
+  std::vector<History> histories;
+  size_t nb_rows = 0;
+  for (int chunk = 0; chunk < nb_chunks; chunk++)
+  {
+    if (chunks_errors[chunk])
+    {
+      std::rethrow_exception(chunks_errors[chunk]);
+    }
+    for (History & h : chunks_histories[chunk])
+    {
+      histories.push_back(std::move(h));
+    }
+    nb_rows += chunks_rows[chunk];
+  }
+  if (stats != nullptr)
+  {
+    stats->rows = nb_rows;
+    stats->elapsed = diffSec(start, rosban_utils::TimeStamp::now());
+  }
   return histories;
 }
 
@@ -207,11 +389,14 @@ std::vector<History> History::readCSV(const std::string &path,
                                       const std::vector<int> &state_cols,
                                       const std::vector<int> &action_cols,
                                       Problem::RewardFunction compute_reward,
-                                      bool header)
+                                      bool header,
+                                      int nb_threads,
+                                      CSVReader::Stats * stats)
 {
   // Factorizing code
   std::vector<History> histories = History::readCSV(path, run_col, step_col,
-                                                    state_cols, action_cols, -1, header);
+                                                    state_cols, action_cols, -1, header,
+                                                    nb_threads, stats);
   // Computing rewards
   for (auto & h : histories)
   {
@@ -2,10 +2,11 @@
 
 #include "rosban_csa_mdp/core/policy_factory.h"
 #include "rosban_csa_mdp/core/problem_factory.h"
+#include "rosban_csa_mdp/core/rollout_engine.h"
+#include "rosban_csa_mdp/core/worker_pool.h"
 
 #include "rosban_bbo/optimizer_factory.h"
 
-#include "rosban_random/tools.h"
 #include "rosban_utils/multi_core.h"
 
 namespace csa_mdp
@@ -96,30 +97,24 @@ double MonteCarloPolicy::averageReward(const Eigen::VectorXd & initial_state,
                                        int rollouts,
                                        std::default_random_engine * engine) const
 {
-  // Simple version for mono-threading or mono rollout
-  if (nb_threads == 1 || rollouts == 1) {
-    double total_reward = 0;
-    for (int rollout = 0; rollout < rollouts; rollout++) {
-      total_reward += sampleReward(initial_state, first_action, engine);
-    }
-    return total_reward / rollouts;
-  }
-  // Preparing random_engines + rewards storing
-  std::vector<std::default_random_engine> engines;
-  engines = rosban_random::getRandomEngines(std::min(nb_threads, rollouts), engine);
   Eigen::VectorXd rewards = Eigen::VectorXd::Zero(rollouts);
-  // The task which has to be performed :
+  // Each chunk of rollouts is simulated in lock-step, all the trajectories
+  // start with first_action
   rosban_utils::MultiCore::StochasticTask task =
     [this, &initial_state, &first_action, &rewards]
     (int start_idx, int end_idx, std::default_random_engine * engine)
     {
-      for (int idx = start_idx; idx < end_idx; idx++) {
-        rewards(idx) = sampleReward(initial_state, first_action, engine);
-      }
+      if (end_idx <= start_idx) return;
+      int chunk_size = end_idx - start_idx;
+      Eigen::MatrixXd initial_states = initial_state.replicate(1, chunk_size);
+      Eigen::MatrixXd first_actions = first_action.replicate(1, chunk_size);
+      RolloutEngine rollout_engine(*problem);
+      rollout_engine.run(initial_states, *default_policy, simulation_depth, 1.0,
+                         engine, &first_actions);
+      rewards.segment(start_idx, chunk_size) = rollout_engine.getRewards();
     };
-  // Running computation
-  rosban_utils::MultiCore::runParallelStochasticTask(task, rollouts, &engines);
-
+  // Running computation, rollouts have heterogeneous durations
+  WorkerPool::runBalancedStochasticTask(task, rollouts, nb_threads, engine);
   return rewards.mean();
 }
 
@@ -127,23 +122,11 @@ double MonteCarloPolicy::sampleReward(const Eigen::VectorXd & initial_state,
                                       const Eigen::VectorXd & first_action,
                                       std::default_random_engine * engine) const
 {
-  double cumulated_reward = 0;
-  Problem::Result result;
-  // Perform the first step
-  result = problem->getSuccessor(initial_state,
-                                 first_action,
-                                 engine);
-  cumulated_reward = result.reward;
-  // Perform remaining steps
-  for (int step = 1; step < simulation_depth; step++) {
-    // End evaluation as soon as a terminal state has been reached
-    if (result.terminal) break;
-    // Compute a single step
-    Eigen::VectorXd action = default_policy->getAction(result.successor, engine);
-    result = problem->getSuccessor(result.successor, action, engine);
-    cumulated_reward += result.reward;
-  }
-  return cumulated_reward;
+  RolloutEngine rollout_engine(*problem);
+  Eigen::MatrixXd first_actions = first_action;
+  rollout_engine.run(initial_state, *default_policy, simulation_depth, 1.0,
+                     engine, &first_actions);
+  return rollout_engine.getRewards()(0);
 }
 
 std::string MonteCarloPolicy::class_name() const
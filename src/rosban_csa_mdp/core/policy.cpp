@@ -53,6 +53,18 @@ Eigen::VectorXd Policy::getAction(const Eigen::VectorXd &state,
   return boundAction(getRawAction(state, external_engine));
 }
 
+void Policy::getActions(const Eigen::MatrixXd &states,
+                        std::default_random_engine * external_engine,
+                        Eigen::MatrixXd * actions) const
+{
+  for (int i = 0; i < states.cols(); i++) {
+    Eigen::VectorXd action = getAction(states.col(i), external_engine);
+    if (i == 0 && (actions->rows() != action.rows() || actions->cols() != states.cols())) {
+      actions->resize(action.rows(), states.cols());
+    }
+    actions->col(i) = action;
+  }
+}
 
 Eigen::VectorXd Policy::getRawAction(const Eigen::VectorXd &state)
 {
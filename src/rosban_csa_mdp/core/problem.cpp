@@ -5,6 +5,40 @@
 namespace csa_mdp
 {
 
+/// Compute the transitions one by one with 'transition', outputs are only
+/// resized if required
+template <typename TransitionFunction>
+static void computeSuccessors(TransitionFunction transition,
+                              const Eigen::MatrixXd & states,
+                              const Eigen::MatrixXd & actions,
+                              Eigen::MatrixXd * successors,
+                              Eigen::VectorXd * rewards,
+                              Problem::TerminalFlags * terminals)
+{
+  if (states.cols() != actions.cols()) {
+    std::ostringstream oss;
+    oss << "Problem::getSuccessors: number of states and actions differ ("
+        << states.cols() << " != " << actions.cols() << ")";
+    throw std::runtime_error(oss.str());
+  }
+  int nb_transitions = states.cols();
+  if (successors->rows() != states.rows() || successors->cols() != nb_transitions) {
+    successors->resize(states.rows(), nb_transitions);
+  }
+  if (rewards->rows() != nb_transitions) {
+    rewards->resize(nb_transitions);
+  }
+  if (terminals->rows() != nb_transitions) {
+    terminals->resize(nb_transitions);
+  }
+  for (int i = 0; i < nb_transitions; i++) {
+    Problem::Result result = transition(states.col(i), actions.col(i));
+    successors->col(i) = result.successor;
+    (*rewards)(i) = result.reward;
+    (*terminals)(i) = result.terminal;
+  }
+}
+
 Problem::Problem() {}
 
 Problem::~Problem() {}
@@ -27,6 +61,50 @@ Problem::ResultFunction Problem::getResultFunction() const {
   };
 }
 
+Problem::BatchResultFunction Problem::getBatchResultFunction() const {
+  return [this] (const Eigen::MatrixXd & states,
+                 const Eigen::MatrixXd & actions,
+                 std::default_random_engine * engine,
+                 Eigen::MatrixXd * successors,
+                 Eigen::VectorXd * rewards,
+                 TerminalFlags * terminals) {
+    this->getSuccessors(states, actions, engine, successors, rewards, terminals);
+  };
+}
+
+Problem::BatchResultFunction
+Problem::toBatchResultFunction(ResultFunction result_function) {
+  return [result_function] (const Eigen::MatrixXd & states,
+                            const Eigen::MatrixXd & actions,
+                            std::default_random_engine * engine,
+                            Eigen::MatrixXd * successors,
+                            Eigen::VectorXd * rewards,
+                            TerminalFlags * terminals) {
+    computeSuccessors([&result_function, engine] (const Eigen::VectorXd & state,
+                                                  const Eigen::VectorXd & action) {
+                        return result_function(state, action, engine);
+                      },
+                      states, actions, successors, rewards, terminals);
+  };
+}
+
+Problem::ResultFunction
+Problem::toResultFunction(BatchResultFunction result_function) {
+  return [result_function] (const Eigen::VectorXd & state,
+                            const Eigen::VectorXd & action,
+                            std::default_random_engine * engine) {
+    Eigen::MatrixXd successors;
+    Eigen::VectorXd rewards;
+    TerminalFlags terminals;
+    result_function(state, action, engine, &successors, &rewards, &terminals);
+    Result result;
+    result.successor = successors.col(0);
+    result.reward = rewards(0);
+    result.terminal = terminals(0);
+    return result;
+  };
+}
+
 int Problem::stateDims() const {
   return state_limits.rows();
 }
@@ -144,28 +222,50 @@ std::vector<int> Problem::getLearningDimensions() const
   return result;
 }
 
+void Problem::getSuccessors(const Eigen::MatrixXd & states,
+                            const Eigen::MatrixXd & actions,
+                            std::default_random_engine * engine,
+                            Eigen::MatrixXd * successors,
+                            Eigen::VectorXd * rewards,
+                            TerminalFlags * terminals) const
+{
+  computeSuccessors([this, engine] (const Eigen::VectorXd & state,
+                                    const Eigen::VectorXd & action) {
+                      return this->getSuccessor(state, action, engine);
+                    },
+                    states, actions, successors, rewards, terminals);
+}
+
 double Problem::sampleRolloutReward(const Eigen::VectorXd & initial_state,
                                     const csa_mdp::Policy & policy,
                                     int max_horizon,
                                     double discount,
-                                    std::default_random_engine * engine) const
+                                    std::default_random_engine * engine,
+                                    std::vector<Eigen::VectorXd> * visited_states) const
 {
+  // A single trajectory is simulated directly: building a RolloutEngine for
+  // each rollout would only add overhead
   double coeff = 1;
   double reward = 0;
   Eigen::VectorXd state = initial_state;
-  bool is_terminated = false;
-  // Compute the reward over the next 'nb_steps'
   for (int i = 0; i < max_horizon; i++) {
+    if (visited_states != nullptr) {
+      visited_states->push_back(state);
+    }
     Eigen::VectorXd action = policy.getAction(state, engine);
     Problem::Result result = getSuccessor(state, action, engine);
     reward += coeff * result.reward;
     state = result.successor;
     coeff *= discount;
-    is_terminated = result.terminal;
     // Stop predicting steps if a terminal state has been reached
-    if (is_terminated) break;
+    if (result.terminal) break;
   }
   return reward;
 }
 
+bool Problem::hasAllocationFreeRollouts(const csa_mdp::Policy &) const
+{
+  return false;
+}
+
 }
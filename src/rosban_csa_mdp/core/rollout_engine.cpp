@@ -0,0 +1,138 @@
+#include "rosban_csa_mdp/core/rollout_engine.h"
+
+#include <sstream>
+#include <stdexcept>
+
+namespace csa_mdp
+{
+
+RolloutEngine::RolloutEngine(Problem::BatchResultFunction result_function_)
+  : result_function(result_function_),
+    record_visited_states(false),
+    final_coeff(1)
+{
+}
+
+RolloutEngine::RolloutEngine(const Problem & problem)
+  : RolloutEngine(problem.getBatchResultFunction())
+{
+}
+
+void RolloutEngine::run(const Eigen::MatrixXd & initial_states,
+                        const Policy & policy,
+                        int horizon,
+                        double discount,
+                        std::default_random_engine * engine,
+                        const Eigen::MatrixXd * first_actions)
+{
+  int nb_trajectories = initial_states.cols();
+  if (first_actions != nullptr && first_actions->cols() != nb_trajectories) {
+    std::ostringstream oss;
+    oss << "RolloutEngine::run: invalid number of first actions ("
+        << first_actions->cols() << " while " << nb_trajectories << " were expected)";
+    throw std::runtime_error(oss.str());
+  }
+  // Initializing results
+  rewards = Eigen::VectorXd::Zero(nb_trajectories);
+  final_states = initial_states;
+  terminals = Problem::TerminalFlags::Constant(nb_trajectories, false);
+  if (record_visited_states) {
+    visited_states.clear();
+    visited_states.resize(nb_trajectories);
+  }
+  // Initializing active trajectories
+  states = initial_states;
+  active.resize(nb_trajectories);
+  for (int i = 0; i < nb_trajectories; i++) {
+    active[i] = i;
+  }
+  double coeff = 1;
+  for (int step = 0; step < horizon && active.size() > 0; step++) {
+    int nb_active = active.size();
+    if (record_visited_states) {
+      for (int i = 0; i < nb_active; i++) {
+        visited_states[active[i]].push_back(states.col(i));
+      }
+    }
+    // Computing actions and transitions for all the active trajectories
+    if (step == 0 && first_actions != nullptr) {
+      actions = *first_actions;
+    }
+    else {
+      policy.getActions(states, engine, &actions);
+    }
+    result_function(states, actions, engine, &successors, &step_rewards, &step_terminals);
+    // Removing trajectories which reached a terminal state
+    int nb_remaining = 0;
+    for (int i = 0; i < nb_active; i++) {
+      int trajectory = active[i];
+      rewards(trajectory) += coeff * step_rewards(i);
+      if (step_terminals(i)) {
+        terminals(trajectory) = true;
+        final_states.col(trajectory) = successors.col(i);
+      }
+      else {
+        if (nb_remaining != i) {
+          successors.col(nb_remaining) = successors.col(i);
+        }
+        active[nb_remaining] = trajectory;
+        nb_remaining++;
+      }
+    }
+    active.resize(nb_remaining);
+    // Swapping avoids any allocation when no trajectory has been removed
+    if (nb_remaining == nb_active) {
+      states.swap(successors);
+    }
+    else {
+      states = successors.leftCols(nb_remaining);
+    }
+    coeff *= discount;
+  }
+  // Storing the final states of the trajectories which are still active
+  for (size_t i = 0; i < active.size(); i++) {
+    final_states.col(active[i]) = states.col(i);
+  }
+  final_coeff = coeff;
+}
+
+int RolloutEngine::nbTrajectories() const
+{
+  return rewards.rows();
+}
+
+const Eigen::VectorXd & RolloutEngine::getRewards() const
+{
+  return rewards;
+}
+
+const Eigen::MatrixXd & RolloutEngine::getFinalStates() const
+{
+  return final_states;
+}
+
+const Problem::TerminalFlags & RolloutEngine::getTerminals() const
+{
+  return terminals;
+}
+
+void RolloutEngine::addFinalValues(Problem::ValueFunction value_function)
+{
+  for (int i = 0; i < nbTrajectories(); i++) {
+    if (!terminals(i)) {
+      rewards(i) += final_coeff * value_function(final_states.col(i));
+    }
+  }
+}
+
+void RolloutEngine::setRecordVisitedStates(bool record)
+{
+  record_visited_states = record;
+}
+
+const std::vector<std::vector<Eigen::VectorXd>> & RolloutEngine::getVisitedStates() const
+{
+  return visited_states;
+}
+
+}
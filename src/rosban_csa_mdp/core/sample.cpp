@@ -1,6 +1,6 @@
 #include "rosban_csa_mdp/core/sample.h"
 
-#include <fstream>
+#include "rosban_csa_mdp/core/csv_reader.h"
 
 namespace csa_mdp
 {
@@ -21,17 +21,6 @@ Sample::Sample(const Eigen::VectorXd &state_,
 {
 }
 
-//TODO externalize to another module
-static std::vector<std::string> split(const std::string &s, char delim) {
-  std::vector<std::string> elems;
-  std::stringstream ss(s);
-  std::string item;
-  while(getline(ss, item, delim)) {
-    elems.push_back(item);
-  }
-  return elems;
-}
-
 std::vector<Sample> Sample::readCSV(const std::string &path,
                                     const std::vector<size_t> &src_state_cols,
                                     const std::vector<size_t> &action_cols,
@@ -42,43 +31,35 @@ std::vector<Sample> Sample::readCSV(const std::string &path,
   std::vector<Sample> samples;
   int x_dim = src_state_cols.size();
   int u_dim = action_cols.size();
-  std::ifstream infile(path);
-  std::string line;
-  while (std::getline(infile, line))
+  CSVReader reader(path);
+  // Skipping first line if needed
+  if (header) reader.nextRow();
+  // Buffers reused for all the rows
+  Eigen::VectorXd src_state(x_dim);
+  Eigen::VectorXd action(u_dim);
+  Eigen::VectorXd dst_state(x_dim);
+  while (reader.nextRow())
   {
-    // Skipping first line if needed
-    if (header)
-    {
-      header = false;
-      continue;
-    }
-    // Getting columns
-    std::vector<std::string> cols = split(line,',');
-    // Declaring variables
-    Eigen::VectorXd src_state(x_dim);
-    Eigen::VectorXd action(u_dim);
-    Eigen::VectorXd dst_state(x_dim);
     double reward = 0;
     // Attributing variables at the right place
     int dim = 0;
     for (int col : src_state_cols){
-      src_state(dim++) = std::stod(cols[col]);
+      src_state(dim++) = reader.getDouble(col);
     }
     dim = 0;
     for (int col : action_cols){
-      action(dim++) = std::stod(cols[col]);
+      action(dim++) = reader.getDouble(col);
     }
     dim = 0;
     for (int col : dst_state_cols){
-      dst_state(dim++) = std::stod(cols[col]);
+      dst_state(dim++) = reader.getDouble(col);
     }
     if (reward_col >= 0)
-      reward = std::stod(cols[reward_col]);
+      reward = reader.getDouble(reward_col);
     // Pushing values
     samples.push_back(Sample(src_state, action, dst_state, reward));
   }
   return samples;
 }
 
-
 }
@@ -0,0 +1,35 @@
+#include "rosban_csa_mdp/core/sample_source.h"
+
+namespace csa_mdp
+{
+
+SampleSource::~SampleSource()
+{
+}
+
+bool SampleSource::empty() const
+{
+  return size() == 0;
+}
+
+Sample SampleSource::getSample(int idx) const
+{
+  Sample sample;
+  getState(idx, &sample.state);
+  getAction(idx, &sample.action);
+  getNextState(idx, &sample.next_state);
+  sample.reward = reward(idx);
+  return sample;
+}
+
+std::vector<Sample> SampleSource::toSamples() const
+{
+  std::vector<Sample> samples;
+  samples.reserve(size());
+  for (int idx = 0; idx < size(); idx++) {
+    samples.push_back(getSample(idx));
+  }
+  return samples;
+}
+
+}
@@ -0,0 +1,503 @@
+#include "rosban_csa_mdp/core/sample_store.h"
+
+#include "rosban_csa_mdp/core/binary_io.h"
+
+#include <algorithm>
+#include <cmath>
+#include <sstream>
+#include <stdexcept>
+
+namespace csa_mdp
+{
+
+SampleStore::ColumnStorage::ColumnStorage()
+  : precision(Precision::Double), dims(0), has_limits(false)
+{
+}
+
+void SampleStore::ColumnStorage::setup(Precision precision_, int dims_)
+{
+  precision = precision_;
+  dims = dims_;
+  double_data.resize(dims, 0);
+  float_data.resize(dims, 0);
+  quantized_data.resize(dims, 0);
+  has_limits = false;
+  resetErrors();
+}
+
+void SampleStore::ColumnStorage::setLimits(const Eigen::MatrixXd & limits)
+{
+  if (limits.rows() != dims || limits.cols() != 2) {
+    std::ostringstream oss;
+    oss << "SampleStore::setLimits: invalid limits size (" << limits.rows() << "x"
+        << limits.cols() << " while " << dims << "x2 was expected)";
+    throw std::runtime_error(oss.str());
+  }
+  offset = limits.col(0);
+  scale = (limits.col(1) - limits.col(0)) / 65535.0;
+  has_limits = true;
+}
+
+void SampleStore::ColumnStorage::resetErrors()
+{
+  max_error = Eigen::VectorXd::Zero(dims);
+}
+
+int SampleStore::ColumnStorage::capacity() const
+{
+  switch (precision) {
+    case Precision::Double: return double_data.cols();
+    case Precision::Float: return float_data.cols();
+    case Precision::Quantized16: return quantized_data.cols();
+  }
+  return 0;
+}
+
+void SampleStore::ColumnStorage::reserve(int new_capacity)
+{
+  switch (precision) {
+    case Precision::Double:
+      double_data.conservativeResize(dims, new_capacity);
+      break;
+    case Precision::Float:
+      float_data.conservativeResize(dims, new_capacity);
+      break;
+    case Precision::Quantized16:
+      quantized_data.conservativeResize(dims, new_capacity);
+      break;
+  }
+}
+
+void SampleStore::ColumnStorage::set(int idx, const Eigen::Ref<const Eigen::VectorXd> & value)
+{
+  switch (precision) {
+    case Precision::Double:
+      double_data.col(idx) = value;
+      return;
+    case Precision::Float:
+      for (int d = 0; d < dims; d++) {
+        float encoded = (float)value(d);
+        float_data(d, idx) = encoded;
+        max_error(d) = std::max(max_error(d), std::fabs(encoded - value(d)));
+      }
+      return;
+    case Precision::Quantized16:
+      if (!has_limits) {
+        throw std::logic_error("SampleStore::push: limits are required for Quantized16 precision");
+      }
+      for (int d = 0; d < dims; d++) {
+        double level = 0;
+        if (scale(d) > 0) {
+          level = std::round((value(d) - offset(d)) / scale(d));
+          level = std::min(65535.0, std::max(0.0, level));
+        }
+        quantized_data(d, idx) = (uint16_t)level;
+        double decoded = offset(d) + level * scale(d);
+        max_error(d) = std::max(max_error(d), std::fabs(decoded - value(d)));
+      }
+      return;
+  }
+}
+
+void SampleStore::ColumnStorage::get(int idx, Eigen::VectorXd * value) const
+{
+  if (value->rows() != dims) {
+    value->resize(dims);
+  }
+  switch (precision) {
+    case Precision::Double:
+      *value = double_data.col(idx);
+      return;
+    case Precision::Float:
+      *value = float_data.col(idx).cast<double>();
+      return;
+    case Precision::Quantized16:
+      *value = offset + scale.cwiseProduct(quantized_data.col(idx).cast<double>());
+      return;
+  }
+}
+
+size_t SampleStore::ColumnStorage::bytesPerColumn() const
+{
+  switch (precision) {
+    case Precision::Double: return dims * sizeof(double);
+    case Precision::Float: return dims * sizeof(float);
+    case Precision::Quantized16: return dims * sizeof(uint16_t);
+  }
+  return 0;
+}
+
+void SampleStore::ColumnStorage::write(std::ostream & out, int nb_columns) const
+{
+  binary_io::write<uint8_t>(out, has_limits);
+  if (has_limits) {
+    binary_io::writeMatrix(out, offset);
+    binary_io::writeMatrix(out, scale);
+  }
+  const char * data = nullptr;
+  switch (precision) {
+    case Precision::Double: data = (const char *)double_data.data(); break;
+    case Precision::Float: data = (const char *)float_data.data(); break;
+    case Precision::Quantized16: data = (const char *)quantized_data.data(); break;
+  }
+  out.write(data, nb_columns * bytesPerColumn());
+}
+
+void SampleStore::ColumnStorage::read(std::istream & in, int nb_columns)
+{
+  has_limits = binary_io::read<uint8_t>(in) != 0;
+  if (has_limits) {
+    binary_io::readMatrix(in, &offset);
+    binary_io::readMatrix(in, &scale);
+    if (offset.rows() != dims || scale.rows() != dims) {
+      throw std::runtime_error("SampleStore::read: invalid quantization parameters");
+    }
+  }
+  reserve(nb_columns);
+  char * data = nullptr;
+  switch (precision) {
+    case Precision::Double: data = (char *)double_data.data(); break;
+    case Precision::Float: data = (char *)float_data.data(); break;
+    case Precision::Quantized16: data = (char *)quantized_data.data(); break;
+  }
+  in.read(data, nb_columns * bytesPerColumn());
+  if (!in.good()) {
+    throw std::runtime_error("SampleStore::read: unexpected end of stream");
+  }
+}
+
+SampleStore::SampleStore()
+  : state_dims(-1), action_dims(-1), nb_samples(0), precision(Precision::Double)
+{
+}
+
+SampleStore::SampleStore(int state_dims_, int action_dims_, Precision precision_)
+  : state_dims(state_dims_), action_dims(action_dims_), nb_samples(0),
+    precision(precision_)
+{
+  state_data.setup(precision, state_dims);
+  action_data.setup(precision, action_dims);
+  next_state_data.setup(precision, state_dims);
+}
+
+SampleStore::SampleStore(const std::vector<Sample> & samples)
+  : SampleStore()
+{
+  if (samples.size() == 0) return;
+  checkDims(samples[0].state.rows(), samples[0].action.rows());
+  reserve(samples.size());
+  for (const Sample & s : samples) {
+    push(s);
+  }
+}
+
+int SampleStore::size() const
+{
+  return nb_samples;
+}
+
+int SampleStore::capacity() const
+{
+  return reward_data.rows();
+}
+
+int SampleStore::stateDims() const
+{
+  return state_dims;
+}
+
+int SampleStore::actionDims() const
+{
+  return action_dims;
+}
+
+SampleStore::Precision SampleStore::getPrecision() const
+{
+  return precision;
+}
+
+void SampleStore::setLimits(const Eigen::MatrixXd & state_limits,
+                            const Eigen::MatrixXd & action_limits)
+{
+  if (state_dims < 0 || action_dims < 0) {
+    throw std::logic_error("SampleStore::setLimits: dimensions have not been set");
+  }
+  // Stored samples are encoded with the current limits
+  if (precision == Precision::Quantized16 && nb_samples > 0) {
+    throw std::logic_error("SampleStore::setLimits: cannot change the limits of a "
+                           "non-empty Quantized16 store");
+  }
+  state_data.setLimits(state_limits);
+  action_data.setLimits(action_limits);
+  next_state_data.setLimits(state_limits);
+}
+
+void SampleStore::reserve(int new_capacity)
+{
+  if (new_capacity <= capacity()) return;
+  if (state_dims < 0 || action_dims < 0) {
+    throw std::logic_error("SampleStore::reserve: dimensions have not been set");
+  }
+  state_data.reserve(new_capacity);
+  action_data.reserve(new_capacity);
+  next_state_data.reserve(new_capacity);
+  reward_data.conservativeResize(new_capacity);
+}
+
+void SampleStore::clear()
+{
+  nb_samples = 0;
+  state_data.resetErrors();
+  action_data.resetErrors();
+  next_state_data.resetErrors();
+}
+
+void SampleStore::push(const Sample & sample)
+{
+  push(sample.state, sample.action, sample.next_state, sample.reward);
+}
+
+void SampleStore::push(const Eigen::Ref<const Eigen::VectorXd> & state,
+                       const Eigen::Ref<const Eigen::VectorXd> & action,
+                       const Eigen::Ref<const Eigen::VectorXd> & next_state,
+                       double reward)
+{
+  checkDims(state.rows(), action.rows());
+  if (next_state.rows() != state_dims) {
+    std::ostringstream oss;
+    oss << "SampleStore::push: invalid dimension for next_state ("
+        << next_state.rows() << " while " << state_dims << " was expected)";
+    throw std::runtime_error(oss.str());
+  }
+  // Growing geometrically to keep an amortized constant cost
+  if (nb_samples == capacity()) {
+    reserve(std::max(16, 2 * capacity()));
+  }
+  state_data.set(nb_samples, state);
+  action_data.set(nb_samples, action);
+  next_state_data.set(nb_samples, next_state);
+  reward_data(nb_samples) = reward;
+  nb_samples++;
+}
+
+void SampleStore::push(const SampleSource & other, int idx)
+{
+  // Avoid decoding when views are available
+  const SampleStore * other_store = dynamic_cast<const SampleStore *>(&other);
+  if (other_store != nullptr && other_store->getPrecision() == Precision::Double) {
+    push(other_store->state(idx), other_store->action(idx),
+         other_store->nextState(idx), other_store->reward(idx));
+    return;
+  }
+  Eigen::VectorXd state, action, next_state;
+  other.getState(idx, &state);
+  other.getAction(idx, &action);
+  other.getNextState(idx, &next_state);
+  push(state, action, next_state, other.reward(idx));
+}
+
+void SampleStore::append(const SampleSource & other)
+{
+  if (other.empty()) return;
+  checkDims(other.stateDims(), other.actionDims());
+  int new_size = nb_samples + other.size();
+  if (new_size > capacity()) {
+    reserve(std::max(new_size, 2 * capacity()));
+  }
+  // Block copy is only possible if other is a store and no conversion is required
+  const SampleStore * other_store = dynamic_cast<const SampleStore *>(&other);
+  if (other_store == nullptr || precision != Precision::Double ||
+      other_store->getPrecision() != Precision::Double) {
+    Eigen::VectorXd state, action, next_state;
+    for (int idx = 0; idx < other.size(); idx++) {
+      other.getState(idx, &state);
+      other.getAction(idx, &action);
+      other.getNextState(idx, &next_state);
+      push(state, action, next_state, other.reward(idx));
+    }
+    return;
+  }
+  state_data.double_data.middleCols(nb_samples, other.size()) = other_store->states();
+  action_data.double_data.middleCols(nb_samples, other.size()) = other_store->actions();
+  next_state_data.double_data.middleCols(nb_samples, other.size()) = other_store->nextStates();
+  reward_data.segment(nb_samples, other.size()) = other_store->rewards();
+  nb_samples = new_size;
+}
+
+SampleStore::ConstColumn SampleStore::state(int idx) const
+{
+  checkDoublePrecision("state");
+  return state_data.double_data.col(idx);
+}
+
+SampleStore::ConstColumn SampleStore::action(int idx) const
+{
+  checkDoublePrecision("action");
+  return action_data.double_data.col(idx);
+}
+
+SampleStore::ConstColumn SampleStore::nextState(int idx) const
+{
+  checkDoublePrecision("nextState");
+  return next_state_data.double_data.col(idx);
+}
+
+double SampleStore::reward(int idx) const
+{
+  return reward_data(idx);
+}
+
+SampleStore::ConstColumns SampleStore::states() const
+{
+  checkDoublePrecision("states");
+  return state_data.double_data.leftCols(nb_samples);
+}
+
+SampleStore::ConstColumns SampleStore::actions() const
+{
+  checkDoublePrecision("actions");
+  return action_data.double_data.leftCols(nb_samples);
+}
+
+SampleStore::ConstColumns SampleStore::nextStates() const
+{
+  checkDoublePrecision("nextStates");
+  return next_state_data.double_data.leftCols(nb_samples);
+}
+
+SampleStore::ConstRewards SampleStore::rewards() const
+{
+  return reward_data.segment(0, nb_samples);
+}
+
+void SampleStore::getState(int idx, Eigen::VectorXd * state) const
+{
+  state_data.get(idx, state);
+}
+
+void SampleStore::getAction(int idx, Eigen::VectorXd * action) const
+{
+  action_data.get(idx, action);
+}
+
+void SampleStore::getNextState(int idx, Eigen::VectorXd * next_state) const
+{
+  next_state_data.get(idx, next_state);
+}
+
+Eigen::VectorXd SampleStore::getMaxStateError() const
+{
+  return state_data.max_error.cwiseMax(next_state_data.max_error);
+}
+
+Eigen::VectorXd SampleStore::getMaxActionError() const
+{
+  return action_data.max_error;
+}
+
+size_t SampleStore::getMemoryUsage() const
+{
+  size_t bytes_per_sample = state_data.bytesPerColumn() + action_data.bytesPerColumn()
+    + next_state_data.bytesPerColumn() + sizeof(double);
+  return capacity() * bytes_per_sample;
+}
+
+void SampleStore::write(std::ostream & out) const
+{
+  binary_io::write<int32_t>(out, state_dims);
+  binary_io::write<int32_t>(out, action_dims);
+  binary_io::write<int32_t>(out, nb_samples);
+  binary_io::write<uint8_t>(out, (uint8_t)precision);
+  if (state_dims < 0 || action_dims < 0) return;
+  state_data.write(out, nb_samples);
+  action_data.write(out, nb_samples);
+  next_state_data.write(out, nb_samples);
+  out.write((const char *)reward_data.data(), nb_samples * sizeof(double));
+}
+
+void SampleStore::read(std::istream & in)
+{
+  int new_state_dims = binary_io::read<int32_t>(in);
+  int new_action_dims = binary_io::read<int32_t>(in);
+  int new_nb_samples = binary_io::read<int32_t>(in);
+  uint8_t precision_id = binary_io::read<uint8_t>(in);
+  if (precision_id > (uint8_t)Precision::Quantized16 || new_nb_samples < 0) {
+    throw std::runtime_error("SampleStore::read: invalid header");
+  }
+  if (new_state_dims < 0 || new_action_dims < 0) {
+    // Dimensions were not known yet when the store was written
+    *this = SampleStore();
+    precision = (Precision)precision_id;
+    return;
+  }
+  *this = SampleStore(new_state_dims, new_action_dims, (Precision)precision_id);
+  state_data.read(in, new_nb_samples);
+  action_data.read(in, new_nb_samples);
+  next_state_data.read(in, new_nb_samples);
+  reward_data.resize(new_nb_samples);
+  in.read((char *)reward_data.data(), new_nb_samples * sizeof(double));
+  if (!in.good()) {
+    throw std::runtime_error("SampleStore::read: unexpected end of stream");
+  }
+  nb_samples = new_nb_samples;
+}
+
+void SampleStore::checkDims(int sample_state_dims, int sample_action_dims)
+{
+  // Dimensions are deduced from the first sample if they were not provided
+  if (state_dims < 0 && action_dims < 0 && nb_samples == 0) {
+    state_dims = sample_state_dims;
+    action_dims = sample_action_dims;
+    state_data.setup(precision, state_dims);
+    action_data.setup(precision, action_dims);
+    next_state_data.setup(precision, state_dims);
+    reward_data.resize(0);
+    return;
+  }
+  if (sample_state_dims != state_dims || sample_action_dims != action_dims) {
+    std::ostringstream oss;
+    oss << "SampleStore::checkDims: dimensions mismatch: received ("
+        << sample_state_dims << "," << sample_action_dims << ") while ("
+        << state_dims << "," << action_dims << ") was expected";
+    throw std::runtime_error(oss.str());
+  }
+}
+
+void SampleStore::checkDoublePrecision(const char * caller) const
+{
+  if (precision != Precision::Double) {
+    throw std::logic_error(std::string("SampleStore::") + caller + ": views are only "
+                           "available with Double precision, use decoding accessors");
+  }
+}
+
+std::string to_string(SampleStore::Precision precision)
+{
+  switch (precision)
+  {
+    case SampleStore::Precision::Double: return "Double";
+    case SampleStore::Precision::Float: return "Float";
+    case SampleStore::Precision::Quantized16: return "Quantized16";
+  }
+  throw std::runtime_error("Unknown type in to_string(Precision)");
+}
+
+SampleStore::Precision loadPrecision(const std::string & precision)
+{
+  if (precision == "Double")
+  {
+    return SampleStore::Precision::Double;
+  }
+  if (precision == "Float")
+  {
+    return SampleStore::Precision::Float;
+  }
+  if (precision == "Quantized16")
+  {
+    return SampleStore::Precision::Quantized16;
+  }
+  throw std::runtime_error("Unknown SampleStore Precision: '" + precision + "'");
+}
+
+}
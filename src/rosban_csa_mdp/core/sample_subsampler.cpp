@@ -0,0 +1,217 @@
+#include "rosban_csa_mdp/core/sample_subsampler.h"
+
+#include "rosban_csa_mdp/core/similarity_index.h"
+
+#include <algorithm>
+#include <numeric>
+#include <sstream>
+#include <stdexcept>
+
+namespace csa_mdp
+{
+
+SampleSubsampler::Config::Config()
+  : max_samples(0), merge_tolerance(0), leaf_size(16), max_replication(4)
+{
+}
+
+void SampleSubsampler::Config::to_xml(std::ostream &out) const
+{
+  rosban_utils::xml_tools::write<int>("max_samples", max_samples, out);
+  rosban_utils::xml_tools::write<double>("merge_tolerance", merge_tolerance, out);
+  rosban_utils::xml_tools::write<int>("leaf_size", leaf_size, out);
+  rosban_utils::xml_tools::write<double>("max_replication", max_replication, out);
+}
+
+void SampleSubsampler::Config::from_xml(TiXmlNode *node)
+{
+  rosban_utils::xml_tools::try_read<int>(node, "max_samples", max_samples);
+  rosban_utils::xml_tools::try_read<double>(node, "merge_tolerance", merge_tolerance);
+  rosban_utils::xml_tools::try_read<int>(node, "leaf_size", leaf_size);
+  rosban_utils::xml_tools::try_read<double>(node, "max_replication", max_replication);
+}
+
+std::string SampleSubsampler::Config::class_name() const
+{
+  return "SampleSubsamplerConfig";
+}
+
+bool SampleSubsampler::Config::isActive() const
+{
+  return max_samples > 0 || merge_tolerance > 0;
+}
+
+SampleSubsampler::SampleSubsampler(const Config & conf_)
+  : conf(conf_)
+{
+}
+
+void SampleSubsampler::subsample(const SampleSource & samples,
+                                 const Eigen::MatrixXd & input_limits,
+                                 SampleStore * subset,
+                                 std::vector<double> * weights) const
+{
+  int x_dim = samples.stateDims();
+  int u_dim = samples.actionDims();
+  int dims = x_dim + u_dim;
+  if (input_limits.rows() != dims || input_limits.cols() != 2) {
+    std::ostringstream oss;
+    oss << "SampleSubsampler::subsample: invalid limits size (" << input_limits.rows()
+        << "x" << input_limits.cols() << " while " << dims << "x2 was expected)";
+    throw std::runtime_error(oss.str());
+  }
+  Eigen::VectorXd offset = input_limits.col(0);
+  Eigen::VectorXd range = input_limits.col(1) - input_limits.col(0);
+  for (int dim = 0; dim < dims; dim++) {
+    if (range(dim) <= 0) range(dim) = 1;
+  }
+  // Merging similar samples, kept[i] is the index of the i-th sample kept and
+  // column i of points is its normalized (state, action)
+  std::vector<int> kept;
+  std::vector<double> kept_weights;
+  Eigen::MatrixXd points(dims, samples.size());
+  SimilarityIndex index(conf.merge_tolerance > 0 ? conf.merge_tolerance : 1);
+  Eigen::VectorXd state(x_dim), action(u_dim), point(dims);
+  for (int idx = 0; idx < samples.size(); idx++) {
+    samples.getState(idx, &state);
+    samples.getAction(idx, &action);
+    point.segment(0, x_dim) = state;
+    point.segment(x_dim, u_dim) = action;
+    point = (point - offset).cwiseQuotient(range);
+    if (conf.merge_tolerance > 0) {
+      // Indices of the similarity index match the indices in kept
+      int similar = index.findSimilar(point);
+      if (similar >= 0) {
+        kept_weights[similar] += 1;
+        continue;
+      }
+      index.insert(point);
+    }
+    points.col(kept.size()) = point;
+    kept.push_back(idx);
+    kept_weights.push_back(1);
+  }
+  int nb_kept = kept.size();
+  // Pairs (index in samples, weight)
+  std::vector<std::pair<int, double>> selected;
+  if (conf.max_samples <= 0 || nb_kept <= conf.max_samples) {
+    for (int i = 0; i < nb_kept; i++) {
+      selected.push_back({kept[i], kept_weights[i]});
+    }
+  }
+  else {
+    // Cells have more than max_leaf_size / 2 points, thus there are at most
+    // max_samples cells
+    int min_leaf_size = (2 * nb_kept + conf.max_samples - 1) / conf.max_samples;
+    int max_leaf_size = std::max(std::max(conf.leaf_size, 1), min_leaf_size);
+    std::vector<int> order(nb_kept);
+    std::iota(order.begin(), order.end(), 0);
+    std::vector<std::pair<int,int>> cells;
+    partition(points, order, 0, nb_kept, max_leaf_size, &cells);
+    std::vector<double> cell_weights(cells.size(), 0);
+    for (size_t cell_id = 0; cell_id < cells.size(); cell_id++) {
+      for (int pos = cells[cell_id].first; pos < cells[cell_id].second; pos++) {
+        cell_weights[cell_id] += kept_weights[order[pos]];
+      }
+    }
+    std::vector<int> quotas = getQuotas(cells, cell_weights, conf.max_samples);
+    for (size_t cell_id = 0; cell_id < cells.size(); cell_id++) {
+      const std::pair<int,int> & cell = cells[cell_id];
+      int cell_size = cell.second - cell.first;
+      int quota = quotas[cell_id];
+      // Each chosen sample replaces a chunk of the cell
+      for (int k = 0; k < quota; k++) {
+        int chunk_start = cell.first + (k * cell_size) / quota;
+        int chunk_end = cell.first + ((k + 1) * cell_size) / quota;
+        double chunk_weight = 0;
+        for (int pos = chunk_start; pos < chunk_end; pos++) {
+          chunk_weight += kept_weights[order[pos]];
+        }
+        int chosen = order[chunk_start + (chunk_end - chunk_start) / 2];
+        selected.push_back({kept[chosen], chunk_weight});
+      }
+    }
+    // Original order of the samples is preserved
+    std::sort(selected.begin(), selected.end());
+  }
+  *subset = SampleStore(x_dim, u_dim);
+  subset->reserve(selected.size());
+  weights->clear();
+  weights->reserve(selected.size());
+  for (const std::pair<int, double> & entry : selected) {
+    subset->push(samples, entry.first);
+    weights->push_back(entry.second);
+  }
+}
+
+std::vector<int> SampleSubsampler::getQuotas(const std::vector<std::pair<int,int>> & cells,
+                                             const std::vector<double> & cell_weights,
+                                             int nb_samples)
+{
+  std::vector<int> quotas(cells.size(), 1);
+  int remaining = nb_samples - cells.size();
+  while (remaining > 0) {
+    // Weight of the cells which can receive more samples
+    double open_weight = 0;
+    for (size_t cell_id = 0; cell_id < cells.size(); cell_id++) {
+      int cell_size = cells[cell_id].second - cells[cell_id].first;
+      if (quotas[cell_id] < cell_size) open_weight += cell_weights[cell_id];
+    }
+    if (open_weight <= 0) break;
+    int distributed = 0;
+    int best_cell = -1;
+    double best_ratio = 0;
+    for (size_t cell_id = 0; cell_id < cells.size(); cell_id++) {
+      int cell_size = cells[cell_id].second - cells[cell_id].first;
+      if (quotas[cell_id] >= cell_size) continue;
+      int added = (int)(remaining * cell_weights[cell_id] / open_weight);
+      added = std::min(added, cell_size - quotas[cell_id]);
+      quotas[cell_id] += added;
+      distributed += added;
+      // Cell with the highest weight per sample, used if rounding prevents
+      // any progress
+      double ratio = cell_weights[cell_id] / quotas[cell_id];
+      if (quotas[cell_id] < cell_size && ratio > best_ratio) {
+        best_cell = cell_id;
+        best_ratio = ratio;
+      }
+    }
+    if (distributed == 0) {
+      if (best_cell < 0) break;
+      quotas[best_cell]++;
+      distributed = 1;
+    }
+    remaining -= distributed;
+  }
+  return quotas;
+}
+
+void SampleSubsampler::partition(const Eigen::MatrixXd & points,
+                                 std::vector<int> & order, int start, int end,
+                                 int max_leaf_size,
+                                 std::vector<std::pair<int,int>> * cells)
+{
+  if (end - start <= max_leaf_size) {
+    cells->push_back({start, end});
+    return;
+  }
+  // Splitting at the median of the widest dimension
+  Eigen::VectorXd min = points.col(order[start]);
+  Eigen::VectorXd max = min;
+  for (int pos = start + 1; pos < end; pos++) {
+    min = min.cwiseMin(points.col(order[pos]));
+    max = max.cwiseMax(points.col(order[pos]));
+  }
+  int split_dim;
+  (max - min).maxCoeff(&split_dim);
+  int middle = start + (end - start) / 2;
+  std::nth_element(order.begin() + start, order.begin() + middle, order.begin() + end,
+                   [&points, split_dim](int a, int b)
+                   {
+                     return points(split_dim, a) < points(split_dim, b);
+                   });
+  partition(points, order, start, middle, max_leaf_size, cells);
+  partition(points, order, middle, end, max_leaf_size, cells);
+}
+
+}
@@ -0,0 +1,156 @@
+#include "rosban_csa_mdp/core/similarity_index.h"
+
+#include <cmath>
+#include <sstream>
+#include <stdexcept>
+
+namespace csa_mdp
+{
+
+const int SimilarityIndex::cell_factor = 8;
+const int SimilarityIndex::max_border_dims = 10;
+
+SimilarityIndex::SimilarityIndex(double tolerance_)
+{
+  reset(tolerance_);
+}
+
+void SimilarityIndex::reset(double tolerance_)
+{
+  if (tolerance_ <= 0) {
+    throw std::logic_error("SimilarityIndex::reset: tolerance should be strictly positive");
+  }
+  tolerance = tolerance_;
+  cell_size = cell_factor * tolerance;
+  dim = -1;
+  points.clear();
+  cells.clear();
+}
+
+bool SimilarityIndex::hasSimilar(const Eigen::VectorXd & point) const
+{
+  return findSimilar(point) >= 0;
+}
+
+int SimilarityIndex::findSimilar(const Eigen::VectorXd & point) const
+{
+  if (dim < 0) return -1;
+  checkPoint(point, "findSimilar");
+  std::vector<int64_t> cell;
+  getCell(point, &cell);
+  // Dimensions along which a similar point might be in a neighbor cell, and
+  // direction of the neighbor
+  std::vector<int> border_dims;
+  std::vector<int> border_dirs;
+  for (int d = 0; d < dim; d++) {
+    double offset = point(d) - cell[d] * cell_size;
+    if (offset < tolerance) {
+      border_dims.push_back(d);
+      border_dirs.push_back(-1);
+    }
+    else if (offset > cell_size - tolerance) {
+      border_dims.push_back(d);
+      border_dirs.push_back(1);
+    }
+  }
+  // When the point is close to the border along many dimensions, checking
+  // all the points is cheaper than enumerating 2^k neighbor cells
+  if ((int)border_dims.size() > max_border_dims) {
+    for (int idx = 0; idx < size(); idx++) {
+      Eigen::Map<const Eigen::VectorXd> known_point(points.data() + idx * dim, dim);
+      if ((known_point - point).lpNorm<Eigen::Infinity>() < tolerance) return idx;
+    }
+    return -1;
+  }
+  // Checking all the combinations of neighbors
+  uint64_t nb_combinations = (uint64_t)1 << border_dims.size();
+  for (uint64_t combination = 0; combination < nb_combinations; combination++) {
+    std::vector<int64_t> neighbor = cell;
+    for (size_t i = 0; i < border_dims.size(); i++) {
+      if (combination & ((uint64_t)1 << i)) {
+        neighbor[border_dims[i]] += border_dirs[i];
+      }
+    }
+    int idx = cellFindSimilar(hashCell(neighbor), point);
+    if (idx >= 0) return idx;
+  }
+  return -1;
+}
+
+bool SimilarityIndex::insert(const Eigen::VectorXd & point)
+{
+  if (dim < 0) {
+    dim = point.rows();
+  }
+  checkPoint(point, "insert");
+  if (findSimilar(point) >= 0) return false;
+  std::vector<int64_t> cell;
+  getCell(point, &cell);
+  cells[hashCell(cell)].push_back(size());
+  for (int d = 0; d < dim; d++) {
+    points.push_back(point(d));
+  }
+  return true;
+}
+
+int SimilarityIndex::size() const
+{
+  if (dim <= 0) return 0;
+  return points.size() / dim;
+}
+
+double SimilarityIndex::getTolerance() const
+{
+  return tolerance;
+}
+
+void SimilarityIndex::checkPoint(const Eigen::VectorXd & point, const char * method) const
+{
+  if (point.rows() != dim) {
+    std::ostringstream oss;
+    oss << "SimilarityIndex::" << method << ": invalid dimension for point ("
+        << point.rows() << " while " << dim << " was expected)";
+    throw std::runtime_error(oss.str());
+  }
+  // Coordinates of the cells (and of their neighbors) have to fit in int64_t
+  const double max_cell = std::ldexp(1.0, 62);
+  for (int d = 0; d < dim; d++) {
+    if (!std::isfinite(point(d)) || std::fabs(point(d) / cell_size) >= max_cell) {
+      std::ostringstream oss;
+      oss << "SimilarityIndex::" << method << ": invalid value " << point(d)
+          << " along dimension " << d;
+      throw std::runtime_error(oss.str());
+    }
+  }
+}
+
+int SimilarityIndex::cellFindSimilar(uint64_t cell_hash, const Eigen::VectorXd & point) const
+{
+  auto it = cells.find(cell_hash);
+  if (it == cells.end()) return -1;
+  for (int idx : it->second) {
+    Eigen::Map<const Eigen::VectorXd> known_point(points.data() + idx * dim, dim);
+    if ((known_point - point).lpNorm<Eigen::Infinity>() < tolerance) return idx;
+  }
+  return -1;
+}
+
+void SimilarityIndex::getCell(const Eigen::VectorXd & point, std::vector<int64_t> * cell) const
+{
+  cell->resize(point.rows());
+  for (int d = 0; d < point.rows(); d++) {
+    (*cell)[d] = (int64_t)std::floor(point(d) / cell_size);
+  }
+}
+
+uint64_t SimilarityIndex::hashCell(const std::vector<int64_t> & cell)
+{
+  // Combining coordinates as boost::hash_combine does
+  uint64_t hash = cell.size();
+  for (int64_t coord : cell) {
+    hash ^= (uint64_t)coord + 0x9e3779b97f4a7c15ul + (hash << 6) + (hash >> 2);
+  }
+  return hash;
+}
+
+}
@@ -1,5 +1,7 @@
 set(SOURCES
   fa_policy.cpp
+  forest_max_query.cpp
+  gp_forest_query.cpp
   forests_policy.cpp
   monte_carlo_policy.cpp
   random_policy.cpp
@@ -10,4 +12,13 @@ set(SOURCES
   problem.cpp
   problem_factory.cpp
   sample.cpp
+  sample_source.cpp
+  sample_store.cpp
+  sample_subsampler.cpp
+  transition_view.cpp
+  csv_reader.cpp
+  trajectory_log.cpp
+  rollout_engine.cpp
+  similarity_index.cpp
+  worker_pool.cpp
 )
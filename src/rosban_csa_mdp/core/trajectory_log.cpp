@@ -0,0 +1,358 @@
+#include "rosban_csa_mdp/core/trajectory_log.h"
+
+#include <cstring>
+#include <sstream>
+#include <stdexcept>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+namespace csa_mdp
+{
+
+const char TrajectoryLog::magic[8] = {'C','S','A','M','D','P','T','L'};
+const uint32_t TrajectoryLog::version = 1;
+
+TrajectoryLog::SampleView::SampleView(const double * record, const double * next_record,
+                                      int state_dims, int action_dims)
+  : state(record, state_dims),
+    action(record + state_dims, action_dims),
+    next_state(next_record, state_dims),
+    reward(next_record[state_dims + action_dims])
+{
+}
+
+Sample TrajectoryLog::SampleView::toSample() const
+{
+  return Sample(state, action, next_state, reward);
+}
+
+TrajectoryLog::RunView::RunView(const double * data_, size_t nb_steps_,
+                                int state_dims_, int action_dims_)
+  : data(data_), nb_steps(nb_steps_), state_dims(state_dims_), action_dims(action_dims_)
+{
+}
+
+size_t TrajectoryLog::RunView::size() const
+{
+  return nb_steps;
+}
+
+TrajectoryLog::ConstVectorMap TrajectoryLog::RunView::getState(size_t step) const
+{
+  return ConstVectorMap(data + step * stride(), state_dims);
+}
+
+TrajectoryLog::ConstVectorMap TrajectoryLog::RunView::getAction(size_t step) const
+{
+  return ConstVectorMap(data + step * stride() + state_dims, action_dims);
+}
+
+double TrajectoryLog::RunView::getReward(size_t step) const
+{
+  return data[step * stride() + state_dims + action_dims];
+}
+
+TrajectoryLog::ConstMatrixMap TrajectoryLog::RunView::getStates() const
+{
+  return ConstMatrixMap(data, state_dims, nb_steps, Eigen::OuterStride<>(stride()));
+}
+
+TrajectoryLog::ConstMatrixMap TrajectoryLog::RunView::getActions() const
+{
+  return ConstMatrixMap(data + state_dims, action_dims, nb_steps,
+                        Eigen::OuterStride<>(stride()));
+}
+
+size_t TrajectoryLog::RunView::getNbSamples() const
+{
+  if (nb_steps == 0) return 0;
+  return nb_steps - 1;
+}
+
+TrajectoryLog::SampleView TrajectoryLog::RunView::getSample(size_t idx) const
+{
+  if (idx >= getNbSamples())
+  {
+    throw std::out_of_range("TrajectoryLog::RunView::getSample: invalid index");
+  }
+  const double * record = data + idx * stride();
+  return SampleView(record, record + stride(), state_dims, action_dims);
+}
+
+History TrajectoryLog::RunView::toHistory() const
+{
+  History h;
+  for (size_t step = 0; step < nb_steps; step++)
+  {
+    h.push(getState(step), getAction(step), getReward(step));
+  }
+  return h;
+}
+
+int TrajectoryLog::RunView::stride() const
+{
+  return state_dims + action_dims + 1;
+}
+
+TrajectoryLog::Writer::Writer(const std::string & path_, int state_dims_, int action_dims_)
+  : path(path_), state_dims(state_dims_), action_dims(action_dims_),
+    run_started(false), offset(sizeof(Header)),
+    record(state_dims_ + action_dims_ + 1)
+{
+  out.open(path, std::ios::binary | std::ios::trunc);
+  if (!out.good())
+  {
+    throw std::runtime_error("TrajectoryLog::Writer: Failed to open file '" + path + "'");
+  }
+  // Placeholder, the header is written when closing the file
+  Header header;
+  memset(&header, 0, sizeof(Header));
+  out.write((const char *)&header, sizeof(Header));
+}
+
+TrajectoryLog::Writer::~Writer()
+{
+  if (out.is_open())
+  {
+    try
+    {
+      close();
+    }
+    catch (...)
+    {
+      // Destructors should not throw
+    }
+  }
+}
+
+void TrajectoryLog::Writer::startRun()
+{
+  if (run_started) endRun();
+  RunEntry entry;
+  entry.offset = offset;
+  entry.nb_steps = 0;
+  runs.push_back(entry);
+  run_started = true;
+}
+
+void TrajectoryLog::Writer::push(const Eigen::VectorXd & state,
+                                 const Eigen::VectorXd & action,
+                                 double reward)
+{
+  if (!out.is_open())
+  {
+    throw std::logic_error("TrajectoryLog::Writer::push: writer is closed");
+  }
+  if (state.rows() != state_dims || action.rows() != action_dims)
+  {
+    std::ostringstream oss;
+    oss << "TrajectoryLog::Writer::push: dimensions mismatch: received ("
+        << state.rows() << "," << action.rows() << ") while ("
+        << state_dims << "," << action_dims << ") was expected";
+    throw std::runtime_error(oss.str());
+  }
+  if (!run_started) startRun();
+  Eigen::Map<Eigen::VectorXd>(record.data(), state_dims) = state;
+  Eigen::Map<Eigen::VectorXd>(record.data() + state_dims, action_dims) = action;
+  record[state_dims + action_dims] = reward;
+  size_t record_size = record.size() * sizeof(double);
+  out.write((const char *)record.data(), record_size);
+  offset += record_size;
+  runs.back().nb_steps++;
+}
+
+void TrajectoryLog::Writer::endRun()
+{
+  run_started = false;
+}
+
+void TrajectoryLog::Writer::write(const History & history)
+{
+  startRun();
+  for (size_t step = 0; step < history.size(); step++)
+  {
+    push(history.getState(step), history.getAction(step), history.getReward(step));
+  }
+  endRun();
+}
+
+void TrajectoryLog::Writer::close()
+{
+  if (!out.is_open()) return;
+  endRun();
+  out.write((const char *)runs.data(), runs.size() * sizeof(RunEntry));
+  Header header;
+  memset(&header, 0, sizeof(Header));
+  memcpy(header.magic, TrajectoryLog::magic, sizeof(header.magic));
+  header.version = TrajectoryLog::version;
+  header.state_dims = state_dims;
+  header.action_dims = action_dims;
+  header.nb_runs = runs.size();
+  header.index_offset = offset;
+  out.seekp(0);
+  out.write((const char *)&header, sizeof(Header));
+  out.close();
+  if (out.fail())
+  {
+    throw std::runtime_error("TrajectoryLog::Writer::close: Failed to write file '" + path + "'");
+  }
+}
+
+TrajectoryLog::TrajectoryLog(const std::string & path_)
+  : path(path_), mapping(nullptr), mapping_size(0), header(nullptr), index(nullptr)
+{
+  int fd = ::open(path.c_str(), O_RDONLY);
+  if (fd < 0)
+  {
+    throw std::runtime_error("TrajectoryLog: Failed to open file '" + path + "'");
+  }
+  struct stat file_stat;
+  if (fstat(fd, &file_stat) != 0 || (size_t)file_stat.st_size < sizeof(Header))
+  {
+    ::close(fd);
+    throw std::runtime_error("TrajectoryLog: '" + path + "' is not a valid trajectory log");
+  }
+  mapping_size = file_stat.st_size;
+  mapping = mmap(nullptr, mapping_size, PROT_READ, MAP_SHARED, fd, 0);
+  // The mapping stays valid after the file descriptor is closed
+  ::close(fd);
+  if (mapping == MAP_FAILED)
+  {
+    mapping = nullptr;
+    throw std::runtime_error("TrajectoryLog: Failed to map file '" + path + "'");
+  }
+  header = (const Header *)mapping;
+  std::string error;
+  if (memcmp(header->magic, magic, sizeof(magic)) != 0)
+  {
+    error = "invalid magic number";
+  }
+  else if (header->version != version)
+  {
+    error = "unsupported version";
+  }
+  // Written to avoid overflows on corrupted values
+  else if (header->index_offset < sizeof(Header) ||
+           header->index_offset > mapping_size ||
+           header->nb_runs > (mapping_size - header->index_offset) / sizeof(RunEntry))
+  {
+    error = "truncated file";
+  }
+  else if (header->index_offset % sizeof(double) != 0)
+  {
+    error = "misaligned run index";
+  }
+  if (error == "")
+  {
+    index = (const RunEntry *)((const char *)mapping + header->index_offset);
+    // Records of each run have to be located between the header and the index
+    uint64_t record_size = ((uint64_t)header->state_dims + header->action_dims + 1) * sizeof(double);
+    for (size_t run = 0; run < header->nb_runs; run++)
+    {
+      const RunEntry & entry = index[run];
+      if (entry.offset < sizeof(Header) || entry.offset > header->index_offset ||
+          entry.offset % sizeof(double) != 0 ||
+          entry.nb_steps > (header->index_offset - entry.offset) / record_size)
+      {
+        std::ostringstream oss;
+        oss << "invalid entry for run " << run << " (offset: " << entry.offset
+            << ", nb_steps: " << entry.nb_steps << ")";
+        error = oss.str();
+        break;
+      }
+    }
+  }
+  if (error != "")
+  {
+    munmap(mapping, mapping_size);
+    throw std::runtime_error("TrajectoryLog: '" + path + "' " + error);
+  }
+}
+
+TrajectoryLog::~TrajectoryLog()
+{
+  if (mapping != nullptr)
+  {
+    munmap(mapping, mapping_size);
+  }
+}
+
+int TrajectoryLog::getStateDims() const
+{
+  return header->state_dims;
+}
+
+int TrajectoryLog::getActionDims() const
+{
+  return header->action_dims;
+}
+
+size_t TrajectoryLog::getNbRuns() const
+{
+  return header->nb_runs;
+}
+
+size_t TrajectoryLog::getNbSamples() const
+{
+  size_t nb_samples = 0;
+  for (size_t run = 0; run < getNbRuns(); run++)
+  {
+    if (index[run].nb_steps > 0)
+    {
+      nb_samples += index[run].nb_steps - 1;
+    }
+  }
+  return nb_samples;
+}
+
+TrajectoryLog::RunView TrajectoryLog::getRun(size_t idx) const
+{
+  if (idx >= getNbRuns())
+  {
+    std::ostringstream oss;
+    oss << "TrajectoryLog::getRun: invalid run " << idx
+        << " (nb_runs: " << getNbRuns() << ")";
+    throw std::out_of_range(oss.str());
+  }
+  const double * data = (const double *)((const char *)mapping + index[idx].offset);
+  return RunView(data, index[idx].nb_steps, getStateDims(), getActionDims());
+}
+
+std::vector<History> TrajectoryLog::toHistories() const
+{
+  std::vector<History> histories;
+  histories.reserve(getNbRuns());
+  for (size_t run = 0; run < getNbRuns(); run++)
+  {
+    histories.push_back(getRun(run).toHistory());
+  }
+  return histories;
+}
+
+void TrajectoryLog::write(const std::string & path, const std::vector<History> & histories,
+                          int state_dims, int action_dims)
+{
+  Writer writer(path, state_dims, action_dims);
+  for (const History & h : histories)
+  {
+    writer.write(h);
+  }
+  writer.close();
+}
+
+void TrajectoryLog::convertCSV(const History::Config & conf, const std::string & output_path)
+{
+  if (!conf.problem)
+  {
+    throw std::runtime_error("TrajectoryLog::convertCSV: problem is not set in conf");
+  }
+  std::vector<History> histories = History::readCSV(conf);
+  int state_dims = conf.problem->getStateLimits().rows();
+  int action_dims = conf.problem->actionDims(0);
+  write(output_path, histories, state_dims, action_dims);
+}
+
+}
@@ -0,0 +1,99 @@
+#include "rosban_csa_mdp/core/transition_view.h"
+
+#include <algorithm>
+#include <stdexcept>
+
+namespace csa_mdp
+{
+
+TransitionView::TransitionView(const std::vector<History> & histories_)
+  : histories(&histories_), state_dims(0), action_dims(0)
+{
+  offsets.reserve(histories->size() + 1);
+  int nb_transitions = 0;
+  for (const History & h : *histories) {
+    offsets.push_back(nb_transitions);
+    if (h.size() == 0) continue;
+    nb_transitions += h.size() - 1;
+    state_dims = h.getState(0).rows();
+    action_dims = h.getAction(0).rows();
+  }
+  offsets.push_back(nb_transitions);
+}
+
+int TransitionView::size() const
+{
+  return offsets.back();
+}
+
+int TransitionView::stateDims() const
+{
+  return state_dims;
+}
+
+int TransitionView::actionDims() const
+{
+  return action_dims;
+}
+
+void TransitionView::getState(int idx, Eigen::VectorXd * state_) const
+{
+  *state_ = state(idx);
+}
+
+void TransitionView::getAction(int idx, Eigen::VectorXd * action_) const
+{
+  *action_ = action(idx);
+}
+
+void TransitionView::getNextState(int idx, Eigen::VectorXd * next_state) const
+{
+  *next_state = nextState(idx);
+}
+
+double TransitionView::reward(int idx) const
+{
+  const History * history;
+  size_t step;
+  locate(idx, &history, &step);
+  return history->getReward(step + 1);
+}
+
+const Eigen::VectorXd & TransitionView::state(int idx) const
+{
+  const History * history;
+  size_t step;
+  locate(idx, &history, &step);
+  return history->getState(step);
+}
+
+const Eigen::VectorXd & TransitionView::action(int idx) const
+{
+  const History * history;
+  size_t step;
+  locate(idx, &history, &step);
+  return history->getAction(step);
+}
+
+const Eigen::VectorXd & TransitionView::nextState(int idx) const
+{
+  const History * history;
+  size_t step;
+  locate(idx, &history, &step);
+  return history->getState(step + 1);
+}
+
+void TransitionView::locate(int idx, const History ** history, size_t * step) const
+{
+  if (idx < 0 || idx >= size()) {
+    throw std::out_of_range("TransitionView::locate: invalid index");
+  }
+  // First history starting after idx, histories without transitions share
+  // the offset of their successor and are therefore skipped
+  auto it = std::upper_bound(offsets.begin(), offsets.end(), idx);
+  size_t history_idx = (it - offsets.begin()) - 1;
+  *history = &((*histories)[history_idx]);
+  *step = idx - offsets[history_idx];
+}
+
+}
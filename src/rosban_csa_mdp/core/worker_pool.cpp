@@ -0,0 +1,289 @@
+#include "rosban_csa_mdp/core/worker_pool.h"
+
+#include "rosban_random/tools.h"
+
+#include <algorithm>
+
+using rosban_utils::MultiCore;
+
+namespace csa_mdp
+{
+
+const int WorkerPool::max_workers = 256;
+const int WorkerPool::chunks_per_thread = 4;
+
+/// Index of the worker running on the current thread, -1 if the thread is
+/// not part of the pool
+static thread_local int current_worker_id = -1;
+
+WorkerPool & WorkerPool::getInstance()
+{
+  static WorkerPool instance;
+  return instance;
+}
+
+WorkerPool::WorkerPool()
+  : nb_workers(0), nb_pending(0), version(0), stop(false)
+{
+  // Queues are allocated once, so that they can be accessed without locking
+  // while the pool grows
+  for (int worker_id = 0; worker_id < max_workers; worker_id++) {
+    queues.push_back(std::unique_ptr<JobQueue>(new JobQueue));
+  }
+}
+
+WorkerPool::~WorkerPool()
+{
+  {
+    std::unique_lock<std::mutex> lock(sleep_mutex);
+    stop = true;
+  }
+  cond.notify_all();
+  for (std::thread & worker : workers) {
+    worker.join();
+  }
+}
+
+void WorkerPool::run(int nb_jobs, Job job, int nb_threads)
+{
+  if (nb_jobs <= 0) return;
+  // No need to involve the workers for a single job or a single thread, jobs
+  // are executed in order and the first exception is rethrown at the end
+  if (nb_jobs == 1 || nb_threads <= 1) {
+    std::exception_ptr error;
+    for (int job_id = 0; job_id < nb_jobs; job_id++) {
+      try {
+        job(job_id);
+      }
+      catch (...) {
+        if (!error) error = std::current_exception();
+      }
+    }
+    if (error) {
+      std::rethrow_exception(error);
+    }
+    return;
+  }
+  reserveWorkers(nb_threads - 1);
+  Batch batch;
+  batch.job = job;
+  batch.nb_remaining = nb_jobs;
+  batch.max_participants = nb_threads;
+  batch.nb_participants = 1;
+  batch.owner = std::this_thread::get_id();
+  int worker_id = current_worker_id;
+  JobQueue & queue = worker_id >= 0 ? *(queues[worker_id]) : shared_queue;
+  {
+    std::unique_lock<std::mutex> lock(queue.mutex);
+    if (worker_id >= 0) {
+      // The owner pops from the back: the first jobs are executed first
+      for (int job_id = nb_jobs - 1; job_id > 0; job_id--) {
+        queue.entries.push_back({&batch, job_id, false});
+      }
+    }
+    else {
+      for (int job_id = 1; job_id < nb_jobs; job_id++) {
+        queue.entries.push_back({&batch, job_id, false});
+      }
+    }
+    nb_pending += nb_jobs - 1;
+  }
+  notifyAll();
+  // The submitting thread handles the first job, then executes available jobs
+  // until its batch is over
+  execute({&batch, 0, false});
+  while (batch.nb_remaining > 0) {
+    // Read before searching, so that notifications sent meanwhile are seen
+    long seen_version = getVersion();
+    Entry entry;
+    if (takeEntry(worker_id, &entry)) {
+      execute(entry);
+      continue;
+    }
+    std::unique_lock<std::mutex> lock(sleep_mutex);
+    cond.wait(lock, [this, &batch, seen_version]()
+              {
+                return batch.nb_remaining == 0 || version != seen_version;
+              });
+  }
+  if (batch.error) {
+    std::rethrow_exception(batch.error);
+  }
+}
+
+void WorkerPool::reserveWorkers(int wished_workers)
+{
+  std::unique_lock<std::mutex> lock(workers_mutex);
+  wished_workers = std::min(wished_workers, max_workers);
+  while ((int)workers.size() < wished_workers) {
+    int worker_id = workers.size();
+    workers.push_back(std::thread([this, worker_id]() { this->workerLoop(worker_id); }));
+    nb_workers++;
+  }
+}
+
+int WorkerPool::getNbWorkers() const
+{
+  return nb_workers;
+}
+
+void WorkerPool::runParallelTask(MultiCore::Task task, int nb_tasks, int nb_threads)
+{
+  MultiCore::Intervals intervals = MultiCore::buildIntervals(nb_tasks, nb_threads);
+  getInstance().run(intervals.size(), [&task, &intervals](int job_id)
+                    {
+                      task(intervals[job_id].first, intervals[job_id].second);
+                    },
+                    nb_threads);
+}
+
+void WorkerPool::runParallelStochasticTask(MultiCore::StochasticTask task,
+                                           int nb_tasks,
+                                           std::vector<std::default_random_engine> * engines)
+{
+  MultiCore::Intervals intervals = MultiCore::buildIntervals(nb_tasks, engines->size());
+  getInstance().run(intervals.size(), [&task, &intervals, engines](int job_id)
+                    {
+                      task(intervals[job_id].first, intervals[job_id].second,
+                           &((*engines)[job_id]));
+                    },
+                    engines->size());
+}
+
+void WorkerPool::runBalancedStochasticTask(MultiCore::StochasticTask task,
+                                           int nb_tasks, int nb_threads,
+                                           std::default_random_engine * engine)
+{
+  if (nb_tasks <= 0) return;
+  // A single thread does not need any balancing
+  int nb_chunks = 1;
+  if (nb_threads > 1) {
+    nb_chunks = std::min(nb_tasks, nb_threads * chunks_per_thread);
+  }
+  std::vector<std::default_random_engine> engines;
+  engines = rosban_random::getRandomEngines(nb_chunks, engine);
+  MultiCore::Intervals intervals = MultiCore::buildIntervals(nb_tasks, nb_chunks);
+  getInstance().run(intervals.size(), [&task, &intervals, &engines](int job_id)
+                    {
+                      task(intervals[job_id].first, intervals[job_id].second,
+                           &(engines[job_id]));
+                    },
+                    nb_threads);
+}
+
+void WorkerPool::workerLoop(int worker_id)
+{
+  current_worker_id = worker_id;
+  while (true) {
+    long seen_version = getVersion();
+    Entry entry;
+    if (takeEntry(worker_id, &entry)) {
+      execute(entry);
+      continue;
+    }
+    std::unique_lock<std::mutex> lock(sleep_mutex);
+    if (stop && nb_pending == 0) return;
+    cond.wait(lock, [this, seen_version]() { return stop || version != seen_version; });
+    if (stop && nb_pending == 0) return;
+  }
+}
+
+bool WorkerPool::takeEntry(int worker_id, Entry * entry)
+{
+  if (nb_pending == 0) return false;
+  // Own queue: most recent job first
+  if (worker_id >= 0 && popEntry(*(queues[worker_id]), true, entry)) {
+    return true;
+  }
+  // Shared queue: oldest job first
+  if (popEntry(shared_queue, false, entry)) {
+    return true;
+  }
+  // Stealing the oldest job of the other workers
+  int current_nb_workers = nb_workers;
+  for (int offset = 1; offset <= current_nb_workers; offset++) {
+    int victim_id = (std::max(worker_id, 0) + offset) % current_nb_workers;
+    if (victim_id == worker_id) continue;
+    if (popEntry(*(queues[victim_id]), false, entry)) {
+      return true;
+    }
+  }
+  return false;
+}
+
+bool WorkerPool::popEntry(JobQueue & queue, bool from_back, Entry * entry)
+{
+  std::unique_lock<std::mutex> lock(queue.mutex);
+  int nb_entries = queue.entries.size();
+  for (int i = 0; i < nb_entries; i++) {
+    int idx = from_back ? nb_entries - 1 - i : i;
+    *entry = queue.entries[idx];
+    if (claim(entry)) {
+      queue.entries.erase(queue.entries.begin() + idx);
+      nb_pending--;
+      return true;
+    }
+  }
+  return false;
+}
+
+bool WorkerPool::claim(Entry * entry)
+{
+  Batch * batch = entry->batch;
+  // The submitting thread is already counted
+  if (batch->owner == std::this_thread::get_id()) {
+    entry->counted = false;
+    return true;
+  }
+  int nb_participants = batch->nb_participants;
+  while (nb_participants < batch->max_participants) {
+    if (batch->nb_participants.compare_exchange_weak(nb_participants, nb_participants + 1)) {
+      entry->counted = true;
+      return true;
+    }
+  }
+  return false;
+}
+
+void WorkerPool::execute(const Entry & entry)
+{
+  Batch * batch = entry.batch;
+  try {
+    batch->job(entry.job_id);
+  }
+  catch (...) {
+    std::unique_lock<std::mutex> lock(batch->error_mutex);
+    if (!batch->error) {
+      batch->error = std::current_exception();
+    }
+  }
+  // The participant leaves before the job is marked as ended, since batch
+  // might be destroyed as soon as nb_remaining reaches 0
+  if (entry.counted) {
+    batch->nb_participants--;
+  }
+  int nb_remaining = --(batch->nb_remaining);
+  // Either the batch is over or a slot has been released for its other jobs
+  if (nb_remaining == 0 || entry.counted) {
+    notifyAll();
+  }
+}
+
+void WorkerPool::notifyAll()
+{
+  // Locking ensures that threads checking their wake-up condition are either
+  // already waiting or will see the new state
+  {
+    std::unique_lock<std::mutex> lock(sleep_mutex);
+    version++;
+  }
+  cond.notify_all();
+}
+
+long WorkerPool::getVersion()
+{
+  std::unique_lock<std::mutex> lock(sleep_mutex);
+  return version;
+}
+
+}
@@ -1,10 +1,20 @@
 #include "rosban_csa_mdp/knownness/knownness_forest.h"
 
+#include "rosban_csa_mdp/core/binary_io.h"
+#include "rosban_csa_mdp/core/worker_pool.h"
+
+#include "rosban_utils/multi_core.h"
+
+#include <algorithm>
+#include <atomic>
+#include <iostream>
+#include <sstream>
+
 namespace csa_mdp
 {
 
 KnownnessForest::Config::Config()
-  : nb_trees(25), tree_conf()
+  : nb_trees(25), tree_conf(), nb_threads(1), async(false)
 {
 }
 
@@ -17,62 +27,176 @@ void KnownnessForest::Config::to_xml(std::ostream &out) const
 {
   rosban_utils::xml_tools::write<int>("nb_trees", nb_trees, out);
   tree_conf.write("tree_conf", out);
+  rosban_utils::xml_tools::write<int>("nb_threads", nb_threads, out);
+  rosban_utils::xml_tools::write<bool>("async", async, out);
 }
 
 void KnownnessForest::Config::from_xml(TiXmlNode *node)
 {
   nb_trees = rosban_utils::xml_tools::read<int>(node, "nb_trees");
   tree_conf.tryRead(node, "tree_conf");
+  rosban_utils::xml_tools::try_read<int>(node, "nb_threads", nb_threads);
+  rosban_utils::xml_tools::try_read<bool>(node, "async", async);
 }
 
 KnownnessForest::KnownnessForest()
+  : trees(new TreeSet()), nb_threads(1), async(false),
+    applying_batch(false), stop(false)
 {
 }
 
 KnownnessForest::KnownnessForest(const Eigen::MatrixXd &space,
                                  const Config &conf)
+  : trees(new TreeSet()), nb_threads(std::max(1, conf.nb_threads)), async(conf.async),
+    applying_batch(false), stop(false)
 {
   for (int tree = 0; tree < conf.nb_trees; tree++)
   {
-    trees.push_back(KnownnessTree(space, conf.tree_conf));
+    trees->push_back(KnownnessTree(space, conf.tree_conf));
+  }
+}
+
+KnownnessForest::~KnownnessForest()
+{
+  {
+    std::unique_lock<std::mutex> lock(queue_mutex);
+    stop = true;
+  }
+  queue_cond.notify_all();
+  if (insertion_thread.joinable())
+  {
+    insertion_thread.join();
   }
 }
 
 void KnownnessForest::push(const Eigen::VectorXd &point)
 {
-  for (KnownnessTree &tree : trees)
+  pushBatch({point});
+}
+
+void KnownnessForest::pushBatch(const std::vector<Eigen::VectorXd> &points)
+{
+  if (points.size() == 0) return;
+  if (!async)
+  {
+    applyBatch(points);
+    return;
+  }
+  {
+    std::unique_lock<std::mutex> lock(queue_mutex);
+    pending_points.insert(pending_points.end(), points.begin(), points.end());
+    // The background thread is started on first use
+    if (!insertion_thread.joinable())
+    {
+      insertion_thread = std::thread(&KnownnessForest::insertionLoop, this);
+    }
+  }
+  queue_cond.notify_all();
+}
+
+void KnownnessForest::flush() const
+{
+  if (!async) return;
+  std::unique_lock<std::mutex> lock(queue_mutex);
+  queue_cond.wait(lock, [this]() { return pending_points.size() == 0 && !applying_batch; });
+}
+
+void KnownnessForest::applyBatch(const std::vector<Eigen::VectorXd> &points)
+{
+  if (!async)
   {
-    // Adding a point can throw a std::runtime_error in two cases:
-    // 1. The point is outside of the tree space (in this case it will be refused by all trees)
-    // 2. The random split fails because all points have the same coordinate along the chosen dimension
-    // In both case, we choose to 'forget' about this case
+    insertPoints(points, trees.get());
+    return;
+  }
+  // Readers keep using the current snapshot while the batch is inserted in a
+  // copy of the trees, the copy is then published atomically
+  std::shared_ptr<TreeSet> new_trees(new TreeSet(*getSnapshot()));
+  insertPoints(points, new_trees.get());
+  std::atomic_store(&trees, new_trees);
+}
+
+void KnownnessForest::insertPoints(const std::vector<Eigen::VectorXd> &points,
+                                   TreeSet * target) const
+{
+  // Each tree receives all the points in order, trees are independent
+  rosban_utils::MultiCore::Task task = [&](int start, int end)
+    {
+      for (int tree_id = start; tree_id < end; tree_id++)
+      {
+        for (const Eigen::VectorXd &point : points)
+        {
+          // Adding a point can throw a std::runtime_error in two cases:
+          // 1. The point is outside of the tree space (in this case it will be refused by all trees)
+          // 2. The random split fails because all points have the same coordinate along the chosen dimension
+          // In both case, we choose to 'forget' about this case
+          try
+          {
+            (*target)[tree_id].push(point);
+          }
+          catch (const std::runtime_error & exc)
+          {
+            std::cerr << exc.what() << std::endl;
+          }
+        }
+      }
+    };
+  WorkerPool::runParallelTask(task, target->size(), nb_threads);
+}
+
+std::shared_ptr<const KnownnessForest::TreeSet> KnownnessForest::getSnapshot() const
+{
+  if (!async) return trees;
+  return std::atomic_load(&trees);
+}
+
+void KnownnessForest::insertionLoop()
+{
+  std::unique_lock<std::mutex> lock(queue_mutex);
+  while (true)
+  {
+    queue_cond.wait(lock, [this]() { return stop || pending_points.size() > 0; });
+    if (pending_points.size() == 0)
+    {
+      // stop has been requested and all the points have been inserted
+      return;
+    }
+    std::vector<Eigen::VectorXd> batch;
+    batch.swap(pending_points);
+    applying_batch = true;
+    lock.unlock();
     try
     {
-      tree.push(point);
+      applyBatch(batch);
     }
-    catch (const std::runtime_error & exc)
+    catch (const std::exception & exc)
     {
-      std::cerr << exc.what() << std::endl;
+      std::cerr << "KnownnessForest::insertionLoop: " << exc.what() << std::endl;
     }
+    lock.lock();
+    applying_batch = false;
+    queue_cond.notify_all();
   }
 }
 
 /// Get the knownness value at the given point
 double KnownnessForest::getValue(const Eigen::VectorXd &point) const
 {
+  // All the trees are read from the same snapshot, batches applied in the
+  // meantime do not modify it
+  std::shared_ptr<const TreeSet> snapshot = getSnapshot();
   double sum = 0;
-  for (const KnownnessTree &tree : trees)
+  for (const KnownnessTree &tree : *snapshot)
   {
-    double tree_value = tree.getValue(point);
-    sum += tree_value;
+    sum += tree.getValue(point);
   }
-  return sum / trees.size();
+  return sum / snapshot->size();
 }
 
 std::unique_ptr<regression_forests::Forest> KnownnessForest::convertToRegressionForest() const
 {
+  flush();
   std::unique_ptr<regression_forests::Forest> forest(new regression_forests::Forest);
-  for (const KnownnessTree &tree : trees)
+  for (const KnownnessTree &tree : *getSnapshot())
   {
     forest->push(tree.convertToRegTree());
   }
@@ -81,10 +205,41 @@ std::unique_ptr<regression_forests::Forest> KnownnessForest::convertToRegression
 
 void KnownnessForest::checkConsistency()
 {
-  for (KnownnessTree &tree : trees)
+  flush();
+  for (const KnownnessTree &tree : *getSnapshot())
   {
     tree.checkConsistency();
   }
 }
 
+void KnownnessForest::write(std::ostream &out) const
+{
+  flush();
+  std::shared_ptr<const TreeSet> snapshot = getSnapshot();
+  binary_io::write<int32_t>(out, snapshot->size());
+  for (const KnownnessTree &tree : *snapshot)
+  {
+    tree.write(out);
+  }
+}
+
+void KnownnessForest::read(std::istream &in)
+{
+  flush();
+  // Trees are read in a copy, thus the forest is unchanged if reading fails
+  std::shared_ptr<TreeSet> new_trees(new TreeSet(*getSnapshot()));
+  int nb_trees = binary_io::read<int32_t>(in);
+  if (nb_trees != (int)new_trees->size()) {
+    std::ostringstream oss;
+    oss << "KnownnessForest::read: read " << nb_trees << " trees while forest has "
+        << new_trees->size() << " trees";
+    throw std::runtime_error(oss.str());
+  }
+  for (KnownnessTree &tree : *new_trees)
+  {
+    tree.read(in);
+  }
+  std::atomic_store(&trees, new_trees);
+}
+
 }
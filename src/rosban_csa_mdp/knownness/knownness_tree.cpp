@@ -1,5 +1,7 @@
 #include "rosban_csa_mdp/knownness/knownness_tree.h"
 
+#include "rosban_csa_mdp/core/binary_io.h"
+
 #include "rosban_regression_forests/approximations/pwc_approximation.h"
 #include "rosban_random/tools.h"
 #include "rosban_regression_forests/tools/statistics.h"
@@ -37,6 +39,14 @@ void KnownnessTree::Config::from_xml(TiXmlNode *node)
   }
 }
 
+/// The buffer is reused by all the trees used on the current thread, it is
+/// only reallocated when the dimension of the space changes
+static Eigen::MatrixXd & getLeafSpaceBuffer()
+{
+  static thread_local Eigen::MatrixXd leaf_space;
+  return leaf_space;
+}
+
 KnownnessTree::KnownnessTree(const Eigen::MatrixXd& space,
                              const Config &conf_)
   : tree(space), conf(conf_), nb_points(0), next_split_dim(0)
@@ -60,10 +70,10 @@ void KnownnessTree::push(const Eigen::VectorXd& point)
     }
   }
   // Pushing point
-  kd_trees::KdNode * leafNode = tree.getLeaf(point);
-  Eigen::MatrixXd leaf_space = tree.getSpace(point);
-  leafNode->push(point);
-  int leafCount = leafNode->getPoints().size();
+  Eigen::MatrixXd & leaf_space = getLeafSpaceBuffer();
+  int leaf = tree.getLeafWithSpace(point, &leaf_space);
+  tree.push(leaf, point);
+  int leafCount = tree.getNbPoints(leaf);
   if (leafCount > conf.max_points) {
     int split_dim = -1;
     double split_val = 0;
@@ -83,9 +93,10 @@ void KnownnessTree::push(const Eigen::VectorXd& point)
           double s_val_max = std::numeric_limits<double>::lowest();
           double s_val_min = std::numeric_limits<double>::max();
           // Finding min and max points along this dimension
-          for (const auto & p : leafNode->getPoints())
+          const double * leaf_values = tree.getCoordinates(leaf, dim);
+          for (int i = 0; i < leafCount; i++)
           {
-            double val = p(dim);
+            double val = leaf_values[i];
             if (val < s_val_min) s_val_min = val;
             if (val > s_val_max) s_val_max = val; 
           }
@@ -98,9 +109,9 @@ void KnownnessTree::push(const Eigen::VectorXd& point)
           if (curr_split_val == s_val_max) continue;
           // Gathering points
           std::vector<double> values, lower_values, upper_values;
-          for (const auto & p : leafNode->getPoints())
+          for (int i = 0; i < leafCount; i++)
           {
-            double val = p(dim);
+            double val = leaf_values[i];
             values.push_back(val);
             if (val <= curr_split_val)
             {
@@ -137,20 +148,20 @@ void KnownnessTree::push(const Eigen::VectorXd& point)
         }
         if (split_dim < 0)
         {
-          leafNode->pop_back();
+          tree.popBack(leaf);
           return;
           //std::ostringstream oss;
           //oss << "No split candidate found: Points:" << std::endl;
-          //for (const auto & p : leafNode->getPoints())
+          //for (int i = 0; i < leafCount; i++)
           //{
-          //  oss << "\t" << p.transpose() << std::endl;
+          //  oss << "\t" << tree.getPoint(leaf, i).transpose() << std::endl;
           //}
           //throw std::runtime_error(oss.str());
         }
       }
     }
     // Apply split
-    leafNode->split(split_dim, split_val);
+    tree.split(leaf, split_dim, split_val);
     next_split_dim++;
     if (next_split_dim == leaf_space.rows()) { next_split_dim = 0;}
   }
@@ -165,9 +176,9 @@ double KnownnessTree::getMu() const
 
 double KnownnessTree::getValue(const Eigen::VectorXd& point) const
 {
-  const kd_trees::KdNode * leaf = tree.getLeaf(point);
-  int leaf_count = leaf->getPoints().size();
-  Eigen::MatrixXd leaf_space = tree.getSpace(point);
+  Eigen::MatrixXd & leaf_space = getLeafSpaceBuffer();
+  int leaf = tree.getLeafWithSpace(point, &leaf_space);
+  int leaf_count = tree.getNbPoints(leaf);
   return getValue(leaf_space, leaf_count);
 }
 
@@ -214,34 +225,34 @@ double KnownnessTree::getValue(const Eigen::MatrixXd& space,
   throw std::runtime_error("Unhandled type for knownness tree");
 }
 
-regression_forests::Node * KnownnessTree::convertToRegNode(const kd_trees::KdNode *node,
+regression_forests::Node * KnownnessTree::convertToRegNode(int node,
                                                            Eigen::MatrixXd &space) const
 {
-  if (node == NULL) return NULL;
+  if (node < 0) return NULL;
   regression_forests::Node * new_node = new regression_forests::Node();
   // Leaf case
-  if (node->isLeaf())
+  if (tree.isLeaf(node))
   {
-    int nb_points = node->getPoints().size();
+    int nb_points = tree.getNbPoints(node);
     double value = getValue(space, nb_points);
     new_node->a = std::unique_ptr<Approximation>(new regression_forests::PWCApproximation(value));
     return new_node;
   }
   // Node case
-  double split_dim = node->getSplitDim();
-  double split_val = node->getSplitVal();
+  int split_dim = tree.getSplitDim(node);
+  double split_val = tree.getSplitVal(node);
   double old_min = space(split_dim, 0);
   double old_max = space(split_dim, 1);
   // Update split
-  new_node->s.dim = node->getSplitDim();
-  new_node->s.val = node->getSplitVal();
+  new_node->s.dim = split_dim;
+  new_node->s.val = split_val;
   // Update lower child
   space(split_dim, 1) = split_val;
-  new_node->lowerChild = convertToRegNode(node->getLowerChild(), space);
+  new_node->lowerChild = convertToRegNode(tree.getLowerChild(node), space);
   space(split_dim, 1) = old_max;
   // Update upper child
   space(split_dim, 0) = split_val;
-  new_node->upperChild = convertToRegNode(node->getUpperChild(), space);
+  new_node->upperChild = convertToRegNode(tree.getUpperChild(node), space);
   space(split_dim, 0) = old_min;
   return new_node;
 }
@@ -254,13 +265,13 @@ std::unique_ptr<regression_forests::Tree> KnownnessTree::convertToRegTree() cons
   return reg_tree;
 }
 
-void KnownnessTree::checkConsistency()
+void KnownnessTree::checkConsistency() const
 {
-  std::vector<kd_trees::KdNode *> leaves = tree.getLeaves();
+  std::vector<int> leaves = tree.getLeaves();
   int leaf_points = 0;
-  for (kd_trees::KdNode * leaf : leaves)
+  for (int leaf : leaves)
   {
-    leaf_points += leaf->getPoints().size();
+    leaf_points += tree.getNbPoints(leaf);
   }
   if (leaf_points != nb_points) {
     std::ostringstream oss;
@@ -270,6 +281,76 @@ void KnownnessTree::checkConsistency()
   }
 }
 
+void KnownnessTree::write(std::ostream &out) const
+{
+  binary_io::write<int32_t>(out, tree.dim());
+  binary_io::write<int32_t>(out, nb_points);
+  binary_io::write<int32_t>(out, next_split_dim);
+  writeNode(out, tree.getRoot());
+}
+
+void KnownnessTree::read(std::istream &in)
+{
+  int root = tree.getRoot();
+  if (!tree.isLeaf(root) || tree.getNbPoints(root) > 0) {
+    throw std::logic_error("KnownnessTree::read: tree is not empty");
+  }
+  int dims = binary_io::read<int32_t>(in);
+  if (dims != tree.dim()) {
+    std::ostringstream oss;
+    oss << "KnownnessTree::read: dimension mismatch: read " << dims
+        << " while " << tree.dim() << " was expected";
+    throw std::runtime_error(oss.str());
+  }
+  nb_points = binary_io::read<int32_t>(in);
+  next_split_dim = binary_io::read<int32_t>(in);
+  readNode(in, tree.getRoot());
+}
+
+void KnownnessTree::writeNode(std::ostream &out, int node) const
+{
+  if (tree.isLeaf(node)) {
+    binary_io::write<int32_t>(out, -1);
+    int nb_leaf_points = tree.getNbPoints(node);
+    binary_io::write<int32_t>(out, nb_leaf_points);
+    for (int i = 0; i < nb_leaf_points; i++) {
+      Eigen::VectorXd point = tree.getPoint(node, i);
+      out.write((const char *)point.data(), point.rows() * sizeof(double));
+    }
+    return;
+  }
+  binary_io::write<int32_t>(out, tree.getSplitDim(node));
+  binary_io::write<double>(out, tree.getSplitVal(node));
+  writeNode(out, tree.getLowerChild(node));
+  writeNode(out, tree.getUpperChild(node));
+}
+
+void KnownnessTree::readNode(std::istream &in, int node)
+{
+  int dims = tree.dim();
+  int split_dim = binary_io::read<int32_t>(in);
+  if (split_dim < 0) {
+    int nb_leaf_points = binary_io::read<int32_t>(in);
+    Eigen::VectorXd point(dims);
+    for (int i = 0; i < nb_leaf_points; i++) {
+      in.read((char *)point.data(), dims * sizeof(double));
+      if (!in.good()) {
+        throw std::runtime_error("KnownnessTree::read: unexpected end of stream");
+      }
+      tree.push(node, point);
+    }
+    return;
+  }
+  if (split_dim >= dims) {
+    throw std::runtime_error("KnownnessTree::read: invalid split dimension");
+  }
+  double split_val = binary_io::read<double>(in);
+  // Points are only stored in leaves, children are empty after the split
+  tree.split(node, split_dim, split_val);
+  readNode(in, tree.getLowerChild(node));
+  readNode(in, tree.getUpperChild(node));
+}
+
 std::string to_string(KnownnessTree::Type type)
 {
   switch (type)
@@ -1,5 +1,8 @@
 #include "rosban_csa_mdp/reward_predictors/monte_carlo_predictor.h"
 
+#include "rosban_csa_mdp/core/rollout_engine.h"
+#include "rosban_csa_mdp/core/worker_pool.h"
+
 #include "rosban_regression_forests/tools/statistics.h"
 
 #include "rosban_random/tools.h"
@@ -23,6 +26,19 @@ void MonteCarloPredictor::predict(const Eigen::VectorXd & input,
                                   double * mean,
                                   double * var,
                                   std::default_random_engine * engine)
+{
+  predict(input, policy, Problem::toBatchResultFunction(result_function),
+          value_function, discount, mean, var, engine);
+}
+
+void MonteCarloPredictor::predict(const Eigen::VectorXd & input,
+                                  const Policy & policy,
+                                  Problem::BatchResultFunction result_function,
+                                  Problem::ValueFunction value_function,
+                                  double discount,
+                                  double * mean,
+                                  double * var,
+                                  std::default_random_engine * engine)
 {
   std::vector<double> rewards(nb_predictions);
   // Preparing function:
@@ -33,7 +49,7 @@ void MonteCarloPredictor::predict(const Eigen::VectorXd & input,
   std::vector<std::default_random_engine> engines;
   engines = rosban_random::getRandomEngines(std::min(nb_threads, nb_predictions), engine);
   // Now filling reward in parallel
-  MultiCore::runParallelStochasticTask(prediction_task, nb_predictions, &engines);
+  WorkerPool::runParallelStochasticTask(prediction_task, nb_predictions, &engines);
   double internal_mean = regression_forests::Statistics::mean(rewards);
   if (mean != nullptr) *mean = internal_mean;
   if (var != nullptr) *var = regression_forests::Statistics::variance(rewards);
@@ -42,7 +58,7 @@ void MonteCarloPredictor::predict(const Eigen::VectorXd & input,
 MonteCarloPredictor::RPTask
 MonteCarloPredictor::getTask(const Eigen::VectorXd & input,
                              const Policy & policy,
-                             Problem::ResultFunction result_function,
+                             Problem::BatchResultFunction result_function,
                              Problem::ValueFunction value_function,
                              double discount,
                              std::vector<double> & rewards)
@@ -51,26 +67,15 @@ MonteCarloPredictor::getTask(const Eigen::VectorXd & input,
           discount, &rewards]
     (int start_idx, int end_idx, std::default_random_engine * engine)
     {
-      for (int prediction = start_idx; prediction < end_idx; prediction++)
-      {
-        double coeff = 1;
-        double reward = 0;
-        Eigen::VectorXd state = input;
-        bool is_terminated = false;
-        // Compute the reward over the next 'nb_steps'
-        for (int i = 0; i < nb_steps; i++) {
-          Eigen::VectorXd action = policy.getAction(state, engine);
-          Problem::Result result = result_function(state, action, engine);
-          reward += coeff * result.reward;
-          state = result.successor;
-          coeff *= discount;
-          is_terminated = result.terminal;
-          // Stop predicting steps if a terminal state has been reached
-          if (is_terminated) break;
-        }
-        // Use the value function to estimate long time reward (if not terminated)
-        if (!is_terminated) reward += coeff * value_function(state);
-        rewards[prediction] = reward;
+      int nb_rollouts = end_idx - start_idx;
+      if (nb_rollouts <= 0) return;
+      // All the trajectories of the chunk are simulated simultaneously
+      RolloutEngine rollout_engine(result_function);
+      rollout_engine.run(input.replicate(1, nb_rollouts), policy, nb_steps, discount, engine);
+      // Use the value function to estimate long time reward (if not terminated)
+      rollout_engine.addFinalValues(value_function);
+      for (int i = 0; i < nb_rollouts; i++) {
+        rewards[start_idx + i] = rollout_engine.getRewards()(i);
       }
     };
 }
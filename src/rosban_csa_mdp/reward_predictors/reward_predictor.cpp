@@ -6,6 +6,19 @@ namespace csa_mdp
 RewardPredictor::RewardPredictor() : nb_threads(1) {}
 RewardPredictor::~RewardPredictor() {}
 
+void RewardPredictor::predict(const Eigen::VectorXd & input,
+                              const Policy & policy,
+                              Problem::BatchResultFunction result_function,
+                              Problem::ValueFunction value_function,
+                              double discount,
+                              double * mean,
+                              double * var,
+                              std::default_random_engine * engine)
+{
+  predict(input, policy, Problem::toResultFunction(result_function),
+          value_function, discount, mean, var, engine);
+}
+
 void RewardPredictor::setNbThreads(int new_nb_threads)
 {
   nb_threads = new_nb_threads;
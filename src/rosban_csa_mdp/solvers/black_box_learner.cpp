@@ -1,6 +1,8 @@
 #include "rosban_csa_mdp/solvers/black_box_learner.h"
 
 #include "rosban_csa_mdp/core/problem_factory.h"
+#include "rosban_csa_mdp/core/rollout_engine.h"
+#include "rosban_csa_mdp/core/worker_pool.h"
 
 #include "rosban_random/tools.h"
 #include "rosban_utils/multi_core.h"
@@ -50,9 +52,6 @@ double BlackBoxLearner::evaluatePolicy(const Policy & p,
                                        int nb_evaluations,
                                        std::default_random_engine * engine,
                                        std::vector<Eigen::VectorXd> * visited_states) const {
-  // Preparing random_engines
-  std::vector<std::default_random_engine> engines;
-  engines = rosban_random::getRandomEngines(std::min(nb_threads, nb_evaluations), engine);
   // Rewards + visited_states are computed by different threads and stored in the same vector
   Eigen::VectorXd rewards = Eigen::VectorXd::Zero(nb_evaluations);
   std::vector<std::vector<Eigen::VectorXd>> visited_states_per_thread(nb_evaluations);
@@ -62,25 +61,23 @@ double BlackBoxLearner::evaluatePolicy(const Policy & p,
     [this, &p, &rewards, &visited_states_per_thread, store_visited_states]
     (int start_idx, int end_idx, std::default_random_engine * engine)
     {
+      if (end_idx <= start_idx) return;
+      Eigen::MatrixXd initial_states(problem->stateDims(), end_idx - start_idx);
       for (int idx = start_idx; idx < end_idx; idx++) {
-        Eigen::VectorXd state = problem->getStartingState(engine);
-        double gain = 1.0;
-        for (int step = 0; step < trial_length; step++) {
-          if (store_visited_states) {
-            visited_states_per_thread[idx].push_back(state);
-          }
-          Eigen::VectorXd action = p.getAction(state, engine);
-          Problem::Result result = problem->getSuccessor(state, action, engine);
-          double step_reward = result.reward;
-          state = result.successor;
-          rewards(idx) += gain * step_reward;
-          gain = gain * discount;
-          if (result.terminal) break;
+        initial_states.col(idx - start_idx) = problem->getStartingState(engine);
+      }
+      std::vector<std::vector<Eigen::VectorXd>> chunk_visited_states;
+      rewards.segment(start_idx, end_idx - start_idx) =
+        simulateRollouts(p, initial_states, engine,
+                         store_visited_states ? &chunk_visited_states : nullptr);
+      if (store_visited_states) {
+        for (int idx = start_idx; idx < end_idx; idx++) {
+          visited_states_per_thread[idx].swap(chunk_visited_states[idx - start_idx]);
         }
       }
     };
-  // Running computation
-  rosban_utils::MultiCore::runParallelStochasticTask(task, nb_evaluations, &engines);
+  // Running computation, rollouts have heterogeneous durations
+  WorkerPool::runBalancedStochasticTask(task, nb_evaluations, nb_threads, engine);
   // Fill visited states if required
   if (store_visited_states) {
     for (const std::vector<Eigen::VectorXd> & eval_visited_states : visited_states_per_thread) {
@@ -107,22 +104,12 @@ double BlackBoxLearner::localEvaluation(const Policy & p,
     {
       // 1: Generating states
       int thread_evaluations = end_idx - start_idx;
-      std::vector<Eigen::VectorXd> starting_states;
-      starting_states = rosban_random::getUniformSamples(space, thread_evaluations, engine);
+      Eigen::MatrixXd starting_states;
+      starting_states = rosban_random::getUniformSamplesMatrix(space, thread_evaluations, engine);
       // 2: Simulating trajectories
       try {
-        for (int idx = 0; idx < thread_evaluations; idx++) {
-          Eigen::VectorXd state = starting_states[idx];
-          double gain = 1.0;
-          for (int step = 0; step < trial_length; step++) {
-            Eigen::VectorXd action = p.getAction(state, engine);
-            Problem::Result result = problem->getSuccessor(state, action, engine);
-            state = result.successor;
-            rewards(idx + start_idx) += gain * result.reward;
-            gain = gain * discount;
-            if (result.terminal) break;
-          }
-        }
+        rewards.segment(start_idx, thread_evaluations) =
+          simulateRollouts(p, starting_states, engine);
       }
       catch (const std::runtime_error & exc) {
         std::ostringstream oss;
@@ -131,11 +118,8 @@ double BlackBoxLearner::localEvaluation(const Policy & p,
         throw exc;
       }
     };
-  // Preparing random_engines
-  std::vector<std::default_random_engine> engines;
-  engines = rosban_random::getRandomEngines(std::min(nb_threads, nb_evaluations), engine);
-  // Running computation
-  rosban_utils::MultiCore::runParallelStochasticTask(task, nb_evaluations, &engines);
+  // Running computation, rollouts have heterogeneous durations
+  WorkerPool::runBalancedStochasticTask(task, nb_evaluations, nb_threads, engine);
   // Result
   return rewards.mean();
 }
@@ -153,28 +137,52 @@ double BlackBoxLearner::evaluation(const Policy & p,
     (int start_idx, int end_idx, std::default_random_engine * engine)
     {
       // Simulating trajectories
+      if (end_idx <= start_idx) return;
+      Eigen::MatrixXd chunk_states(problem->stateDims(), end_idx - start_idx);
       for (int idx = start_idx; idx < end_idx; idx++) {
-        Eigen::VectorXd state = initial_states[idx];
-        double gain = 1.0;
-        for (int step = 0; step < trial_length; step++) {
-          Eigen::VectorXd action = p.getAction(state, engine);
-          Problem::Result result = problem->getSuccessor(state, action, engine);
-          state = result.successor;
-          rewards(idx) += gain * result.reward;
-          gain = gain * discount;
-          if (result.terminal) break;
-        }
+        chunk_states.col(idx - start_idx) = initial_states[idx];
       }
+      rewards.segment(start_idx, end_idx - start_idx) =
+        simulateRollouts(p, chunk_states, engine);
     };
-  // Preparing random_engines
-  std::vector<std::default_random_engine> engines;
-  engines = rosban_random::getRandomEngines(std::min(nb_threads, nb_evaluations), engine);
-  // Running computation
-  rosban_utils::MultiCore::runParallelStochasticTask(task, nb_evaluations, &engines);
+  // Running computation, rollouts have heterogeneous durations
+  WorkerPool::runBalancedStochasticTask(task, nb_evaluations, nb_threads, engine);
   // Result
   return rewards.mean();
 }
 
+Eigen::VectorXd BlackBoxLearner::simulateRollouts(
+  const Policy & p,
+  const Eigen::MatrixXd & initial_states,
+  std::default_random_engine * engine,
+  std::vector<std::vector<Eigen::VectorXd>> * visited_states) const
+{
+  int nb_rollouts = initial_states.cols();
+  if (problem->hasAllocationFreeRollouts(p)) {
+    Eigen::VectorXd rewards(nb_rollouts);
+    if (visited_states != nullptr) {
+      visited_states->clear();
+      visited_states->resize(nb_rollouts);
+    }
+    for (int idx = 0; idx < nb_rollouts; idx++) {
+      std::vector<Eigen::VectorXd> * idx_visited_states = nullptr;
+      if (visited_states != nullptr) {
+        idx_visited_states = &((*visited_states)[idx]);
+      }
+      rewards(idx) = problem->sampleRolloutReward(initial_states.col(idx), p, trial_length,
+                                                  discount, engine, idx_visited_states);
+    }
+    return rewards;
+  }
+  RolloutEngine rollout_engine(*problem);
+  rollout_engine.setRecordVisitedStates(visited_states != nullptr);
+  rollout_engine.run(initial_states, p, trial_length, discount, engine);
+  if (visited_states != nullptr) {
+    *visited_states = rollout_engine.getVisitedStates();
+  }
+  return rollout_engine.getRewards();
+}
+
 void BlackBoxLearner::setNbThreads(int nb_threads_)
 {
   nb_threads = nb_threads_;
@@ -1,16 +1,24 @@
 #include "rosban_csa_mdp/solvers/fpf.h"
 
+#include "rosban_csa_mdp/core/binary_io.h"
+#include "rosban_csa_mdp/core/worker_pool.h"
+
 #include "rosban_gp/gradient_ascent/randomized_rprop.h"
 
+#include "rosban_regression_forests/approximations/pwc_approximation.h"
+
 #include "rosban_random/tools.h"
 
 #include "rosban_utils/benchmark.h"
 #include "rosban_utils/multi_core.h"
+#include "rosban_utils/time_stamp.h"
 
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <fstream>
 #include <iostream>
-#include <mutex>
 #include <sstream>
-#include <thread>
 
 using rosban_utils::Benchmark;
 using rosban_utils::MultiCore;
@@ -18,6 +26,8 @@ using rosban_utils::TimeStamp;
 
 using regression_forests::Approximation;
 using regression_forests::ExtraTrees;
+using regression_forests::Forest;
+using regression_forests::PWCApproximation;
 using regression_forests::TrainingSet;
 
 
@@ -26,6 +36,22 @@ using namespace rosban_utils::xml_tools;//Read and writes
 namespace csa_mdp
 {
 
+const char FPF::checkpoint_magic[8] = {'C','S','A','F','P','F','C','K'};
+const uint32_t FPF::checkpoint_version = 4;
+
+/// FNV-1a hash of the given bytes, 'hash' is updated
+static void hashBytes(uint64_t * hash, const void * data, size_t nb_bytes)
+{
+  const unsigned char * bytes = (const unsigned char *)data;
+  for (size_t i = 0; i < nb_bytes; i++) {
+    *hash ^= bytes[i];
+    *hash *= 1099511628211ull;
+  }
+}
+
+/// Initial value of FNV-1a hashes
+static const uint64_t fnv_offset = 14695981039346656037ull;
+
 FPF::Config::Config()
 {
   nb_threads = 1;
@@ -34,14 +60,24 @@ FPF::Config::Config()
   horizon = 1;
   discount = 0.99;
   max_action_tiles = 0;
+  max_query_tiles = 0;
   policy_samples = 0;
   q_training_set_time = 0;
   q_extra_trees_time  = 0;
   p_training_set_time = 0;
   p_extra_trees_time  = 0;
+  residual_tolerance = 0;
+  time_budget = 0;
+  q_nb_iterations = 0;
+  budget_exhausted = false;
+  checkpoint_resumed = false;
   auto_parameters = true;
   gp_values = false;
   gp_policies = false;
+  warm_start = false;
+  sample_precision = SampleStore::Precision::Double;
+  checkpoint_prefix = "";
+  resume = false;
 }
 
 const Eigen::MatrixXd & FPF::Config::getStateLimits() const
@@ -96,6 +132,9 @@ void FPF::Config::to_xml(std::ostream &out) const
   rosban_utils::xml_tools::write<double>("discount", discount, out);
   rosban_utils::xml_tools::write<int>("policy_samples", policy_samples, out);
   rosban_utils::xml_tools::write<int>("max_action_tiles", max_action_tiles, out);
+  rosban_utils::xml_tools::write<int>("max_query_tiles", max_query_tiles, out);
+  rosban_utils::xml_tools::write<double>("residual_tolerance", residual_tolerance, out);
+  rosban_utils::xml_tools::write<double>("time_budget", time_budget, out);
   rosban_utils::xml_tools::write<bool>("auto_parameters", auto_parameters, out);
   if (!auto_parameters)
   {
@@ -104,6 +143,14 @@ void FPF::Config::to_xml(std::ostream &out) const
   }
   rosban_utils::xml_tools::write<bool>("gp_values", gp_values, out);
   rosban_utils::xml_tools::write<bool>("gp_policies", gp_policies, out);
+  rosban_utils::xml_tools::write<bool>("warm_start", warm_start, out);
+  rosban_utils::xml_tools::write<std::string>("sample_precision",
+                                              to_string(sample_precision), out);
+  if (subsampler_conf.isActive()) {
+    subsampler_conf.write("subsampler_conf", out);
+  }
+  rosban_utils::xml_tools::write<std::string>("checkpoint_prefix", checkpoint_prefix, out);
+  rosban_utils::xml_tools::write<bool>("resume", resume, out);
   if (gp_values) {
     find_max_rprop_conf.write("find_max_rprop_conf", out);
   }
@@ -112,6 +159,31 @@ void FPF::Config::to_xml(std::ostream &out) const
   }
 }
 
+void FPF::Config::writeQValueParameters(std::ostream &out) const
+{
+  // Threads, time budget, checkpoints and policy parameters do not influence
+  // the q_value
+  out.precision(17);
+  out << horizon << " " << discount << " " << max_query_tiles << " "
+      << residual_tolerance << " " << auto_parameters << " " << gp_values << " "
+      << warm_start << " " << to_string(sample_precision) << std::endl;
+  Eigen::MatrixXd limits = getInputLimits();
+  for (int idx = 0; idx < limits.size(); idx++) {
+    out << limits.data()[idx] << " ";
+  }
+  out << std::endl;
+  if (!auto_parameters) {
+    q_value_conf.write("q_value_conf", out);
+  }
+  if (subsampler_conf.isActive()) {
+    subsampler_conf.write("subsampler_conf", out);
+  }
+  if (gp_values) {
+    find_max_rprop_conf.write("find_max_rprop_conf", out);
+    hyper_rprop_conf.write("hyper_rprop_conf", out);
+  }
+}
+
 void FPF::Config::from_xml(TiXmlNode *node)
 {
   // Reading size of the problem if provided
@@ -141,6 +213,9 @@ void FPF::Config::from_xml(TiXmlNode *node)
   // Reading optional properties
   rosban_utils::xml_tools::try_read<int>   (node, "nb_threads"      , nb_threads      );
   rosban_utils::xml_tools::try_read<int>   (node, "policy_samples"  , policy_samples  );
+  rosban_utils::xml_tools::try_read<int>   (node, "max_query_tiles" , max_query_tiles );
+  rosban_utils::xml_tools::try_read<double>(node, "residual_tolerance", residual_tolerance);
+  rosban_utils::xml_tools::try_read<double>(node, "time_budget", time_budget);
   rosban_utils::xml_tools::try_read<bool>  (node, "auto_parameters" , auto_parameters );
   if (!auto_parameters)
   {
@@ -149,6 +224,16 @@ void FPF::Config::from_xml(TiXmlNode *node)
   }
   rosban_utils::xml_tools::try_read<bool>  (node, "gp_values" , gp_values);
   rosban_utils::xml_tools::try_read<bool>  (node, "gp_policies" , gp_policies);
+  rosban_utils::xml_tools::try_read<bool>  (node, "warm_start" , warm_start);
+  std::string sample_precision_str;
+  rosban_utils::xml_tools::try_read<std::string>(node, "sample_precision", sample_precision_str);
+  if (sample_precision_str != "")
+  {
+    sample_precision = loadPrecision(sample_precision_str);
+  }
+  subsampler_conf.tryRead(node, "subsampler_conf");
+  rosban_utils::xml_tools::try_read<std::string>(node, "checkpoint_prefix", checkpoint_prefix);
+  rosban_utils::xml_tools::try_read<bool>  (node, "resume" , resume);
   if (gp_values) {
     find_max_rprop_conf.tryRead(node, "find_max_rprop_conf");
   }
@@ -158,6 +243,7 @@ void FPF::Config::from_xml(TiXmlNode *node)
 }
 
 FPF::FPF()
+  : q_value_nb_samples(0), q_value_samples_hash(0)
 {
 }
 
@@ -178,7 +264,63 @@ std::unique_ptr<regression_forests::Forest> FPF::stealPolicyForest(int action_in
   return std::unique_ptr<regression_forests::Forest>(policies[action_index].release());
 }
 
-void FPF::updateQValue(const std::vector<Sample>& samples,
+bool FPF::subsample(const SampleSource& samples, const Config &conf,
+                    SampleStore * subset)
+{
+  if (!conf.subsampler_conf.isActive()) return false;
+  SampleSubsampler subsampler(conf.subsampler_conf);
+  subsampler.subsample(samples, conf.getInputLimits(), subset, &sample_weights);
+  return true;
+}
+
+void FPF::prepareSolve(const SampleSource&, const Config &)
+{
+}
+
+void FPF::finishSolve()
+{
+}
+
+void FPF::writeQValueState(const Config &, std::ostream &) const
+{
+}
+
+TrainingSet FPF::applyWeights(const TrainingSet &ts, const Config &conf) const
+{
+  if (ts.size() != sample_weights.size()) {
+    std::ostringstream oss;
+    oss << "FPF::applyWeights: " << ts.size() << " samples in the training set while "
+        << sample_weights.size() << " weights are available";
+    throw std::logic_error(oss.str());
+  }
+  if (ts.size() == 0) return ts;
+  double min_weight = sample_weights[0];
+  double total_weight = 0;
+  for (double weight : sample_weights) {
+    min_weight = std::min(min_weight, weight);
+    total_weight += weight;
+  }
+  if (min_weight <= 0) {
+    throw std::logic_error("FPF::applyWeights: weights should be strictly positive");
+  }
+  // Number of copies per unit of weight, reduced if the weighted set would
+  // exceed the allowed size
+  double copies_per_weight = 1.0 / min_weight;
+  double max_size = std::max(1.0, conf.subsampler_conf.max_replication) * ts.size();
+  if (total_weight * copies_per_weight > max_size) {
+    copies_per_weight = max_size / total_weight;
+  }
+  TrainingSet weighted_ts(ts.getInputDim());
+  for (size_t i = 0; i < ts.size(); i++) {
+    int nb_copies = std::max(1, (int)std::round(sample_weights[i] * copies_per_weight));
+    for (int copy = 0; copy < nb_copies; copy++) {
+      weighted_ts.push(ts(i));
+    }
+  }
+  return weighted_ts;
+}
+
+void FPF::updateQValue(const SampleSource& samples,
                        std::function<bool(const Eigen::VectorXd&)> isTerminal,
                        Config &conf,
                        bool last_step)
@@ -208,8 +350,27 @@ void FPF::updateQValue(const std::vector<Sample>& samples,
   Benchmark::open("Getting TrainingSet");
   TrainingSet ts = getTrainingSet(samples, isTerminal, conf);
   conf.q_training_set_time += Benchmark::close();
+  updateResiduals(ts, conf);
+  if (!sample_weights.empty())
+  {
+    ts = applyWeights(ts, conf);
+  }
   Benchmark::open("q_learner.solve()");
-  q_value = q_learner.solve(ts, conf.getInputLimits());
+  // The structure of q_value can only be reused if it was built on the
+  // first samples of ts, the hash of the whole set is obtained by continuing
+  // the hash of the prefix
+  size_t prefix_size = std::min(ts.size(), q_value_nb_samples);
+  uint64_t prefix_hash = hashInputs(ts, 0, prefix_size, fnv_offset);
+  if (canWarmStart(ts, q_learner, conf, prefix_hash))
+  {
+    q_value = warmRefit(ts, q_learner, conf);
+  }
+  else
+  {
+    q_value = q_learner.solve(ts, conf.getInputLimits());
+  }
+  q_value_nb_samples = ts.size();
+  q_value_samples_hash = hashInputs(ts, prefix_size, ts.size(), prefix_hash);
   conf.q_extra_trees_time += Benchmark::close();
 }
 
@@ -217,18 +378,96 @@ void FPF::solve(const std::vector<Sample>& samples,
                 std::function<bool(const Eigen::VectorXd&)> isTerminal,
                 Config &conf)
 {
+  if (samples.size() == 0 || conf.sample_precision == SampleStore::Precision::Double)
+  {
+    solve(SampleStore(samples), isTerminal, conf);
+    return;
+  }
+  SampleStore store(samples[0].state.rows(), samples[0].action.rows(), conf.sample_precision);
+  store.setLimits(conf.getStateLimits(), conf.getActionLimits());
+  store.reserve(samples.size());
+  for (const Sample & sample : samples)
+  {
+    store.push(sample);
+  }
+  solve(store, isTerminal, conf);
+}
+
+void FPF::solve(const SampleSource& samples,
+                std::function<bool(const Eigen::VectorXd&)> isTerminal,
+                Config &conf)
+{
+  TimeStamp solve_start = TimeStamp::now();
+  // Policy extraction is expected to last as long as during previous solve,
+  // without previous timing, it is conservatively expected to last as long
+  // as an iteration on the q_value (see the budget check)
+  bool learn_policy = conf.policy_samples >= 0;
+  double expected_policy_time = 0;
+  if (learn_policy) {
+    expected_policy_time = conf.p_training_set_time + conf.p_extra_trees_time;
+  }
   // Resetting properties
   //q_value.release();//Experimental
   conf.q_training_set_time = 0;
   conf.q_extra_trees_time  = 0;
   conf.p_training_set_time = 0;
   conf.p_extra_trees_time  = 0;
+  conf.q_max_residuals.clear();
+  conf.q_mean_residuals.clear();
+  conf.q_iteration_times.clear();
+  last_q_targets.resize(0);
+  conf.budget_exhausted = false;
+  conf.checkpoint_resumed = false;
+  // Subsampling is performed once, thus all the iterations use the same samples
+  Benchmark::open("Preparing samples");
+  SampleStore subset;
+  sample_weights.clear();
+  bool use_subset = subsample(samples, conf, &subset);
+  const SampleSource & training_samples = use_subset ? (const SampleSource &)subset : samples;
+  prepareSolve(training_samples, conf);
+  conf.q_training_set_time += Benchmark::close();
+  size_t nb_iterations = 0;
+  bool converged = false;
+  // The key is computed once since hashing the samples is expensive
+  CheckpointKey checkpoint_key;
+  if (conf.checkpoint_prefix != "") {
+    checkpoint_key = getCheckpointKey(samples, training_samples, conf);
+    if (conf.resume) {
+      conf.checkpoint_resumed = loadCheckpoint(checkpoint_key, conf,
+                                               &nb_iterations, &converged);
+    }
+  }
   // Updating q-value
   Benchmark::open("Updating Q-Value");
-  for (size_t h = 1; h <= conf.horizon; h++) {
+  for (size_t h = nb_iterations + 1; h <= conf.horizon && !converged; h++) {
+    // A q_value is required, therefore the budget is not checked if no
+    // iteration has been performed yet
+    if (conf.time_budget > 0 && q_value && !conf.q_iteration_times.empty()) {
+      double elapsed = diffSec(solve_start, TimeStamp::now());
+      double iteration_time = conf.q_iteration_times.back();
+      double policy_time = expected_policy_time;
+      if (learn_policy && policy_time <= 0) {
+        policy_time = iteration_time;
+      }
+      double expected_time = iteration_time + policy_time;
+      if (elapsed + expected_time > conf.time_budget) {
+        conf.budget_exhausted = true;
+        break;
+      }
+    }
     bool last_step = (h == conf.horizon);
-    updateQValue(samples, isTerminal, conf, last_step);
+    TimeStamp iteration_start = TimeStamp::now();
+    updateQValue(training_samples, isTerminal, conf, last_step);
+    conf.q_iteration_times.push_back(diffSec(iteration_start, TimeStamp::now()));
+    // Stop when targets have converged
+    converged = conf.residual_tolerance > 0 && !conf.q_max_residuals.empty() &&
+      conf.q_max_residuals.back() < conf.residual_tolerance;
+    if (conf.checkpoint_prefix != "") {
+      saveCheckpoint(checkpoint_key, conf, h, converged);
+    }
+    nb_iterations = h;
   }
+  conf.q_nb_iterations = nb_iterations;
   Benchmark::close();
   // If required, learn policy from the q_value
   if (conf.policy_samples >= 0)
@@ -237,7 +476,7 @@ void FPF::solve(const std::vector<Sample>& samples,
     int x_dim = conf.getStateLimits().rows();
     int u_dim = conf.getActionLimits().rows();
     // First generate the starting states
-    std::vector<Eigen::VectorXd> states = getPolicyTrainingStates(samples, conf);
+    std::vector<Eigen::VectorXd> states = getPolicyTrainingStates(training_samples, conf);
     // Then get corresponding actions
     std::vector<Eigen::VectorXd> actions = getPolicyActions(states, conf);
     conf.p_training_set_time += Benchmark::close();
@@ -251,7 +490,7 @@ void FPF::solve(const std::vector<Sample>& samples,
       // Use GP if required
       if (conf.gp_policies) policy_appr_type = Approximation::ID::GP;
       policy_learner.conf = ExtraTrees::Config::generateAuto(conf.getStateLimits(),
-                                                             samples.size(),
+                                                             training_samples.size(),
                                                              policy_appr_type);
       policy_learner.conf.nb_threads = conf.nb_threads;
       // If using GP, use the custom parameters for hyperparameters tuning
@@ -261,115 +500,113 @@ void FPF::solve(const std::vector<Sample>& samples,
     {
       policy_learner.conf = conf.policy_conf;
     }
+    // Action dimensions are learnt concurrently, threads are shared among them
+    policy_learner.conf.nb_threads = std::max(1, policy_learner.conf.nb_threads / u_dim);
     Benchmark::open("policy_learning");
-    /// Create a policy for each action dimension
-    for (int dim = 0; dim < u_dim; dim++)
-    {
-      // First build training set from State to action[dim]
-      TrainingSet ts(x_dim);
-      for (size_t sample_idx = 0; sample_idx < states.size(); sample_idx++)
-      {
-        ts.push(regression_forests::Sample(states[sample_idx], actions[sample_idx](dim)));
-      }
-      policies.push_back(policy_learner.solve(ts, conf.getStateLimits()));
-    }
+    policies.resize(u_dim);
+    WorkerPool::getInstance().run(u_dim, [&](int dim)
+                                  {
+                                    // Build training set from State to action[dim], all
+                                    // the jobs read the same states
+                                    TrainingSet ts(x_dim);
+                                    for (size_t sample_idx = 0; sample_idx < states.size(); sample_idx++)
+                                    {
+                                      ts.push(regression_forests::Sample(states[sample_idx],
+                                                                         actions[sample_idx](dim)));
+                                    }
+                                    // Each job uses its own learner since solve is not const
+                                    ExtraTrees learner = policy_learner;
+                                    policies[dim] = learner.solve(ts, conf.getStateLimits());
+                                  },
+                                  conf.nb_threads);
     conf.p_extra_trees_time += Benchmark::close();
   }
+  finishSolve();
 }
 
-TrainingSet FPF::getTrainingSet(const std::vector<Sample>& samples,
+TrainingSet FPF::getTrainingSet(const SampleSource& samples,
                                 std::function<bool(const Eigen::VectorXd&)> is_terminal,
                                 const Config &conf)
 {
-  std::vector<std::thread> threads;
-  std::mutex ts_mutex;
+  updateMaxQuery(conf);
   int x_dim = conf.getStateLimits().rows();
   int u_dim = conf.getActionLimits().rows();
-  TrainingSet ts(x_dim + u_dim);
   MultiCore::Intervals intervals = MultiCore::buildIntervals(samples.size(), conf.nb_threads);
+  // Each job fills its own slot, no synchronization is required
+  std::vector<TrainingSet> thread_ts(intervals.size(), TrainingSet(x_dim + u_dim));
+  // Each job computes the samples of its interval
+  WorkerPool::getInstance().run(intervals.size(), [&](int thread_no)
+                                {
+                                  int start = intervals[thread_no].first;
+                                  int end = intervals[thread_no].second;
+                                  thread_ts[thread_no] = this->getTrainingSet(samples, is_terminal, conf,
+                                                                              start, end);
+                                },
+                                conf.nb_threads);
+  // Gathering slots in the order of the intervals, thus the order of the
+  // samples does not depend on nb_threads or on the scheduling
+  TrainingSet ts(x_dim + u_dim);
   for (size_t thread_no = 0; thread_no < intervals.size(); thread_no++)
   {
-    // Compute samples in [start, end[
-    int start = intervals[thread_no].first;
-    int end = intervals[thread_no].second;
-    threads.push_back(std::thread([&, start, end]()
-                                  {
-                                    TrainingSet thread_ts = this->getTrainingSet(samples,
-                                                                                 is_terminal,
-                                                                                 conf,
-                                                                                 start,
-                                                                                 end);
-                                    // Only one thread at a time can push its collection
-                                    ts_mutex.lock();
-                                    for (size_t sample = 0; sample < thread_ts.size(); sample++)
-                                    {
-                                      ts.push(thread_ts(sample));
-                                    }
-                                    ts_mutex.unlock();
-                                  }));
-  }
-  for (size_t thread_no = 0; thread_no < intervals.size(); thread_no++)
-  {
-    threads[thread_no].join();
+    const TrainingSet & to_add = thread_ts[thread_no];
+    for (size_t sample = 0; sample < to_add.size(); sample++)
+    {
+      ts.push(to_add(sample));
+    }
   }
   return ts;
 }
 
-TrainingSet FPF::getTrainingSet(const std::vector<Sample> &samples,
+TrainingSet FPF::getTrainingSet(const SampleSource &samples,
                                 std::function<bool(const Eigen::VectorXd&)> is_terminal,
                                 const Config &conf,
                                 int start_idx, int end_idx)
 {
-  int x_dim = conf.getStateLimits().rows();
-  int u_dim = conf.getActionLimits().rows();
+  int x_dim = samples.stateDims();
+  int u_dim = samples.actionDims();
   TrainingSet ls(x_dim + u_dim);
-  for (int i = start_idx; i < end_idx; i++) {
-    const Sample& sample = samples[i];
-    int x_dim = sample.state.rows();
-    int u_dim = sample.action.rows();
-    Eigen::VectorXd input(x_dim + u_dim);
-    input.segment(0, x_dim) = sample.state;
-    input.segment(x_dim, u_dim) = sample.action;
-    Eigen::VectorXd next_state = sample.next_state;
-    double reward = sample.reward;
-    if (q_value && !is_terminal(next_state)) {
-      // Establishing limits for projection
-      Eigen::MatrixXd limits(x_dim + u_dim, 2);
-      limits.block(    0, 0, x_dim, 1) = next_state;
-      limits.block(    0, 1, x_dim, 1) = next_state;
-      limits.block(x_dim, 0, u_dim, 2) = conf.getActionLimits();
-      double best_reward;
-      if (conf.gp_values) {
-        // Preparing functions
-        std::function<Eigen::VectorXd(const Eigen::VectorXd)> gradient_func;
-        gradient_func = [this](const Eigen::VectorXd & input)
-          {
-            return this->q_value->getGradient(input);
-          };
-        std::function<double(const Eigen::VectorXd)> scoring_func;
-        scoring_func = [this](const Eigen::VectorXd & guess)
-          {
-            return this->q_value->getValue(guess);
-          };
-        // Performing multiple rProp and conserving the best candidate
-        Eigen::VectorXd best_guess;
-        best_guess = rosban_gp::RandomizedRProp::run(gradient_func, scoring_func,
-                                                     limits, conf.find_max_rprop_conf);
-        best_reward = scoring_func(best_guess);
-      }
-      else {
-        std::unique_ptr<regression_forests::Tree> sub_tree;
-        sub_tree = q_value->unifiedProjectedTree(limits, conf.max_action_tiles);
-        best_reward = sub_tree->getMax(limits);
+  int nb_samples = end_idx - start_idx;
+  // Buffers are reused for all the samples, values are decoded to double
+  // whatever the storage precision
+  Eigen::VectorXd input(x_dim + u_dim);
+  Eigen::VectorXd state(x_dim), action(u_dim), next_state(x_dim);
+  // The maxima of the q_value for all the non-terminal next states of the
+  // interval are computed with a single batched query
+  std::vector<bool> use_next_value(nb_samples, false);
+  Eigen::VectorXd next_values;
+  if (q_value) {
+    Eigen::MatrixXd next_states(x_dim, nb_samples);
+    int nb_queries = 0;
+    for (int i = start_idx; i < end_idx; i++) {
+      samples.getNextState(i, &next_state);
+      if (!is_terminal(next_state)) {
+        next_states.col(nb_queries) = next_state;
+        use_next_value[i - start_idx] = true;
+        nb_queries++;
       }
-      reward += conf.discount * best_reward;
+    }
+    if (nb_queries > 0) {
+      next_states.conservativeResize(x_dim, nb_queries);
+      getMaxQValues(next_states, conf, "getTrainingSet", &next_values);
+    }
+  }
+  int query_idx = 0;
+  for (int i = start_idx; i < end_idx; i++) {
+    samples.getState(i, &state);
+    samples.getAction(i, &action);
+    input.segment(0, x_dim) = state;
+    input.segment(x_dim, u_dim) = action;
+    double reward = samples.reward(i);
+    if (use_next_value[i - start_idx]) {
+      reward += conf.discount * next_values(query_idx);
+      query_idx++;
     }
     ls.push(regression_forests::Sample(input, reward));
   }
   return ls;
 }
 
-std::vector<Eigen::VectorXd> FPF::getPolicyTrainingStates(const std::vector<Sample>& samples,
+std::vector<Eigen::VectorXd> FPF::getPolicyTrainingStates(const SampleSource& samples,
                                                           const Config &conf)
 {
   if (conf.policy_samples > 0)
@@ -377,39 +614,353 @@ std::vector<Eigen::VectorXd> FPF::getPolicyTrainingStates(const std::vector<Samp
     return rosban_random::getUniformSamples(conf.getStateLimits(), conf.policy_samples);
   }
   std::vector<Eigen::VectorXd> result;
-  result.reserve(samples.size());
-  for (const Sample & s : samples)
+  result.resize(samples.size());
+  for (int i = 0; i < samples.size(); i++)
   {
-    result.push_back(s.state);
+    samples.getState(i, &(result[i]));
   }
   return result;
 }
 
+bool FPF::canWarmStart(const TrainingSet &ts,
+                       const ExtraTrees &q_learner,
+                       const Config &conf,
+                       uint64_t prefix_hash) const
+{
+  // Subsets of the samples are not only growing between two solves. The
+  // samples used to build the structure have to be the first samples of ts,
+  // otherwise the solver has received another data set
+  return conf.warm_start && sample_weights.empty() && q_value && q_value_nb_samples > 0 &&
+    ts.size() >= q_value_nb_samples && prefix_hash == q_value_samples_hash &&
+    q_learner.conf.appr_type == Approximation::ID::PWC;
+}
+
+std::unique_ptr<Forest> FPF::warmRefit(const TrainingSet &ts,
+                                       const ExtraTrees &q_learner,
+                                       const Config &conf) const
+{
+  // Regrowing leaves uses a single tree and a single thread
+  ExtraTrees leaf_learner = q_learner;
+  leaf_learner.conf.nb_trees = 1;
+  leaf_learner.conf.nb_threads = 1;
+  std::vector<int> indices(ts.size());
+  for (size_t i = 0; i < ts.size(); i++)
+  {
+    indices[i] = i;
+  }
+  // Trees are refit independently
+  std::vector<std::unique_ptr<regression_forests::Tree>> trees(q_value->nbTrees());
+  WorkerPool::getInstance().run(trees.size(), [&](int tree_id)
+                                {
+                                  Eigen::MatrixXd space = conf.getInputLimits();
+                                  trees[tree_id].reset(new regression_forests::Tree);
+                                  trees[tree_id]->root =
+                                    this->warmRefitNode(q_value->getTree(tree_id).root,
+                                                        ts, indices, space, leaf_learner);
+                                },
+                                conf.nb_threads);
+  std::unique_ptr<Forest> forest(new Forest);
+  for (std::unique_ptr<regression_forests::Tree> & tree : trees)
+  {
+    forest->push(std::move(tree));
+  }
+  return forest;
+}
+
+/// Deep copy of a node, approximations are shared
+static regression_forests::Node * cloneNode(const regression_forests::Node * node)
+{
+  regression_forests::Node * copy = new regression_forests::Node();
+  copy->a = node->a;
+  if (!node->isLeaf())
+  {
+    copy->s = node->s;
+    copy->lowerChild = cloneNode(node->lowerChild);
+    copy->upperChild = cloneNode(node->upperChild);
+  }
+  return copy;
+}
+
+regression_forests::Node * FPF::warmRefitNode(const regression_forests::Node * node,
+                                              const TrainingSet &ts,
+                                              const std::vector<int> &indices,
+                                              Eigen::MatrixXd &space,
+                                              const ExtraTrees &leaf_learner) const
+{
+  if (node->isLeaf())
+  {
+    bool has_new_samples = false;
+    for (int idx : indices)
+    {
+      if ((size_t)idx >= q_value_nb_samples) has_new_samples = true;
+    }
+    // Growing a new subtree where new samples have been received
+    if (has_new_samples)
+    {
+      TrainingSet leaf_ts(ts.getInputDim());
+      for (int idx : indices)
+      {
+        leaf_ts.push(ts(idx));
+      }
+      // Each leaf uses its own learner since solve is not const
+      ExtraTrees learner = leaf_learner;
+      std::unique_ptr<Forest> leaf_forest = learner.solve(leaf_ts, space);
+      return cloneNode(leaf_forest->getTree(0).root);
+    }
+    regression_forests::Node * new_node = new regression_forests::Node();
+    // Leaves without samples keep their previous approximation
+    if (indices.size() == 0)
+    {
+      new_node->a = node->a;
+      return new_node;
+    }
+    double sum = 0;
+    for (int idx : indices)
+    {
+      sum += ts(idx).getOutput();
+    }
+    new_node->a = std::shared_ptr<Approximation>(new PWCApproximation(sum / indices.size()));
+    return new_node;
+  }
+  // Dispatching samples among children
+  int split_dim = node->s.dim;
+  double split_val = node->s.val;
+  std::vector<int> lower_indices, upper_indices;
+  for (int idx : indices)
+  {
+    if (ts(idx).getInput(split_dim) > split_val)
+    {
+      upper_indices.push_back(idx);
+    }
+    else
+    {
+      lower_indices.push_back(idx);
+    }
+  }
+  regression_forests::Node * new_node = new regression_forests::Node();
+  new_node->s = node->s;
+  double old_min = space(split_dim, 0);
+  double old_max = space(split_dim, 1);
+  space(split_dim, 1) = split_val;
+  new_node->lowerChild = warmRefitNode(node->lowerChild, ts, lower_indices, space, leaf_learner);
+  space(split_dim, 1) = old_max;
+  space(split_dim, 0) = split_val;
+  new_node->upperChild = warmRefitNode(node->upperChild, ts, upper_indices, space, leaf_learner);
+  space(split_dim, 0) = old_min;
+  return new_node;
+}
+
+void FPF::updateResiduals(const TrainingSet &ts, Config &conf)
+{
+  Eigen::VectorXd targets(ts.size());
+  for (size_t i = 0; i < ts.size(); i++)
+  {
+    targets(i) = ts(i).getOutput();
+  }
+  // Initial q_value is 0
+  if (last_q_targets.rows() == 0)
+  {
+    last_q_targets = Eigen::VectorXd::Zero(targets.rows());
+  }
+  if (last_q_targets.rows() != targets.rows())
+  {
+    throw std::logic_error("FPF::updateResiduals: number of targets changed between iterations");
+  }
+  if (targets.rows() > 0)
+  {
+    Eigen::VectorXd residuals = (targets - last_q_targets).cwiseAbs();
+    conf.q_max_residuals.push_back(residuals.maxCoeff());
+    conf.q_mean_residuals.push_back(residuals.mean());
+  }
+  last_q_targets = targets;
+}
+
+FPF::CheckpointKey FPF::getCheckpointKey(const SampleSource& samples,
+                                         const SampleSource& training_samples,
+                                         const Config &conf) const
+{
+  CheckpointKey key;
+  key.nb_samples = samples.size();
+  key.samples_hash = hashSamples(samples);
+  key.nb_training_samples = training_samples.size();
+  key.config_hash = hashConfig(conf);
+  std::ostringstream state;
+  writeQValueState(conf, state);
+  std::string state_str = state.str();
+  key.state_hash = fnv_offset;
+  hashBytes(&key.state_hash, state_str.data(), state_str.size());
+  return key;
+}
+
+void FPF::saveCheckpoint(const CheckpointKey &key, const Config &conf,
+                         size_t nb_iterations, bool converged) const
+{
+  // The q_value of each iteration has its own file, thus the header always
+  // refers to a complete forest, even if the process stops while writing
+  std::ostringstream forest_name;
+  forest_name << "fpf_q_value_" << nb_iterations << ".data";
+  std::string forest_path = conf.checkpoint_prefix + forest_name.str();
+  std::string header_path = conf.checkpoint_prefix + "fpf_checkpoint.bin";
+  q_value->save(forest_path);
+  std::ofstream out(header_path + ".tmp", std::ios::binary | std::ios::trunc);
+  if (!out.good()) {
+    throw std::runtime_error("FPF::saveCheckpoint: failed to open '" + header_path + ".tmp'");
+  }
+  binary_io::writeHeader(out, checkpoint_magic, checkpoint_version);
+  binary_io::write<uint64_t>(out, key.nb_samples);
+  binary_io::write<uint64_t>(out, key.samples_hash);
+  binary_io::write<uint64_t>(out, key.nb_training_samples);
+  binary_io::write<uint64_t>(out, key.config_hash);
+  binary_io::write<uint64_t>(out, key.state_hash);
+  binary_io::write<uint64_t>(out, nb_iterations);
+  binary_io::write<uint8_t>(out, converged);
+  binary_io::write<uint64_t>(out, q_value_nb_samples);
+  binary_io::write<uint64_t>(out, q_value_samples_hash);
+  binary_io::write<double>(out, conf.q_training_set_time);
+  binary_io::write<double>(out, conf.q_extra_trees_time);
+  binary_io::writeVector(out, conf.q_max_residuals);
+  binary_io::writeVector(out, conf.q_mean_residuals);
+  binary_io::writeVector(out, conf.q_iteration_times);
+  binary_io::writeMatrix(out, last_q_targets);
+  out.close();
+  if (out.fail() || std::rename((header_path + ".tmp").c_str(), header_path.c_str()) != 0) {
+    throw std::runtime_error("FPF::saveCheckpoint: failed to write '" + header_path + "'");
+  }
+  // Forest of the previous iteration is not referenced anymore
+  if (nb_iterations > 1) {
+    std::ostringstream previous_name;
+    previous_name << "fpf_q_value_" << (nb_iterations - 1) << ".data";
+    std::remove((conf.checkpoint_prefix + previous_name.str()).c_str());
+  }
+}
+
+bool FPF::loadCheckpoint(const CheckpointKey &key, Config &conf,
+                         size_t * nb_iterations, bool * converged)
+{
+  std::string header_path = conf.checkpoint_prefix + "fpf_checkpoint.bin";
+  std::ifstream in(header_path, std::ios::binary);
+  if (!in.good()) return false;
+  binary_io::checkHeader(in, checkpoint_magic, checkpoint_version,
+                         "FPF::loadCheckpoint: '" + header_path + "'");
+  CheckpointKey read_key;
+  read_key.nb_samples = binary_io::read<uint64_t>(in);
+  read_key.samples_hash = binary_io::read<uint64_t>(in);
+  read_key.nb_training_samples = binary_io::read<uint64_t>(in);
+  read_key.config_hash = binary_io::read<uint64_t>(in);
+  read_key.state_hash = binary_io::read<uint64_t>(in);
+  if (read_key.nb_samples != key.nb_samples ||
+      read_key.samples_hash != key.samples_hash ||
+      read_key.nb_training_samples != key.nb_training_samples ||
+      read_key.config_hash != key.config_hash ||
+      read_key.state_hash != key.state_hash) {
+    return false;
+  }
+  size_t read_iterations = binary_io::read<uint64_t>(in);
+  bool read_converged = binary_io::read<uint8_t>(in) != 0;
+  size_t read_nb_samples = binary_io::read<uint64_t>(in);
+  uint64_t read_samples_hash = binary_io::read<uint64_t>(in);
+  double q_training_set_time = binary_io::read<double>(in);
+  double q_extra_trees_time = binary_io::read<double>(in);
+  std::vector<double> q_max_residuals = binary_io::readVector(in);
+  std::vector<double> q_mean_residuals = binary_io::readVector(in);
+  std::vector<double> q_iteration_times = binary_io::readVector(in);
+  Eigen::VectorXd read_targets;
+  binary_io::readMatrix(in, &read_targets);
+  // Targets are computed on the training samples (0 if no iteration)
+  if (read_targets.rows() != 0 &&
+      (uint64_t)read_targets.rows() != key.nb_training_samples) {
+    return false;
+  }
+  std::ostringstream forest_name;
+  forest_name << "fpf_q_value_" << read_iterations << ".data";
+  std::unique_ptr<Forest> forest(new Forest);
+  forest->load(conf.checkpoint_prefix + forest_name.str());
+  // Everything has been read, the state of the solver can be updated
+  q_value = std::move(forest);
+  q_value_nb_samples = read_nb_samples;
+  q_value_samples_hash = read_samples_hash;
+  last_q_targets = read_targets;
+  conf.q_training_set_time = q_training_set_time;
+  conf.q_extra_trees_time = q_extra_trees_time;
+  conf.q_max_residuals = q_max_residuals;
+  conf.q_mean_residuals = q_mean_residuals;
+  conf.q_iteration_times = q_iteration_times;
+  *nb_iterations = read_iterations;
+  *converged = read_converged;
+  return true;
+}
+
+uint64_t FPF::hashSamples(const SampleSource& samples)
+{
+  uint64_t hash = fnv_offset;
+  Eigen::VectorXd state, action, next_state;
+  for (int idx = 0; idx < samples.size(); idx++) {
+    samples.getState(idx, &state);
+    samples.getAction(idx, &action);
+    samples.getNextState(idx, &next_state);
+    double reward = samples.reward(idx);
+    hashBytes(&hash, state.data(), state.size() * sizeof(double));
+    hashBytes(&hash, action.data(), action.size() * sizeof(double));
+    hashBytes(&hash, next_state.data(), next_state.size() * sizeof(double));
+    hashBytes(&hash, &reward, sizeof(double));
+  }
+  return hash;
+}
+
+uint64_t FPF::hashConfig(const Config &conf)
+{
+  std::ostringstream oss;
+  conf.writeQValueParameters(oss);
+  std::string str = oss.str();
+  uint64_t hash = fnv_offset;
+  hashBytes(&hash, str.data(), str.size());
+  return hash;
+}
+
+uint64_t FPF::hashInputs(const TrainingSet &ts, size_t start, size_t end, uint64_t hash)
+{
+  for (size_t idx = start; idx < end; idx++) {
+    const Eigen::VectorXd & input = ts(idx).getInput();
+    hashBytes(&hash, input.data(), input.size() * sizeof(double));
+  }
+  return hash;
+}
+
+void FPF::updateMaxQuery(const Config &conf)
+{
+  q_max_query.reset();
+  q_gp_query.reset();
+  if (!q_value) return;
+  if (conf.gp_values)
+  {
+    q_gp_query.reset(new GPForestQuery(*q_value, conf.getInputLimits(),
+                                       conf.getStateLimits().rows()));
+    return;
+  }
+  q_max_query.reset(new ForestMaxQuery(*q_value, conf.getInputLimits(),
+                                       conf.getStateLimits().rows(),
+                                       conf.max_query_tiles));
+}
+
 std::vector<Eigen::VectorXd> FPF::getPolicyActions(const std::vector<Eigen::VectorXd> &states,
                                                    const Config &conf)
 {
+  updateMaxQuery(conf);
   MultiCore::Intervals intervals = MultiCore::buildIntervals(states.size(), conf.nb_threads);
-  // Each thread has its own vector of actions
-  std::vector<std::thread> threads;
+  // Each job has its own vector of actions
   std::vector<std::vector<Eigen::VectorXd>> thread_actions(intervals.size());
-  for (size_t thread_no = 0; thread_no < intervals.size(); thread_no++)
-  {
-    // Compute samples in [start, end[
-    int start = intervals[thread_no].first;
-    int end = intervals[thread_no].second;
-    threads.push_back(std::thread([&, thread_no, start, end]()
-                                  {
-                                    thread_actions[thread_no]= this->getPolicyActions(states,
-                                                                                      conf,
-                                                                                      start,
-                                                                                      end);
-                                  }));
-  }
+  WorkerPool::getInstance().run(intervals.size(), [&](int thread_no)
+                                {
+                                  int start = intervals[thread_no].first;
+                                  int end = intervals[thread_no].second;
+                                  thread_actions[thread_no] = this->getPolicyActions(states, conf,
+                                                                                     start, end);
+                                },
+                                conf.nb_threads);
   // Gathering all actions in the right order
   std::vector<Eigen::VectorXd> actions;
   for (size_t thread_no = 0; thread_no < intervals.size(); thread_no++)
   {
-    threads[thread_no].join();
     const std::vector<Eigen::VectorXd> & to_add = thread_actions[thread_no];
     actions.insert(actions.end(), to_add.begin(), to_add.end());
   }
@@ -420,41 +971,41 @@ std::vector<Eigen::VectorXd> FPF::getPolicyActions(const std::vector<Eigen::Vect
                                                    const Config &conf,
                                                    int start_idx, int end_idx)
 {
-  int x_dim = conf.getStateLimits().rows();
-  int u_dim = conf.getActionLimits().rows();
-  std::vector<Eigen::VectorXd> actions;
+  Eigen::MatrixXd interval_states(conf.getStateLimits().rows(), end_idx - start_idx);
   for (int i = start_idx; i < end_idx; i++)
   {
-    Eigen::MatrixXd limits(x_dim + u_dim, 2);
-    limits.block(    0, 0, x_dim, 1) = states[i];
-    limits.block(    0, 1, x_dim, 1) = states[i];
-    limits.block(x_dim, 0, u_dim, 2) = conf.getActionLimits();
-    Eigen::VectorXd best_input;
-    if (conf.gp_values) {
-      // Preparing functions
-      std::function<Eigen::VectorXd(const Eigen::VectorXd)> gradient_func;
-      gradient_func = [this](const Eigen::VectorXd & input)
-        {
-          return this->q_value->getGradient(input);
-        };
-      std::function<double(const Eigen::VectorXd)> scoring_func;
-      scoring_func = [this](const Eigen::VectorXd & guess)
-        {
-          return this->q_value->getValue(guess);
-        };
-      // Performing multiple rProp and conserving the best candidate
-      best_input = rosban_gp::RandomizedRProp::run(gradient_func, scoring_func,
-                                                   limits, conf.find_max_rprop_conf);
+    interval_states.col(i - start_idx) = states[i];
+  }
+  Eigen::VectorXd values;
+  Eigen::MatrixXd best_actions;
+  getMaxQValues(interval_states, conf, "getPolicyActions", &values, &best_actions);
+  std::vector<Eigen::VectorXd> actions;
+  actions.reserve(end_idx - start_idx);
+  for (int col = 0; col < best_actions.cols(); col++)
+  {
+    actions.push_back(best_actions.col(col));
+  }
+  return actions;
+}
+
+void FPF::getMaxQValues(const Eigen::MatrixXd &states, const Config &conf,
+                        const char * method, Eigen::VectorXd * values,
+                        Eigen::MatrixXd * best_actions) const
+{
+  if (conf.gp_values) {
+    if (!q_gp_query) {
+      throw std::logic_error(std::string("FPF::") + method + ": q_gp_query has not been built");
     }
-    else {
-      std::unique_ptr<regression_forests::Tree> sub_tree;
-      sub_tree = q_value->unifiedProjectedTree(limits, conf.max_action_tiles);
-      best_input = sub_tree->getArgMax(limits);
+    GPForestQuery::Scratch gp_scratch;
+    q_gp_query->getMax(states, conf.find_max_rprop_conf, &gp_scratch, values, best_actions);
+  }
+  else {
+    if (!q_max_query) {
+      throw std::logic_error(std::string("FPF::") + method + ": q_max_query has not been built");
     }
-    actions.push_back(best_input.segment(x_dim, u_dim));
+    ForestMaxQuery::Scratch scratch;
+    q_max_query->getMax(states, &scratch, values, best_actions);
   }
-
-  return actions;
 }
 
 }
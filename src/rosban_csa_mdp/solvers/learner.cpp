@@ -48,7 +48,15 @@ std::vector<Eigen::MatrixXd> Learner::getActionLimits() const
 
 void Learner::feed(const csa_mdp::Sample & sample)
 {
-  samples.push_back(sample);
+  samples.push(sample);
+}
+
+void Learner::feed(const csa_mdp::SampleSource & new_samples)
+{
+  for (int i = 0; i < new_samples.size(); i++)
+  {
+    feed(new_samples.getSample(i));
+  }
 }
 
 
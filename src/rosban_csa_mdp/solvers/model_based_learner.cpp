@@ -5,6 +5,7 @@
 #include "rosban_csa_mdp/core/fa_policy.h"
 #include "rosban_csa_mdp/core/problem_factory.h"
 #include "rosban_csa_mdp/core/random_policy.h"
+#include "rosban_csa_mdp/core/worker_pool.h"
 
 #include "rosban_fa/trainer_factory.h"
 
@@ -127,10 +128,11 @@ void ModelBasedLearner::updateValue()
     {
       for (int sample = start_idx; sample < end_idx; sample++)
       {
-        Eigen::VectorXd state = this->samples[sample].state;
+        Eigen::VectorXd state;
+        this->samples.getState(sample, &state);
         double mean, var;
         reward_predictor->predict(state, *(this->getPolicy()),
-                                  this->model->getResultFunction(),
+                                  this->model->getBatchResultFunction(),
                                   getValueFunction(),
                                   this->discount,
                                   &mean, &var, thread_engine);
@@ -138,23 +140,11 @@ void ModelBasedLearner::updateValue()
         observations(sample) = mean;
       }
     };
-  // Choosing how many threads will be used for the samples and how many
-  // subthreads will be spawned by each thread
-  int wished_threads = nb_threads;
-  int subthreads = 1;
-  // Increasing performances when the number of samples is small, but ensuring that
-  // no more than nb_threads are created
-  if (nb_threads > nb_samples) {
-    subthreads = std::ceil(nb_threads / (double)nb_samples);
-    wished_threads = nb_threads / subthreads;
-  }
-  reward_predictor->setNbThreads(subthreads);
-
-  // Preparing random_engines
-  std::vector<std::default_random_engine> engines;
-  engines = rosban_random::getRandomEngines(wished_threads, &engine);
-  // Run threads in parallel
-  MultiCore::runParallelStochasticTask(rp_task, nb_samples, &engines);
+  // Nested tasks of the reward predictor are submitted to the shared pool, thus idle
+  // workers steal them when there are less samples than threads
+  reward_predictor->setNbThreads(nb_threads);
+  // Run tasks in parallel
+  WorkerPool::runBalancedStochasticTask(rp_task, nb_samples, nb_threads, &engine);
   TimeStamp end_reward_predictor = TimeStamp::now();
   // Approximate the gathered samples
   value = value_trainer->train(inputs, observations, getStateLimits());
@@ -188,11 +178,12 @@ void ModelBasedLearner::updatePolicy()
     {
       for (int sample = start_idx; sample < end_idx; sample++)
       {
-        Eigen::VectorXd state = this->samples[sample].state;
+        Eigen::VectorXd state;
+        this->samples.getState(sample, &state);
         Eigen::VectorXd best_action;
         best_action = this->action_optimizer->optimize(state, action_limits,
                                                        this->getPolicy(), 
-                                                       this->model->getResultFunction(),
+                                                       this->model->getBatchResultFunction(),
                                                        getValueFunction(),
                                                        this->discount,
                                                        thread_engine);
@@ -200,23 +191,11 @@ void ModelBasedLearner::updatePolicy()
         observations.row(sample) = best_action.transpose();
       }
     };
-  // Choosing how many threads will be used for the samples and how many
-  // subthreads will be spawned by each thread
-  int wished_threads = nb_threads;
-  int subthreads = 1;
-  // Increasing performances when the number of samples is small, but ensuring that
-  // no more than nb_threads are created
-  if (nb_threads > nb_samples) {
-    subthreads = std::ceil(nb_threads / (double)nb_samples);
-    wished_threads = nb_threads / subthreads;
-  }
-  action_optimizer->setNbThreads(subthreads);
-
-  // Preparing random_engines
-  std::vector<std::default_random_engine> engines;
-  engines = rosban_random::getRandomEngines(wished_threads, &engine);
-  // Run threads in parallel
-  MultiCore::runParallelStochasticTask(ao_task, nb_samples, &engines);
+  // Nested tasks of the action optimizer are submitted to the shared pool, thus idle
+  // workers steal them when there are less samples than threads
+  action_optimizer->setNbThreads(nb_threads);
+  // Run tasks in parallel
+  WorkerPool::runBalancedStochasticTask(ao_task, nb_samples, nb_threads, &engine);
 
   TimeStamp end_action_optimizer = TimeStamp::now();
   std::unique_ptr<rosban_fa::FunctionApproximator> new_policy_fa;
@@ -1,5 +1,7 @@
 #include "rosban_csa_mdp/solvers/mre.h"
 
+#include "rosban_csa_mdp/core/binary_io.h"
+
 #include "rosban_fa/forest_approximator.h"
 #include "rosban_fa/function_approximator.h"
 
@@ -9,6 +11,8 @@
 
 #include "rosban_utils/benchmark.h"
 
+#include <cstdio>
+#include <fstream>
 #include <set>
 #include <iostream>
 
@@ -25,8 +29,11 @@ using namespace regression_forests::Statistics;
 namespace csa_mdp
 {
 
+const char MRE::checkpoint_magic[8] = {'C','S','A','M','R','E','C','K'};
+const uint32_t MRE::checkpoint_version = 1;
+
 MRE::MRE()
-  : plan_period(-1)
+  : plan_period(-1), nb_fed_samples(0)
 {
   // Init random engine
   random_engine = rosban_random::getRandomEngine();
@@ -47,17 +54,79 @@ void MRE::feed(const Sample &s)
     throw std::runtime_error("MRE::feed: not implemented for multiple actions problems");
   }
 
+  // The tolerance might have been changed since the index was built
+  if (mrefpf_conf.filter_samples &&
+      similarity_index.getTolerance() != mrefpf_conf.filter_tolerance)
+  {
+    rebuildSimilarityIndex();
+  }
+
   int s_dim = getStateLimits().rows();
   int a_dim = getActionLimits()[0].rows();
-  // Add the new 4 tuple
-  samples.push_back(s);
-  // Adding last_point to knownness tree
   Eigen::VectorXd knownness_point(s_dim + a_dim);
   knownness_point.segment(    0, s_dim) = s.state;
   knownness_point.segment(s_dim, a_dim) = s.action;
+  nb_fed_samples++;
+  // Add the new 4 tuple (unless a similar sample is already known)
+  if (!mrefpf_conf.filter_samples || similarity_index.insert(knownness_point))
+  {
+    samples.push(s);
+  }
+  // Adding last_point to knownness tree
   knownness_forest->push(knownness_point);
   // Update policy if required
-  if (plan_period > 0 && samples.size() % plan_period == 0)
+  if (plan_period > 0 && nb_fed_samples % plan_period == 0)
+  {
+    internalUpdate();
+  }
+}
+
+void MRE::feed(const SampleSource &new_samples)
+{
+  if (!knownness_forest) {
+    throw std::logic_error("MRE::feed: knownness_forest has not been initialized");
+  }
+  if (getActionLimits().size() !=1) {
+    throw std::runtime_error("MRE::feed: not implemented for multiple actions problems");
+  }
+  if (new_samples.empty()) return;
+
+  // The tolerance might have been changed since the index was built
+  if (mrefpf_conf.filter_samples &&
+      similarity_index.getTolerance() != mrefpf_conf.filter_tolerance)
+  {
+    rebuildSimilarityIndex();
+  }
+
+  int s_dim = getStateLimits().rows();
+  int a_dim = getActionLimits()[0].rows();
+  int old_fed = nb_fed_samples;
+  nb_fed_samples += new_samples.size();
+  // Add all the 4 tuples at once if there is no filtering
+  if (!mrefpf_conf.filter_samples)
+  {
+    samples.append(new_samples);
+  }
+  // Points are added to the knownness forest by a single batch
+  std::vector<Eigen::VectorXd> knownness_points;
+  knownness_points.reserve(new_samples.size());
+  Eigen::VectorXd knownness_point(s_dim + a_dim);
+  Eigen::VectorXd state(s_dim), action(a_dim);
+  for (int i = 0; i < new_samples.size(); i++)
+  {
+    new_samples.getState(i, &state);
+    new_samples.getAction(i, &action);
+    knownness_point.segment(    0, s_dim) = state;
+    knownness_point.segment(s_dim, a_dim) = action;
+    if (mrefpf_conf.filter_samples && similarity_index.insert(knownness_point))
+    {
+      samples.push(new_samples, i);
+    }
+    knownness_points.push_back(knownness_point);
+  }
+  knownness_forest->pushBatch(knownness_points);
+  // Update policy if at least one multiple of plan_period has been reached
+  if (plan_period > 0 && nb_fed_samples / plan_period > old_fed / plan_period)
   {
     internalUpdate();
   }
@@ -93,6 +162,13 @@ void MRE::internalUpdate()
   }
   const Eigen::MatrixXd & limits = getActionLimits()[0];
 
+  // Samples are saved along with the checkpoints of the solver
+  if (mrefpf_conf.checkpoint_prefix != "")
+  {
+    saveCheckpoint(mrefpf_conf.checkpoint_prefix);
+  }
+  // The policy is computed with all the points fed
+  knownness_forest->flush();
   // Updating the policy
   Benchmark::open("solver.solve");
   solver.solve(samples, terminal_function, mrefpf_conf);
@@ -159,6 +235,67 @@ void MRE::saveStatus(const std::string &prefix)
   saveKnownnessTree(prefix);
 }
 
+void MRE::saveCheckpoint(const std::string &prefix)
+{
+  if (!knownness_forest) {
+    throw std::logic_error("MRE::saveCheckpoint: knownness_forest has not been initialized");
+  }
+  std::string path = prefix + "mre_checkpoint.bin";
+  std::ofstream out(path + ".tmp", std::ios::binary | std::ios::trunc);
+  if (!out.good()) {
+    throw std::runtime_error("MRE::saveCheckpoint: failed to open '" + path + ".tmp'");
+  }
+  binary_io::writeHeader(out, checkpoint_magic, checkpoint_version);
+  binary_io::write<int32_t>(out, nb_fed_samples);
+  samples.write(out);
+  knownness_forest->write(out);
+  out.close();
+  if (out.fail() || std::rename((path + ".tmp").c_str(), path.c_str()) != 0) {
+    throw std::runtime_error("MRE::saveCheckpoint: failed to write '" + path + "'");
+  }
+}
+
+void MRE::loadCheckpoint(const std::string &prefix)
+{
+  std::string path = prefix + "mre_checkpoint.bin";
+  std::ifstream in(path, std::ios::binary);
+  if (!in.good()) {
+    throw std::runtime_error("MRE::loadCheckpoint: failed to open '" + path + "'");
+  }
+  binary_io::checkHeader(in, checkpoint_magic, checkpoint_version,
+                         "MRE::loadCheckpoint: '" + path + "'");
+  int read_nb_fed_samples = binary_io::read<int32_t>(in);
+  SampleStore read_samples;
+  read_samples.read(in);
+  // Knownness forest is rebuilt from scratch with the current limits
+  updateQSpaceLimits();
+  knownness_forest->read(in);
+  samples = std::move(read_samples);
+  nb_fed_samples = read_nb_fed_samples;
+  rebuildSimilarityIndex();
+}
+
+void MRE::rebuildSimilarityIndex()
+{
+  // The similarity index contains exactly the samples kept
+  similarity_index.reset(mrefpf_conf.filter_tolerance);
+  if (mrefpf_conf.filter_samples && samples.size() > 0)
+  {
+    int s_dim = samples.stateDims();
+    int a_dim = samples.actionDims();
+    Eigen::VectorXd knownness_point(s_dim + a_dim);
+    Eigen::VectorXd state(s_dim), action(a_dim);
+    for (int i = 0; i < samples.size(); i++)
+    {
+      samples.getState(i, &state);
+      samples.getAction(i, &action);
+      knownness_point.segment(    0, s_dim) = state;
+      knownness_point.segment(s_dim, a_dim) = action;
+      similarity_index.insert(knownness_point);
+    }
+  }
+}
+
 void MRE::setStateLimits(const Eigen::MatrixXd & limits)
 {
   Learner::setStateLimits(limits);
@@ -183,6 +320,7 @@ void MRE::updateQSpaceLimits()
   knownness_forest = std::shared_ptr<KnownnessForest>(new KnownnessForest(q_space,
                                                                           knownness_conf));
   solver.setKnownnessFunc(knownness_forest);
+  rebuildSimilarityIndex();
 }
 
 std::string MRE::class_name() const
@@ -202,6 +340,7 @@ void MRE::from_xml(TiXmlNode *node)
   rosban_utils::xml_tools::try_read<int>(node, "plan_period", plan_period);
   mrefpf_conf.read(node, "mrefpf_conf");
   knownness_conf.tryRead(node, "knownness_conf");
+  rebuildSimilarityIndex();
 }
 
 }
@@ -1,9 +1,14 @@
 #include "rosban_csa_mdp/solvers/mre_fpf.h"
 
+#include "rosban_csa_mdp/core/worker_pool.h"
+#include "rosban_csa_mdp/knownness/knownness_forest.h"
+
 #include "rosban_regression_forests/approximations/pwc_approximation.h"
 
 #include "rosban_utils/benchmark.h"
 
+#include <atomic>
+
 using rosban_utils::Benchmark;
 using rosban_utils::TimeStamp;
 
@@ -15,7 +20,8 @@ namespace csa_mdp
 {
 
 MREFPF::Config::Config()
-  : filter_samples(false), reward_max(0), update_type(UpdateType::Alternative)
+  : filter_samples(false), filter_tolerance(1e-6), reward_max(0),
+    update_type(UpdateType::Alternative)
 {
 }
 
@@ -27,11 +33,18 @@ std::string MREFPF::Config::class_name() const
 void MREFPF::Config::to_xml(std::ostream &out) const
 {
   FPF::Config::to_xml(out);
-  rosban_utils::xml_tools::write<bool>  ("filter_samples", filter_samples, out);
-  rosban_utils::xml_tools::write<double>("reward_max"    , reward_max    , out);
+  rosban_utils::xml_tools::write<bool>  ("filter_samples"  , filter_samples  , out);
+  rosban_utils::xml_tools::write<double>("filter_tolerance", filter_tolerance, out);
+  rosban_utils::xml_tools::write<double>("reward_max"      , reward_max      , out);
   rosban_utils::xml_tools::write<std::string>("update_type", to_string(update_type), out);
 }
 
+void MREFPF::Config::writeQValueParameters(std::ostream &out) const
+{
+  FPF::Config::writeQValueParameters(out);
+  out << reward_max << " " << to_string(update_type) << std::endl;
+}
+
 void MREFPF::Config::from_xml(TiXmlNode *node)
 {
   FPF::Config::from_xml(node);
@@ -44,7 +57,8 @@ void MREFPF::Config::from_xml(TiXmlNode *node)
     update_type = loadUpdateType(update_type_str);
   }
   // Optional parameters
-  rosban_utils::xml_tools::try_read<bool>(node, "filter_samples", filter_samples);
+  rosban_utils::xml_tools::try_read<bool>  (node, "filter_samples"  , filter_samples  );
+  rosban_utils::xml_tools::try_read<double>(node, "filter_tolerance", filter_tolerance);
 }
 
 MREFPF::MREFPF()
@@ -61,7 +75,56 @@ void MREFPF::setKnownnessFunc(std::shared_ptr<KnownnessFunction> new_knownness_f
   knownness_func = new_knownness_func;
 }
 
-TrainingSet MREFPF::getTrainingSet(const std::vector<Sample> &samples,
+void MREFPF::prepareSolve(const SampleSource &samples, const FPF::Config &conf_fpf)
+{
+  const MREFPF::Config &conf = dynamic_cast<const MREFPF::Config &>(conf_fpf);
+  sample_knownness.clear();
+  leaf_knownness.clear();
+  if (conf.update_type != UpdateType::MRE &&
+      conf.update_type != UpdateType::MRE_CI) return;
+  if (!knownness_func) {
+    throw std::logic_error("MREFPF::prepareSolve: knownness_func has not been set");
+  }
+  int x_dim = samples.stateDims();
+  int u_dim = samples.actionDims();
+  sample_knownness.resize(samples.size());
+  WorkerPool::runParallelTask([&](int start, int end)
+                              {
+                                Eigen::VectorXd state(x_dim), action(u_dim);
+                                Eigen::VectorXd input(x_dim + u_dim);
+                                for (int i = start; i < end; i++) {
+                                  samples.getState(i, &state);
+                                  samples.getAction(i, &action);
+                                  input.segment(0, x_dim) = state;
+                                  input.segment(x_dim, u_dim) = action;
+                                  sample_knownness[i] = this->knownness_func->getValue(input);
+                                }
+                              },
+                              samples.size(), conf.nb_threads);
+}
+
+void MREFPF::finishSolve()
+{
+  sample_knownness.clear();
+  leaf_knownness.clear();
+}
+
+void MREFPF::writeQValueState(const FPF::Config &conf_fpf, std::ostream &out) const
+{
+  const MREFPF::Config &conf = dynamic_cast<const MREFPF::Config &>(conf_fpf);
+  if (!knownness_func || conf.update_type == UpdateType::Disabled) return;
+  const KnownnessForest * forest = dynamic_cast<const KnownnessForest *>(knownness_func.get());
+  if (forest != nullptr) {
+    forest->write(out);
+    return;
+  }
+  // The state of other knownness functions is unknown, a different value is
+  // written for each key, thus checkpoints are never resumed
+  static std::atomic<uint64_t> nb_unknown_states(0);
+  out << "unknown_knownness_state " << nb_unknown_states++;
+}
+
+TrainingSet MREFPF::getTrainingSet(const SampleSource &samples,
                                    std::function<bool(const Eigen::VectorXd&)> is_terminal,
                                    const FPF::Config &conf_fpf,
                                    int start_index, int end_index)
@@ -73,7 +136,9 @@ TrainingSet MREFPF::getTrainingSet(const std::vector<Sample> &samples,
   // Modify samples only in MRE mode
   if (conf.update_type != UpdateType::MRE &&
       conf.update_type != UpdateType::MRE_CI) return original_ts;
-  // Otherwise use knownness to influence samples
+  // Otherwise use knownness to influence samples, the values computed by
+  // prepareSolve are used if they are available
+  bool use_table = sample_knownness.size() == (size_t)samples.size();
   TrainingSet new_ts(original_ts.getInputDim());
   for (size_t i = 0; i < original_ts.size(); i++)
   {
@@ -82,7 +147,13 @@ TrainingSet MREFPF::getTrainingSet(const std::vector<Sample> &samples,
     Eigen::VectorXd input = original_sample.getInput();
     double reward         = original_sample.getOutput();
     // Getting knownness of the input and fake reward
-    double knownness = knownness_func->getValue(input);
+    double knownness;
+    if (use_table) {
+      knownness = sample_knownness[start_index + i];
+    }
+    else {
+      knownness = knownness_func->getValue(input);
+    }
     double fake_reward = conf.reward_max;
     if (conf.update_type == UpdateType::MRE_CI && q_value) {
       double reward_std_dev = std::sqrt(q_value->getVar(input));
@@ -95,7 +166,7 @@ TrainingSet MREFPF::getTrainingSet(const std::vector<Sample> &samples,
 }
 
 
-void MREFPF::updateQValue(const std::vector<Sample> &samples,
+void MREFPF::updateQValue(const SampleSource &samples,
                           std::function<bool(const Eigen::VectorXd&)> is_terminal,
                           FPF::Config &conf_fpf,
                           bool last_step)
@@ -105,53 +176,58 @@ void MREFPF::updateQValue(const std::vector<Sample> &samples,
   // If type is not alternative, end here
   if (conf.update_type != UpdateType::Alternative) return;
   Benchmark::open("Applying knownness (Alternative)");
-  regression_forests::Node::Function f = [this, &conf](regression_forests::Node * node,
-                                                       const Eigen::MatrixXd & limits)
+  // Gathering the leaves and their middle points
+  std::vector<regression_forests::Node *> leaves;
+  std::vector<std::vector<double>> middle_points;
+  regression_forests::Node::Function f = [&leaves, &middle_points](regression_forests::Node * node,
+                                                                   const Eigen::MatrixXd & limits)
     {
-      // Throw an error if approximation is not PWC
-      std::shared_ptr<const PWCApproximation> pwc_app;
-      pwc_app = std::dynamic_pointer_cast<const PWCApproximation>(node->a);
-      if (!pwc_app)
-      {
-        throw std::logic_error("Alternative update is only available for pwc approximations");
-      }
-      // Compute knownness and old value
       Eigen::VectorXd middle_point = (limits.col(1) + limits.col(0)) / 2;
-      double knownness = this->knownness_func->getValue(middle_point);
-      double old_val = pwc_app->getValue();
-      double new_val = old_val * knownness + (1 - knownness) * conf.reward_max;
-      node->a = std::shared_ptr<Approximation>(new PWCApproximation(new_val));
+      leaves.push_back(node);
+      middle_points.push_back(std::vector<double>(middle_point.data(),
+                                                  middle_point.data() + middle_point.size()));
     };
   Eigen::MatrixXd limits = conf.getInputLimits();
   q_value->applyOnLeafs(limits, f);
-  Benchmark::close();
-}
-
-std::vector<Sample> MREFPF::filterSimilarSamples(const std::vector<Sample> &samples) const
-{
-  std::vector<Sample> filtered_samples;
-  for (const Sample &new_sample : samples)
+  // Knownness is only computed for leaves which were not encountered during
+  // previous iterations
+  std::vector<int> missing;
+  for (size_t leaf_id = 0; leaf_id < leaves.size(); leaf_id++)
+  {
+    if (leaf_knownness.count(middle_points[leaf_id]) == 0) missing.push_back(leaf_id);
+  }
+  std::vector<double> missing_knownness(missing.size());
+  WorkerPool::runParallelTask([&](int start, int end)
+                              {
+                                for (int i = start; i < end; i++) {
+                                  const std::vector<double> & point = middle_points[missing[i]];
+                                  Eigen::VectorXd middle_point =
+                                    Eigen::Map<const Eigen::VectorXd>(point.data(), point.size());
+                                  missing_knownness[i] = this->knownness_func->getValue(middle_point);
+                                }
+                              },
+                              missing.size(), conf.nb_threads);
+  for (size_t i = 0; i < missing.size(); i++)
   {
-    bool found_similar = false;
-    double tolerance = std::pow(10,-6);
-    for (const Sample &known_sample : filtered_samples)
+    leaf_knownness[middle_points[missing[i]]] = missing_knownness[i];
+  }
+  // Updating the values of the leaves
+  for (size_t leaf_id = 0; leaf_id < leaves.size(); leaf_id++)
+  {
+    regression_forests::Node * node = leaves[leaf_id];
+    // Throw an error if approximation is not PWC
+    std::shared_ptr<const PWCApproximation> pwc_app;
+    pwc_app = std::dynamic_pointer_cast<const PWCApproximation>(node->a);
+    if (!pwc_app)
     {
-      Eigen::VectorXd state_diff = known_sample.state - new_sample.state;
-      Eigen::VectorXd action_diff = known_sample.action - new_sample.action;
-      // Which is the highest difference between the two samples?
-      double max_diff = std::max(state_diff.lpNorm<Eigen::Infinity>(),
-                                 action_diff.lpNorm<Eigen::Infinity>());
-      if (max_diff < tolerance)
-      {
-        found_similar = true;
-        break;
-      }
+      throw std::logic_error("Alternative update is only available for pwc approximations");
     }
-    // Do not add similar samples
-    if (found_similar) continue;
-    filtered_samples.push_back(new_sample);
+    double knownness = leaf_knownness[middle_points[leaf_id]];
+    double old_val = pwc_app->getValue();
+    double new_val = old_val * knownness + (1 - knownness) * conf.reward_max;
+    node->a = std::shared_ptr<Approximation>(new PWCApproximation(new_val));
   }
-  return filtered_samples;
+  Benchmark::close();
 }
 
 std::string to_string(MREFPF::UpdateType type)
@@ -1,14 +1,16 @@
 #include "rosban_csa_mdp/solvers/pf_fpf.h"
 
+#include "rosban_csa_mdp/core/worker_pool.h"
+
 #include "rosban_random/tools.h"
 
+#include "rosban_utils/multi_core.h"
 #include "rosban_utils/time_stamp.h"
 
 #include <iostream>
-#include <mutex>
 #include <sstream>
-#include <thread>
 
+using rosban_utils::MultiCore;
 using rosban_utils::TimeStamp;
 
 using regression_forests::Approximation;
@@ -27,6 +29,7 @@ PF_FPF::Config::Config()
   horizon = 1;
   discount = 0.99;
   max_action_tiles = 0;
+  max_query_tiles = 0;
   q_value_time = 0;
   policy_time = 0;
 }
@@ -83,6 +86,7 @@ void PF_FPF::Config::to_xml(std::ostream &out) const
   rosban_utils::xml_tools::write<int>("nb_threads", nb_threads, out);
   rosban_utils::xml_tools::write<double>("discount", discount, out);
   rosban_utils::xml_tools::write<int>("max_action_tiles", max_action_tiles, out);
+  rosban_utils::xml_tools::write<int>("max_query_tiles", max_query_tiles, out);
   rosban_utils::xml_tools::write<double>("q_value_time", q_value_time, out);
   rosban_utils::xml_tools::write<double>("policy_time", policy_time, out);
 }
@@ -108,6 +112,7 @@ void PF_FPF::Config::from_xml(TiXmlNode *node)
   max_action_tiles = rosban_utils::xml_tools::read<int>   (node, "max_action_tiles");
   q_value_time     = rosban_utils::xml_tools::read<double>(node, "q_value_time");
   policy_time      = rosban_utils::xml_tools::read<double>(node, "policy_time");
+  rosban_utils::xml_tools::try_read<int>(node, "max_query_tiles", max_query_tiles);
 }
 
 PF_FPF::PF_FPF()
@@ -119,37 +124,37 @@ TrainingSet PF_FPF::getTrainingSet(const std::vector<Sample> &samples,
                                    const Config &conf,
                                    std::shared_ptr<regression_forests::Forest> q_value)
 {
-  std::vector<std::thread> threads;
-  std::mutex ts_mutex;
   int x_dim = conf.getStateLimits().rows();
   int u_dim = conf.getActionLimits().rows();
-  TrainingSet ts(x_dim + u_dim);
-  double samples_by_thread = samples.size() / (double)conf.nb_threads;
-  for (int thread_no = 0; thread_no < conf.nb_threads; thread_no++)
-  {
-    // Compute samples in [start, end[
-    int start = std::floor(thread_no * samples_by_thread);
-    int end = std::floor((thread_no + 1) * samples_by_thread);
-    threads.push_back(std::thread([&]()
-                                  {
-                                    TrainingSet thread_ts = this->getTrainingSet(samples,
-                                                                                 is_terminal,
-                                                                                 conf,
-                                                                                 q_value,
-                                                                                 start,
-                                                                                 end);
-                                    // Only one thread at a time can push its collection
-                                    ts_mutex.lock();
-                                    for (size_t sample = 0; sample < thread_ts.size(); sample++)
-                                    {
-                                      ts.push(thread_ts(sample));
-                                    }
-                                    ts_mutex.unlock();
-                                  }));
+  MultiCore::Intervals intervals = MultiCore::buildIntervals(samples.size(), conf.nb_threads);
+  // Each job fills its own slot, no synchronization is required
+  std::vector<TrainingSet> thread_ts(intervals.size(), TrainingSet(x_dim + u_dim));
+  // The forest is flattened once, all the jobs share the query
+  std::unique_ptr<ForestMaxQuery> q_max_query;
+  if (q_value) {
+    q_max_query.reset(new ForestMaxQuery(*q_value, conf.getInputLimits(), x_dim,
+                                         conf.max_query_tiles));
   }
-  for (int thread_no = 0; thread_no < conf.nb_threads; thread_no++)
+  // Each job computes the samples of its interval
+  WorkerPool::getInstance().run(intervals.size(), [&](int thread_no)
+                                {
+                                  int start = intervals[thread_no].first;
+                                  int end = intervals[thread_no].second;
+                                  thread_ts[thread_no] = this->getTrainingSet(samples, is_terminal, conf,
+                                                                              q_max_query.get(),
+                                                                              start, end);
+                                },
+                                conf.nb_threads);
+  // Gathering slots in the order of the intervals, thus the order of the
+  // samples does not depend on nb_threads or on the scheduling
+  TrainingSet ts(x_dim + u_dim);
+  for (size_t thread_no = 0; thread_no < intervals.size(); thread_no++)
   {
-    threads[thread_no].join();
+    const TrainingSet & to_add = thread_ts[thread_no];
+    for (size_t sample = 0; sample < to_add.size(); sample++)
+    {
+      ts.push(to_add(sample));
+    }
   }
   return ts;
 }
@@ -157,12 +162,14 @@ TrainingSet PF_FPF::getTrainingSet(const std::vector<Sample> &samples,
 TrainingSet PF_FPF::getTrainingSet(const std::vector<Sample>& samples,
                                    std::function<bool(const Eigen::VectorXd&)> is_terminal,
                                    const Config &conf,
-                                   std::shared_ptr<regression_forests::Forest> q_value,
+                                   const ForestMaxQuery * q_max_query,
                                    int start_idx, int end_idx)
 {
   int x_dim = conf.getStateLimits().rows();
   int u_dim = conf.getActionLimits().rows();
   TrainingSet ls(x_dim + u_dim);
+  // Each call uses its own scratch buffers
+  ForestMaxQuery::Scratch scratch;
   for (int i = start_idx; i < end_idx; i++) {
     const Sample& sample = samples[i];
     int x_dim = sample.state.rows();
@@ -172,15 +179,8 @@ TrainingSet PF_FPF::getTrainingSet(const std::vector<Sample>& samples,
     input.segment(x_dim, u_dim) = sample.action;
     Eigen::VectorXd next_state = sample.next_state;
     double reward = sample.reward;
-    if (q_value && !is_terminal(next_state)) {
-      // Establishing limits for projection
-      Eigen::MatrixXd limits(x_dim + u_dim, 2);
-      limits.block(    0, 0, x_dim, 1) = next_state;
-      limits.block(    0, 1, x_dim, 1) = next_state;
-      limits.block(x_dim, 0, u_dim, 2) = conf.getActionLimits();
-      std::unique_ptr<regression_forests::Tree> sub_tree;
-      sub_tree = q_value->unifiedProjectedTree(limits, conf.max_action_tiles);
-      reward += conf.discount * sub_tree->getMax(limits);
+    if (q_max_query != nullptr && !is_terminal(next_state)) {
+      reward += conf.discount * q_max_query->getMax(next_state, &scratch);
     }
     ls.push(regression_forests::Sample(input, reward));
   }
@@ -3,6 +3,7 @@
 #include "rosban_csa_mdp/core/fa_policy.h"
 #include "rosban_csa_mdp/core/policy_factory.h"
 #include "rosban_csa_mdp/core/random_policy.h"
+#include "rosban_csa_mdp/core/rollout_engine.h"
 #include "rosban_csa_mdp/value_approximators/value_approximator_factory.h"
 
 #include "rosban_fa/optimizer_trainer_factory.h"
@@ -93,30 +94,17 @@ TreePolicyIteration::updatePolicy(std::default_random_engine * engine) {
      const Eigen::VectorXd & actions,
      std::default_random_engine * engine)
     {
-      // Computing first step reward and successor
-      Eigen::VectorXd state = parameters;
-      Problem::Result result = problem->getSuccessor(state, actions, engine);
-      // If a value approximator is used, only one step is required
+      // The first step uses the provided actions, then the current policy is
+      // followed. If a value approximator is used, only one step is required
+      int horizon = this->use_value_approximator ? 1 : this->trial_length;
+      Eigen::MatrixXd first_actions = actions;
+      RolloutEngine rollout_engine(*problem);
+      rollout_engine.run(parameters, *policy, horizon, this->discount, engine, &first_actions);
+      double reward = rollout_engine.getRewards()(0);
       if (this->use_value_approximator) {
         double value, value_var;
-        this->value->predict(result.successor, value, value_var);
-        return result.reward + this->discount * value;
-      }
-      // Otherwise, do multiple steps
-      double reward = result.reward;
-      state = result.successor;
-      double gain = this->discount;
-      for (int step = 1; step < this->trial_length; step++) {
-        // Stop iterations if we reached a terminal state
-        if (result.terminal) break;
-        // Computing step
-        Eigen::VectorXd action = policy->getAction(state, engine);
-        result = problem->getSuccessor(state, action, engine);
-        // Accumulating reward
-        reward += result.reward * gain;
-        // Updating values
-        state = result.successor;
-        gain *= discount;
+        this->value->predict(rollout_engine.getFinalStates().col(0), value, value_var);
+        reward += this->discount * value;
       }
       return reward;
     };
@@ -1,5 +1,6 @@
 #include "rosban_csa_mdp/value_approximators/extra_trees_approximator.h"
 
+#include "rosban_csa_mdp/core/worker_pool.h"
 #include "rosban_csa_mdp/reward_predictors/reward_predictor_factory.h"
 #include "rosban_fa/trainer_factory.h"
 
@@ -46,7 +47,7 @@ ExtraTreesApproximator::train(const Policy & policy,
         Eigen::VectorXd state = inputs.col(sample);
         double mean, var;
         predictor->predict(state, policy,
-                           problem.getResultFunction(),
+                           problem.getBatchResultFunction(),
                            current_value_function,
                            discount,
                            &mean, &var,
@@ -54,23 +55,11 @@ ExtraTreesApproximator::train(const Policy & policy,
         observations(sample) = mean;
       }
     };
-  // Choosing how many threads will be used for the samples and how many
-  // subthreads will be spawned by each thread
-  int wished_threads = nb_threads;
-  int subthreads = 1;
-  // Increasing performances when the number of samples is small, but ensuring that
-  // no more than nb_threads are created
-  if (nb_threads > nb_samples) {
-    subthreads = std::ceil(nb_threads / (double)nb_samples);
-    wished_threads = nb_threads / subthreads;
-  }
-  predictor->setNbThreads(subthreads);
-
-  // Preparing random_engines
-  std::vector<std::default_random_engine> engines;
-  engines = rosban_random::getRandomEngines(wished_threads, engine);
-  // Run threads in parallel
-  MultiCore::runParallelStochasticTask(rp_task, nb_samples, &engines);
+  // Nested tasks of the predictor are submitted to the shared pool, thus idle
+  // workers steal them when there are less samples than threads
+  predictor->setNbThreads(nb_threads);
+  // Run tasks in parallel
+  WorkerPool::runBalancedStochasticTask(rp_task, nb_samples, nb_threads, engine);
   // Approximate the gathered samples
   return trainer->train(inputs, observations, problem.getStateLimits());
 }
@@ -0,0 +1,161 @@
+#include "rosban_csa_mdp/core/sample_store.h"
+
+#include <gtest/gtest.h>
+
+#include <sstream>
+#include <stdexcept>
+
+using csa_mdp::SampleStore;
+
+namespace
+{
+
+Eigen::MatrixXd getLimits(int dims, double min, double max)
+{
+  Eigen::MatrixXd limits(dims, 2);
+  limits.col(0).fill(min);
+  limits.col(1).fill(max);
+  return limits;
+}
+
+/// A Quantized16 store with 2 state dimensions in [-1,1] and 1 action
+/// dimension in [0,10]
+SampleStore getQuantizedStore()
+{
+  SampleStore store(2, 1, SampleStore::Precision::Quantized16);
+  store.setLimits(getLimits(2, -1, 1), getLimits(1, 0, 10));
+  return store;
+}
+
+}
+
+TEST(SampleStore, quantizationErrorIsBounded)
+{
+  SampleStore store = getQuantizedStore();
+  double state_step = 2.0 / 65535;
+  double action_step = 10.0 / 65535;
+  for (int i = 0; i < 100; i++) {
+    double x = -1 + 2 * i / 99.0;
+    Eigen::Vector2d state(x, 0.3 * x);
+    Eigen::Vector2d next_state(-x, 0.123456789);
+    Eigen::VectorXd action = Eigen::VectorXd::Constant(1, 0.1 * i);
+    store.push(state, action, next_state, i);
+  }
+  ASSERT_EQ(100, store.size());
+  Eigen::VectorXd state, action, next_state;
+  for (int i = 0; i < 100; i++) {
+    double x = -1 + 2 * i / 99.0;
+    store.getState(i, &state);
+    store.getAction(i, &action);
+    store.getNextState(i, &next_state);
+    EXPECT_NEAR(x, state(0), state_step / 2 + 1e-12);
+    EXPECT_NEAR(0.3 * x, state(1), state_step / 2 + 1e-12);
+    EXPECT_NEAR(-x, next_state(0), state_step / 2 + 1e-12);
+    EXPECT_NEAR(0.1 * i, action(0), action_step / 2 + 1e-12);
+    // Rewards are never quantized
+    EXPECT_EQ(i, store.reward(i));
+  }
+  Eigen::VectorXd state_error = store.getMaxStateError();
+  ASSERT_EQ(2, state_error.rows());
+  EXPECT_GT(state_error.maxCoeff(), 0);
+  EXPECT_LE(state_error.maxCoeff(), state_step / 2 + 1e-12);
+  EXPECT_LE(store.getMaxActionError()(0), action_step / 2 + 1e-12);
+}
+
+TEST(SampleStore, quantizationSaturatesOutsideLimits)
+{
+  SampleStore store = getQuantizedStore();
+  store.push(Eigen::Vector2d(-3, 5), Eigen::VectorXd::Constant(1, 20),
+             Eigen::Vector2d(1, -1), 0);
+  Eigen::VectorXd state, action;
+  store.getState(0, &state);
+  store.getAction(0, &action);
+  EXPECT_DOUBLE_EQ(-1, state(0));
+  EXPECT_DOUBLE_EQ(1, state(1));
+  EXPECT_DOUBLE_EQ(10, action(0));
+  EXPECT_NEAR(4, store.getMaxStateError().maxCoeff(), 1e-12);
+}
+
+TEST(SampleStore, quantizationRequiresLimits)
+{
+  SampleStore store(2, 1, SampleStore::Precision::Quantized16);
+  EXPECT_THROW(store.push(Eigen::Vector2d::Zero(), Eigen::VectorXd::Zero(1),
+                          Eigen::Vector2d::Zero(), 0),
+               std::logic_error);
+  EXPECT_THROW(store.setLimits(getLimits(3, -1, 1), getLimits(1, 0, 10)),
+               std::runtime_error);
+}
+
+TEST(SampleStore, limitsAreFrozenOnceQuantizedSamplesAreStored)
+{
+  SampleStore store = getQuantizedStore();
+  store.push(Eigen::Vector2d(0.5, 0.5), Eigen::VectorXd::Constant(1, 5),
+             Eigen::Vector2d(0.5, 0.5), 1);
+  EXPECT_THROW(store.setLimits(getLimits(2, -2, 2), getLimits(1, 0, 20)),
+               std::logic_error);
+  // Stored samples are still decoded with the original limits
+  Eigen::VectorXd state;
+  store.getState(0, &state);
+  EXPECT_NEAR(0.5, state(0), 1.0 / 65535);
+  // Limits can be changed once the store has been cleared
+  store.clear();
+  EXPECT_NO_THROW(store.setLimits(getLimits(2, -2, 2), getLimits(1, 0, 20)));
+  store.push(Eigen::Vector2d(1.5, -1.5), Eigen::VectorXd::Constant(1, 15),
+             Eigen::Vector2d(0, 0), 0);
+  store.getState(0, &state);
+  EXPECT_NEAR(1.5, state(0), 2.0 / 65535);
+  EXPECT_NEAR(-1.5, state(1), 2.0 / 65535);
+}
+
+TEST(SampleStore, quantizedStoreHasNoViews)
+{
+  SampleStore store = getQuantizedStore();
+  store.push(Eigen::Vector2d::Zero(), Eigen::VectorXd::Zero(1),
+             Eigen::Vector2d::Zero(), 0);
+  EXPECT_THROW(store.state(0), std::logic_error);
+  EXPECT_THROW(store.states(), std::logic_error);
+  EXPECT_NO_THROW(store.rewards());
+}
+
+TEST(SampleStore, quantizedStoreUsesLessMemory)
+{
+  SampleStore quantized = getQuantizedStore();
+  SampleStore exact(2, 1);
+  quantized.reserve(1000);
+  exact.reserve(1000);
+  EXPECT_LT(quantized.getMemoryUsage(), exact.getMemoryUsage());
+}
+
+TEST(SampleStore, quantizedWriteReadIsLossless)
+{
+  SampleStore store = getQuantizedStore();
+  for (int i = 0; i < 10; i++) {
+    store.push(Eigen::Vector2d(0.1 * i - 0.5, 0.01 * i), Eigen::VectorXd::Constant(1, i),
+               Eigen::Vector2d(-0.1 * i, 0.2), -i);
+  }
+  std::stringstream stream;
+  store.write(stream);
+  SampleStore copy;
+  copy.read(stream);
+  ASSERT_EQ(store.size(), copy.size());
+  EXPECT_TRUE(copy.getPrecision() == SampleStore::Precision::Quantized16);
+  Eigen::VectorXd expected, received;
+  for (int i = 0; i < store.size(); i++) {
+    store.getState(i, &expected);
+    copy.getState(i, &received);
+    EXPECT_EQ(expected, received);
+    store.getAction(i, &expected);
+    copy.getAction(i, &received);
+    EXPECT_EQ(expected, received);
+    store.getNextState(i, &expected);
+    copy.getNextState(i, &received);
+    EXPECT_EQ(expected, received);
+    EXPECT_EQ(store.reward(i), copy.reward(i));
+  }
+}
+
+int main(int argc, char ** argv)
+{
+  testing::InitGoogleTest(&argc, argv);
+  return RUN_ALL_TESTS();
+}
@@ -0,0 +1,141 @@
+#include "rosban_csa_mdp/core/similarity_index.h"
+
+#include <gtest/gtest.h>
+
+#include <limits>
+#include <random>
+#include <stdexcept>
+
+using csa_mdp::SimilarityIndex;
+
+namespace
+{
+
+/// Index of the first point of 'points' similar to 'point' or -1
+int bruteForceFind(const std::vector<Eigen::VectorXd> & points,
+                   const Eigen::VectorXd & point, double tolerance)
+{
+  for (size_t idx = 0; idx < points.size(); idx++) {
+    if ((points[idx] - point).lpNorm<Eigen::Infinity>() < tolerance) return idx;
+  }
+  return -1;
+}
+
+}
+
+TEST(SimilarityIndex, insertsOnlyDistinctPoints)
+{
+  SimilarityIndex index(0.1);
+  EXPECT_EQ(0, index.size());
+  EXPECT_FALSE(index.hasSimilar(Eigen::Vector2d(0.5, 0.5)));
+  EXPECT_TRUE(index.insert(Eigen::Vector2d(0.5, 0.5)));
+  EXPECT_FALSE(index.insert(Eigen::Vector2d(0.5, 0.5)));
+  EXPECT_FALSE(index.insert(Eigen::Vector2d(0.55, 0.45)));
+  EXPECT_TRUE(index.insert(Eigen::Vector2d(0.65, 0.5)));
+  EXPECT_EQ(2, index.size());
+  EXPECT_EQ(0, index.findSimilar(Eigen::Vector2d(0.52, 0.48)));
+  EXPECT_EQ(1, index.findSimilar(Eigen::Vector2d(0.7, 0.5)));
+  EXPECT_EQ(-1, index.findSimilar(Eigen::Vector2d(0.5, 0.7)));
+}
+
+TEST(SimilarityIndex, findsPointsInNeighborCells)
+{
+  double tolerance = 0.01;
+  SimilarityIndex index(tolerance);
+  double border = SimilarityIndex::cell_factor * tolerance;
+  // Both points are on opposite sides of a cell border along each dimension
+  Eigen::Vector3d point = Eigen::Vector3d::Constant(border - 0.4 * tolerance);
+  index.insert(point);
+  Eigen::Vector3d query = Eigen::Vector3d::Constant(border + 0.4 * tolerance);
+  EXPECT_TRUE(index.hasSimilar(query));
+  query(1) = border - 0.3 * tolerance;
+  EXPECT_TRUE(index.hasSimilar(query));
+  // Negative coordinates
+  index.insert(-point);
+  EXPECT_EQ(1, index.findSimilar(-query));
+}
+
+TEST(SimilarityIndex, matchesBruteForce)
+{
+  double tolerance = 0.05;
+  SimilarityIndex index(tolerance);
+  std::vector<Eigen::VectorXd> points;
+  std::default_random_engine engine(0);
+  std::uniform_real_distribution<double> distribution(-1, 1);
+  for (int i = 0; i < 2000; i++) {
+    Eigen::VectorXd point(3);
+    for (int d = 0; d < 3; d++) {
+      point(d) = distribution(engine);
+    }
+    bool expected_insertion = bruteForceFind(points, point, tolerance) < 0;
+    ASSERT_EQ(!expected_insertion, index.hasSimilar(point));
+    ASSERT_EQ(expected_insertion, index.insert(point));
+    if (expected_insertion) {
+      points.push_back(point);
+    }
+  }
+  EXPECT_EQ((int)points.size(), index.size());
+  // Queries close to the stored points
+  std::uniform_real_distribution<double> noise(-2 * tolerance, 2 * tolerance);
+  for (size_t i = 0; i < points.size(); i += 5) {
+    Eigen::VectorXd query = points[i];
+    for (int d = 0; d < 3; d++) {
+      query(d) += noise(engine);
+    }
+    int expected = bruteForceFind(points, query, tolerance);
+    int received = index.findSimilar(query);
+    EXPECT_EQ(expected >= 0, received >= 0);
+    if (received >= 0) {
+      EXPECT_LT((points[received] - query).lpNorm<Eigen::Infinity>(), tolerance);
+    }
+  }
+}
+
+TEST(SimilarityIndex, handlesManyDimensions)
+{
+  // Points close to cell borders along more than max_border_dims dimensions
+  int dims = SimilarityIndex::max_border_dims + 10;
+  double tolerance = 0.01;
+  double border = SimilarityIndex::cell_factor * tolerance;
+  SimilarityIndex index(tolerance);
+  Eigen::VectorXd point = Eigen::VectorXd::Constant(dims, border - 0.1 * tolerance);
+  EXPECT_TRUE(index.insert(point));
+  Eigen::VectorXd query = Eigen::VectorXd::Constant(dims, border + 0.1 * tolerance);
+  EXPECT_TRUE(index.hasSimilar(query));
+  query(0) += tolerance;
+  EXPECT_FALSE(index.hasSimilar(query));
+}
+
+TEST(SimilarityIndex, rejectsInvalidPoints)
+{
+  SimilarityIndex index(0.1);
+  index.insert(Eigen::Vector2d(0, 0));
+  EXPECT_THROW(index.insert(Eigen::Vector3d(0, 0, 0)), std::runtime_error);
+  EXPECT_THROW(index.hasSimilar(Eigen::Vector3d(0, 0, 0)), std::runtime_error);
+  double nan = std::numeric_limits<double>::quiet_NaN();
+  EXPECT_THROW(index.insert(Eigen::Vector2d(nan, 0)), std::runtime_error);
+  double inf = std::numeric_limits<double>::infinity();
+  EXPECT_THROW(index.hasSimilar(Eigen::Vector2d(0, inf)), std::runtime_error);
+  EXPECT_THROW(index.insert(Eigen::Vector2d(1e300, 0)), std::runtime_error);
+  EXPECT_EQ(1, index.size());
+}
+
+TEST(SimilarityIndex, resetChangesTolerance)
+{
+  SimilarityIndex index(0.1);
+  index.insert(Eigen::Vector2d(0, 0));
+  EXPECT_TRUE(index.hasSimilar(Eigen::Vector2d(0.05, 0)));
+  index.reset(0.01);
+  EXPECT_EQ(0, index.size());
+  EXPECT_DOUBLE_EQ(0.01, index.getTolerance());
+  // Dimension is deduced again from the first point
+  index.insert(Eigen::Vector3d(0, 0, 0));
+  EXPECT_FALSE(index.hasSimilar(Eigen::Vector3d(0.05, 0, 0)));
+  EXPECT_THROW(index.reset(0), std::logic_error);
+}
+
+int main(int argc, char ** argv)
+{
+  testing::InitGoogleTest(&argc, argv);
+  return RUN_ALL_TESTS();
+}
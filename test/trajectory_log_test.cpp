@@ -0,0 +1,187 @@
+#include "rosban_csa_mdp/core/trajectory_log.h"
+
+#include <gtest/gtest.h>
+
+#include <cstddef>
+#include <cstdio>
+#include <fstream>
+#include <stdexcept>
+
+using csa_mdp::History;
+using csa_mdp::Sample;
+using csa_mdp::TrajectoryLog;
+
+namespace
+{
+
+const std::string log_path("trajectory_log_test.log");
+
+/// Run 'run_id' contains 'run_id + 2' steps with 2 state dimensions and 1
+/// action dimension
+std::vector<History> getHistories(int nb_runs)
+{
+  std::vector<History> histories(nb_runs);
+  for (int run = 0; run < nb_runs; run++) {
+    for (int step = 0; step < run + 2; step++) {
+      Eigen::VectorXd state(2), action(1);
+      state << run, step;
+      action << 0.5 * step;
+      histories[run].push(state, action, run * 10 + step);
+    }
+  }
+  return histories;
+}
+
+/// Overwrite 8 bytes of the log at the given position
+void corrupt(size_t position, uint64_t value)
+{
+  std::fstream file(log_path, std::ios::in | std::ios::out | std::ios::binary);
+  file.seekp(position);
+  file.write((const char *)&value, sizeof(value));
+}
+
+TrajectoryLog::Header readHeader()
+{
+  TrajectoryLog::Header header;
+  std::ifstream in(log_path, std::ios::binary);
+  in.read((char *)&header, sizeof(header));
+  return header;
+}
+
+class TrajectoryLogTest : public testing::Test
+{
+protected:
+  void SetUp() override
+  {
+    histories = getHistories(4);
+    TrajectoryLog::write(log_path, histories, 2, 1);
+  }
+
+  void TearDown() override
+  {
+    std::remove(log_path.c_str());
+  }
+
+  std::vector<History> histories;
+};
+
+}
+
+TEST_F(TrajectoryLogTest, runsMatchHistories)
+{
+  TrajectoryLog log(log_path);
+  EXPECT_EQ(2, log.getStateDims());
+  EXPECT_EQ(1, log.getActionDims());
+  ASSERT_EQ(histories.size(), log.getNbRuns());
+  size_t nb_samples = 0;
+  for (size_t run = 0; run < histories.size(); run++) {
+    const History & history = histories[run];
+    TrajectoryLog::RunView view = log.getRun(run);
+    ASSERT_EQ(history.size(), view.size());
+    for (size_t step = 0; step < history.size(); step++) {
+      EXPECT_EQ(history.getState(step), Eigen::VectorXd(view.getState(step)));
+      EXPECT_EQ(history.getAction(step), Eigen::VectorXd(view.getAction(step)));
+      EXPECT_EQ(history.getReward(step), view.getReward(step));
+      EXPECT_EQ(history.getState(step), Eigen::VectorXd(view.getStates().col(step)));
+    }
+    nb_samples += view.getNbSamples();
+  }
+  EXPECT_EQ(History::getBatch(histories).size(), log.getNbSamples());
+  EXPECT_EQ(nb_samples, log.getNbSamples());
+}
+
+TEST_F(TrajectoryLogTest, samplesMatchHistoryBatch)
+{
+  TrajectoryLog log(log_path);
+  for (size_t run = 0; run < histories.size(); run++) {
+    std::vector<Sample> expected = histories[run].getBatch();
+    TrajectoryLog::RunView view = log.getRun(run);
+    ASSERT_EQ(expected.size(), view.getNbSamples());
+    for (size_t idx = 0; idx < expected.size(); idx++) {
+      Sample sample = view.getSample(idx).toSample();
+      EXPECT_EQ(expected[idx].state, sample.state);
+      EXPECT_EQ(expected[idx].action, sample.action);
+      EXPECT_EQ(expected[idx].next_state, sample.next_state);
+      EXPECT_EQ(expected[idx].reward, sample.reward);
+    }
+  }
+}
+
+TEST_F(TrajectoryLogTest, writerMatchesWrite)
+{
+  {
+    TrajectoryLog::Writer writer(log_path, 2, 1);
+    writer.write(histories[0]);
+    writer.startRun();
+    for (size_t step = 0; step < histories[1].size(); step++) {
+      writer.push(histories[1].getState(step), histories[1].getAction(step),
+                  histories[1].getReward(step));
+    }
+    // Empty runs are kept
+    writer.startRun();
+    writer.close();
+  }
+  TrajectoryLog log(log_path);
+  std::vector<History> read = log.toHistories();
+  ASSERT_EQ(3u, read.size());
+  EXPECT_EQ(histories[0].size(), read[0].size());
+  EXPECT_EQ(histories[1].size(), read[1].size());
+  EXPECT_EQ(histories[1].getState(2), read[1].getState(2));
+  EXPECT_EQ(0u, read[2].size());
+  EXPECT_EQ(0u, log.getRun(2).getNbSamples());
+}
+
+TEST_F(TrajectoryLogTest, invalidRunThrows)
+{
+  TrajectoryLog log(log_path);
+  EXPECT_THROW(log.getRun(histories.size()), std::out_of_range);
+}
+
+TEST_F(TrajectoryLogTest, missingFileThrows)
+{
+  EXPECT_THROW(TrajectoryLog("missing_trajectory_log_test.log"), std::runtime_error);
+}
+
+TEST_F(TrajectoryLogTest, invalidMagicThrows)
+{
+  corrupt(offsetof(TrajectoryLog::Header, magic), 0);
+  EXPECT_THROW(TrajectoryLog log(log_path), std::runtime_error);
+}
+
+TEST_F(TrajectoryLogTest, truncatedFileThrows)
+{
+  {
+    std::ofstream out(log_path, std::ios::binary | std::ios::trunc);
+    out.write("TRAJLOG", 4);
+  }
+  EXPECT_THROW(TrajectoryLog log(log_path), std::runtime_error);
+}
+
+TEST_F(TrajectoryLogTest, corruptedHeaderThrows)
+{
+  // Number of runs leading to an overflow of the index size
+  corrupt(offsetof(TrajectoryLog::Header, nb_runs), (uint64_t)-1);
+  EXPECT_THROW(TrajectoryLog log(log_path), std::runtime_error);
+  SetUp();
+  // Index located outside of the file
+  corrupt(offsetof(TrajectoryLog::Header, index_offset), (uint64_t)-8);
+  EXPECT_THROW(TrajectoryLog log(log_path), std::runtime_error);
+}
+
+TEST_F(TrajectoryLogTest, corruptedIndexThrows)
+{
+  TrajectoryLog::Header header = readHeader();
+  // Run longer than the file
+  corrupt(header.index_offset + offsetof(TrajectoryLog::RunEntry, nb_steps), 1000000);
+  EXPECT_THROW(TrajectoryLog log(log_path), std::runtime_error);
+  SetUp();
+  // Run starting outside of the file
+  corrupt(header.index_offset + offsetof(TrajectoryLog::RunEntry, offset), (uint64_t)-8);
+  EXPECT_THROW(TrajectoryLog log(log_path), std::runtime_error);
+}
+
+int main(int argc, char ** argv)
+{
+  testing::InitGoogleTest(&argc, argv);
+  return RUN_ALL_TESTS();
+}
@@ -0,0 +1,126 @@
+#include "rosban_csa_mdp/core/worker_pool.h"
+
+#include <gtest/gtest.h>
+
+#include <algorithm>
+#include <chrono>
+#include <stdexcept>
+
+using csa_mdp::WorkerPool;
+
+TEST(WorkerPool, runsAllJobsOnce)
+{
+  std::vector<std::atomic<int>> counts(100);
+  for (std::atomic<int> & count : counts) {
+    count = 0;
+  }
+  WorkerPool::getInstance().run(counts.size(),
+                                [&counts](int job_id) { counts[job_id]++; },
+                                4);
+  for (const std::atomic<int> & count : counts) {
+    EXPECT_EQ(1, count.load());
+  }
+}
+
+TEST(WorkerPool, respectsNbThreads)
+{
+  WorkerPool & pool = WorkerPool::getInstance();
+  // More workers than allowed for the batch are available
+  pool.reserveWorkers(7);
+  std::atomic<int> nb_active(0);
+  std::atomic<int> max_active(0);
+  pool.run(64,
+           [&nb_active, &max_active](int)
+           {
+             int active = ++nb_active;
+             int previous_max = max_active.load();
+             while (active > previous_max &&
+                    !max_active.compare_exchange_weak(previous_max, active)) {
+             }
+             std::this_thread::sleep_for(std::chrono::milliseconds(2));
+             nb_active--;
+           },
+           3);
+  EXPECT_LE(max_active.load(), 3);
+  EXPECT_GE(max_active.load(), 1);
+}
+
+TEST(WorkerPool, nestedRunDoesNotDeadlock)
+{
+  std::atomic<int> nb_inner(0);
+  WorkerPool & pool = WorkerPool::getInstance();
+  pool.run(8,
+           [&pool, &nb_inner](int)
+           {
+             pool.run(8, [&nb_inner](int) { nb_inner++; }, 4);
+           },
+           4);
+  EXPECT_EQ(64, nb_inner.load());
+}
+
+TEST(WorkerPool, rethrowsJobExceptions)
+{
+  std::atomic<int> nb_executed(0);
+  EXPECT_THROW(WorkerPool::getInstance().run(16,
+                                             [&nb_executed](int job_id)
+                                             {
+                                               if (job_id == 5) {
+                                                 throw std::runtime_error("job failed");
+                                               }
+                                               nb_executed++;
+                                             },
+                                             4),
+               std::runtime_error);
+  // The batch ends only once all the other jobs have been executed
+  EXPECT_EQ(15, nb_executed.load());
+  // The pool is still usable
+  std::atomic<int> nb_after(0);
+  WorkerPool::getInstance().run(16, [&nb_after](int) { nb_after++; }, 4);
+  EXPECT_EQ(16, nb_after.load());
+}
+
+TEST(WorkerPool, singleThreadRunsInOrderOnCaller)
+{
+  for (int nb_threads : {1, 0, -1}) {
+    std::vector<int> order;
+    std::vector<std::thread::id> threads;
+    WorkerPool::getInstance().run(20,
+                                  [&order, &threads](int job_id)
+                                  {
+                                    order.push_back(job_id);
+                                    threads.push_back(std::this_thread::get_id());
+                                  },
+                                  nb_threads);
+    ASSERT_EQ(20u, order.size());
+    for (int i = 0; i < 20; i++) {
+      EXPECT_EQ(i, order[i]);
+      EXPECT_EQ(std::this_thread::get_id(), threads[i]);
+    }
+  }
+}
+
+TEST(WorkerPool, balancedTaskCoversAllIndices)
+{
+  std::vector<std::atomic<int>> counts(57);
+  for (std::atomic<int> & count : counts) {
+    count = 0;
+  }
+  std::default_random_engine engine(42);
+  WorkerPool::runBalancedStochasticTask(
+    [&counts](int start, int end, std::default_random_engine *)
+    {
+      for (int i = start; i < end; i++) {
+        counts[i]++;
+      }
+    },
+    counts.size(), 4, &engine);
+  for (const std::atomic<int> & count : counts) {
+    EXPECT_EQ(1, count.load());
+  }
+}
+
+int main(int argc, char ** argv)
+{
+  testing::InitGoogleTest(&argc, argv);
+  return RUN_ALL_TESTS();
+}